@@ -13,6 +13,11 @@ struct bitmap *bitmap_create_in_buf (size_t bit_cnt, void *, size_t byte_cnt);
 size_t bitmap_buf_size (size_t bit_cnt);
 void bitmap_destroy (struct bitmap *);
 
+/* Summaries. */
+size_t bitmap_summary_buf_size (size_t bit_cnt);
+void bitmap_summarize_in_buf (struct bitmap *, void *, size_t byte_cnt);
+bool bitmap_summarize (struct bitmap *);
+
 /* Bitmap size. */
 size_t bitmap_size (const struct bitmap *);
 
@@ -0,0 +1,19 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* LZ77-style compression of buffers of up to LZ_MAX_SIZE bytes. */
+#define LZ_MAX_SIZE 65535
+
+/* Bytes of scratch memory that lz_compress() needs. */
+#define LZ_HASH_BITS 11
+#define LZ_WORK_SIZE (sizeof (unsigned short) << LZ_HASH_BITS)
+
+size_t lz_compress (const void *src, size_t src_size,
+		void *dst, size_t dst_cap, void *work);
+bool lz_decompress (const void *src, size_t src_size,
+		void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lz.h */
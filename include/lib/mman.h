@@ -0,0 +1,76 @@
+#ifndef __LIB_MMAN_H
+#define __LIB_MMAN_H
+
+#include <stddef.h>
+
+/* Advice to madvise() on how a range of memory will be used. */
+enum {
+	MADV_NORMAL,                /* No advice; the default. */
+	MADV_RANDOM,                /* Random access: fault pages in one by one. */
+	MADV_SEQUENTIAL,            /* Sequential access: read far ahead, and
+	                               drop what was read behind. */
+	MADV_WILLNEED,              /* Will be accessed soon: read it in now. */
+	MADV_DONTNEED,              /* Not needed: free it now. */
+};
+
+/* Or'd into mmap()'s WRITABLE argument: fault the whole mapping in
+   at once, instead of page by page as it is accessed. */
+#define MAP_POPULATE 0x100
+
+/* Flags for msync(). */
+#define MS_ASYNC 1              /* Start writing back; do not wait. */
+#define MS_SYNC 4               /* Write back before returning. */
+
+/* The process ID that stands for the caller in memstat() and
+   faultstat(). */
+#define MEMSTAT_SELF 0
+
+/* A process's use of memory, as memstat() reports it.  Sizes are in
+   pages. */
+struct memstat {
+	size_t rss;                 /* Pages in memory. */
+	size_t rss_limit;           /* Most pages in memory, 0 for no limit. */
+	size_t wss;                 /* Pages accessed recently, on average. */
+	long long fault_cnt;        /* Page faults taken. */
+	unsigned fault_rate;        /* Page faults per second, lately. */
+};
+
+/* Same-page merging, as ksmctl() reports and sets it.  ksmd looks at
+   PAGES_TO_SCAN frames every SLEEP_MS milliseconds, and is off while
+   PAGES_TO_SCAN is 0. */
+struct ksm_info {
+	unsigned pages_to_scan;     /* Frames to look at per pass. */
+	unsigned sleep_ms;          /* Milliseconds between passes. */
+	size_t pages_shared;        /* Pages sharing another's frame now. */
+	long long merge_cnt;        /* Pages merged since boot. */
+};
+
+/* Causes of page faults, as faultstat() counts them. */
+enum {
+	FAULT_LAZY,                 /* First touch of a page of an executable. */
+	FAULT_ZERO,                 /* First touch of a fresh anonymous page. */
+	FAULT_SWAP,                 /* Anonymous page read back from swap. */
+	FAULT_COW,                  /* Write to a page shared copy-on-write. */
+	FAULT_STACK,                /* Access that grew the stack. */
+	FAULT_FILE,                 /* Page of a file mapping read in. */
+	FAULT_MINOR,                /* Page in memory, only remapped. */
+	FAULT_BAD,                  /* Not handled; the process dies. */
+	FAULT_CAUSE_CNT
+};
+
+/* Bucket N of a fault latency histogram counts the faults that took
+   from 2**N up to 2**(N+1) CPU cycles to handle; the last bucket
+   also counts all slower ones. */
+#define FAULT_HIST_BUCKETS 32
+
+/* Page faults by cause, as faultstat() reports them: those of one
+   process, and everyone's since boot along with how long they took
+   to handle. */
+struct faultstat {
+	long long proc_cnt[FAULT_CAUSE_CNT];    /* The process's faults. */
+	long long cnt[FAULT_CAUSE_CNT];         /* Everyone's faults... */
+	unsigned long long cycles[FAULT_CAUSE_CNT];  /* ...time spent... */
+	long long hist[FAULT_CAUSE_CNT][FAULT_HIST_BUCKETS];  /* ...in buckets. */
+};
+
+#endif /* lib/mman.h */
@@ -22,6 +22,11 @@ enum {
 	/* Project 3 and optionally project 4. */
 	SYS_MMAP,                   /* Map a file into memory. */
 	SYS_MUNMAP,                 /* Remove a memory mapping. */
+	SYS_MADVISE,                /* Advise on the use of memory. */
+	SYS_MEMSTAT,                /* Report a process's use of memory. */
+	SYS_MSYNC,                  /* Write a memory mapping back to its file. */
+	SYS_FAULTSTAT,              /* Report page faults by cause. */
+	SYS_KSMCTL,                 /* Report and tune same-page merging. */
 
 	/* Project 4 only. */
 	SYS_CHDIR,                  /* Change the current directory. */
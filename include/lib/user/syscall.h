@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <mman.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -41,6 +42,11 @@ int dup2(int oldfd, int newfd);
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+int msync (void *addr, size_t length, int flags);
+int madvise (void *addr, size_t length, int advice);
+bool memstat (pid_t pid, struct memstat *st);
+bool faultstat (pid_t pid, struct faultstat *st);
+void ksmctl (const struct ksm_info *set, struct ksm_info *get);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -58,6 +64,20 @@ static inline void* get_phys_addr (void *user_addr) {
 	return pa;
 }
 
+/* Returns the number of page faults the caller has taken. */
+static inline long long
+get_page_fault_cnt (void) {
+	struct faultstat st;
+	long long fault_cnt = 0;
+	int cause;
+
+	if (!faultstat (MEMSTAT_SELF, &st))
+		return -1;
+	for (cause = 0; cause < FAULT_CAUSE_CNT; cause++)
+		fault_cnt += st.proc_cnt[cause];
+	return fault_cnt;
+}
+
 static inline long long
 get_fs_disk_read_cnt (void) {
 	long long read_cnt;
@@ -0,0 +1,22 @@
+#ifndef THREADS_ALLOCPROF_H
+#define THREADS_ALLOCPROF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* What a call site allocates. */
+enum allocprof_kind {
+	ALLOCPROF_MALLOC,           /* Blocks from malloc() and friends. */
+	ALLOCPROF_KPAGE,            /* Kernel pool pages. */
+	ALLOCPROF_UPAGE             /* User pool pages. */
+};
+
+/* Profile allocations?  Set by -allocprof, before any allocation. */
+extern bool allocprof_enabled;
+
+unsigned allocprof_alloc (void *caller, enum allocprof_kind,
+		size_t size_class);
+void allocprof_free (unsigned site, size_t bytes);
+void allocprof_print_stats (void);
+
+#endif /* threads/allocprof.h */
@@ -1,6 +1,8 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <list.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -11,13 +13,50 @@ enum palloc_flags {
 	PAL_USER = 004              /* User page. */
 };
 
+/* Watermarks on a pool's count of free pages, see palloc.c. */
+enum palloc_wmark {
+	WMARK_MIN,                  /* Allocations reclaim below this. */
+	WMARK_LOW,                  /* Background reclaim starts below this... */
+	WMARK_HIGH                  /* ...and stops at this. */
+};
+
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
 
+/* Percentage of a pool that it may lend to the other pool. */
+extern unsigned pool_loan_pct;
+
+/* Moves a used user page's contents elsewhere for compaction. */
+typedef bool palloc_migrate_func (void *page);
+
+/* A kernel cache that gives pages back to its pool when the pool
+   runs low.  COUNT returns how many pages the cache could free
+   right now; SCAN frees up to PAGE_CNT of them and returns how
+   many it did.  Both run from allocation paths, possibly while
+   the allocating thread holds locks of its own, so they must only
+   try-acquire locks that an allocating thread might hold. */
+struct shrinker {
+	const char *name;           /* For statistics. */
+	enum palloc_flags pool;     /* PAL_USER for user pages, else 0. */
+	size_t (*count) (struct shrinker *);
+	size_t (*scan) (struct shrinker *, size_t page_cnt);
+	struct list_elem elem;      /* Element in the shrinker list. */
+	long long freed;            /* Pages freed so far. */
+};
+
 uint64_t palloc_init (void);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_multiple_aligned (enum palloc_flags, size_t page_cnt,
+		size_t align);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+size_t palloc_phys_page_cnt (void);
+bool palloc_below_wmark (enum palloc_flags, enum palloc_wmark);
+size_t palloc_free_cnt (enum palloc_flags);
+void palloc_set_migrator (palloc_migrate_func *);
+void palloc_register_shrinker (struct shrinker *);
+void palloc_start_reclaim (void);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -5,6 +5,13 @@
 #include <list.h>
 #include <stdint.h>
 #include "threads/interrupt.h"
+
+/* Thread identifier type.
+   You can redefine this to whatever type you like.
+   Defined before vm/vm.h is included, which uses it. */
+typedef int tid_t;
+#define TID_ERROR ((tid_t) -1)          /* Error value for tid_t. */
+
 #ifdef VM
 #include "vm/vm.h"
 #endif
@@ -18,11 +25,6 @@ enum thread_status {
 	THREAD_DYING        /* About to be destroyed. */
 };
 
-/* Thread identifier type.
-   You can redefine this to whatever type you like. */
-typedef int tid_t;
-#define TID_ERROR ((tid_t) -1)          /* Error value for tid_t. */
-
 /* Thread priorities. */
 #define PRI_MIN 0                       /* Lowest priority. */
 #define PRI_DEFAULT 31                  /* Default priority. */
@@ -109,10 +111,14 @@ struct thread {
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4;                     /* Page map level 4 */
+	struct child *child;                /* Exit status for the parent... */
+	struct list children;               /* ...and those of our children. */
+	struct file **fds;                  /* Open files, by descriptor. */
 #endif
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	struct file *exec_file;             /* Executable, read in lazily. */
 #endif
 
 	/* Owned by thread.c. */
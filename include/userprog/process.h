@@ -1,13 +1,30 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include "threads/synch.h"
 #include "threads/thread.h"
 
+/* Most open files per process, counting the console. */
+#define FD_MAX 128
+
+/* What a parent learns of a child process.  Freed once both have
+ * let go of it. */
+struct child {
+	tid_t tid;                  /* The child's thread. */
+	int exit_status;            /* Status passed to exit(), or -1. */
+	struct semaphore exited;    /* Upped when the child exits. */
+	int ref_cnt;                /* 2 while both parent and child live. */
+	struct list_elem elem;      /* In the parent's children list. */
+};
+
 tid_t process_create_initd (const char *file_name);
 tid_t process_fork (const char *name, struct intr_frame *if_);
 int process_exec (void *f_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (struct thread *next);
+struct file *process_get_file (int fd);
+int process_add_file (struct file *);
+void process_close_file (int fd);
 
 #endif /* userprog/process.h */
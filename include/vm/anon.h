@@ -1,13 +1,32 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
 #include "vm/vm.h"
+#include <stddef.h>
+#include "vm/swap.h"
+#include "filesys/off_t.h"
 struct page;
+struct zswap_entry;
+struct file_load_aux;
 enum vm_type;
 
 struct anon_page {
+	size_t slot;        /* Swap slot with a copy, or SWAP_SLOT_NONE. */
+	struct zswap_entry *zentry;  /* Compressed copy while swapped out. */
+	bool zero;          /* Swapped out all zeros? */
+	bool exec;          /* Read in from the owner's executable... */
+	off_t exec_ofs;     /* ...at this offset... */
+	size_t exec_bytes;  /* ...this many bytes, see anon_exec_load(). */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_has_copy (struct page *page);
+void anon_forget_copy (struct page *page);
+void anon_share_copy (struct page *page, struct page *copy);
+void anon_adopt (struct page *page);
+void anon_note_exec (struct page *page, const struct file_load_aux *load);
+struct file_load_aux *anon_exec_load (struct page *page);
+bool anon_swap_out_batch (struct page *pages[], size_t cnt);
+void anon_print_stats (void);
 
 #endif
@@ -0,0 +1,15 @@
+#ifndef VM_FAULTSTAT_H
+#define VM_FAULTSTAT_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/thread.h"
+
+struct faultstat;
+struct supplemental_page_table;
+
+void faultstat_record (struct supplemental_page_table *spt, int cause,
+		uint64_t cycles);
+bool faultstat_get (tid_t tid, struct faultstat *st);
+void faultstat_print_stats (void);
+
+#endif
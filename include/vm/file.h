@@ -4,14 +4,48 @@
 #include "vm/vm.h"
 
 struct page;
+struct supplemental_page_table;
 enum vm_type;
 
+/* Milliseconds between periodic writebacks of file mappings by
+ * kflushd, 0 for none but those msync() and kswapd ask for.  Read at
+ * boot. */
+extern unsigned flush_interval_ms;
+
+/* A page of a file mapping: READ_BYTES bytes of FILE at OFS,
+ * followed by zeroes up to the end of the page.  Only those bytes
+ * are written back. */
 struct file_page {
+	struct file *file;
+	off_t ofs;
+	size_t read_bytes;
+};
+
+/* Aux of a page that is read in lazily from FILE: READ_BYTES
+ * bytes at offset OFS, followed by zeroes up to the end of the
+ * page.  Owned by the page until its initializer runs. */
+struct file_load_aux {
+	struct file *file;
+	off_t ofs;
+	size_t read_bytes;
+};
+
+/* What a frame of shared text holds: READ_BYTES bytes of INODE at
+ * OFS, followed by zeroes up to the end of the page. */
+struct text_key {
+	struct inode *inode;
+	off_t ofs;
+	size_t read_bytes;
 };
 
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
+bool file_load_page (struct page *page, void *aux);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+bool do_msync (void *addr, size_t length, int flags);
+void file_flush_async (void);
+void file_unmap_all (struct supplemental_page_table *spt);
+void file_print_stats (void);
 #endif
@@ -0,0 +1,33 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+#include <mman.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct frame;
+struct page;
+struct supplemental_page_table;
+struct text_key;
+
+/* ksmd tunables, set by -ksm and -ksm-sleep at boot and by ksmctl()
+ * later, which take effect at its next pass: frames to look at per
+ * pass, 0 to stop merging, and milliseconds between passes. */
+extern unsigned ksm_pages_to_scan;
+extern unsigned ksm_sleep_ms;
+
+void frame_table_init (void);
+void frame_table_insert (struct frame *);
+void frame_table_remove (struct frame *);
+struct frame *frame_pick_victim (struct supplemental_page_table *only,
+		bool *locked);
+void frame_share (struct frame *, struct page *);
+void frame_unshare (struct frame *, struct page *);
+void frame_put_sharers (struct frame *, bool evicted);
+bool frame_is_shared (struct frame *);
+struct frame *frame_text_share (const struct text_key *, struct page *);
+void frame_text_insert (struct frame *, const struct text_key *);
+size_t frame_shared_cnt (void);
+void ksm_control (const struct ksm_info *set, struct ksm_info *get);
+void frame_print_stats (void);
+
+#endif
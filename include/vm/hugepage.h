@@ -0,0 +1,27 @@
+#ifndef VM_HUGEPAGE_H
+#define VM_HUGEPAGE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+
+struct page;
+struct supplemental_page_table;
+
+/* Number of 4 kB pages in a 2 MB huge page. */
+#define HPAGE_PGCNT (PDE_PGSIZE / PGSIZE)
+
+/* Start of the 2 MB block that holds VA. */
+#define hpage_round_down(va) \
+	((void *) ((uint64_t) (va) & ~(PDE_PGSIZE - 1)))
+
+/* Back eligible regions with huge pages?  Cleared by -nothp. */
+extern bool thp_enabled;
+
+void thp_init (void);
+bool thp_claim (struct page *page);
+void thp_split (struct page *page);
+void thp_kill (struct supplemental_page_table *spt);
+void thp_print_stats (void);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+#include <stddef.h>
+
+struct disk;
+
+/* No swap slot. */
+#define SWAP_SLOT_NONE ((size_t) -1)
+
+/* Most pages to swap out in one batch. */
+#define SWAP_BATCH_MAX 8
+
+void swap_init (struct disk *);
+size_t swap_alloc (size_t cnt);
+void swap_dup (size_t slot);
+void swap_free (size_t slot);
+void swap_write (size_t slot, void *const kpages[], size_t cnt);
+void swap_evicted (size_t slot);
+void swap_read (size_t slot, void *kpage);
+void swap_print_stats (void);
+
+#endif
@@ -1,7 +1,11 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <list.h>
+#include <mman.h>
 #include "threads/palloc.h"
+#include "threads/synch.h"
 
 enum vm_type {
 	/* page not initialized */
@@ -24,6 +28,9 @@ enum vm_type {
 	VM_MARKER_END = (1 << 31),
 };
 
+/* Marks the anonymous pages of the user stack. */
+#define VM_STACK VM_MARKER_0
+
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
@@ -46,6 +53,13 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct supplemental_page_table *spt;  /* Table that holds this page. */
+	bool writable;                        /* May the user write to it? */
+	struct page *next_sharer;  /* Next page sharing FRAME, or NULL. */
+	bool evict_locked;         /* SPT lock taken to evict FRAME? */
+	bool zero_mapped;          /* Mapped to the shared zero page? */
+	unsigned char advice;      /* MADV_* access pattern, see vm.c. */
+	bool referenced;           /* Accessed bit taken by kwsd, see vm.c. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -63,6 +77,16 @@ struct page {
 struct frame {
 	void *kva;
 	struct page *page;
+	bool huge;             /* Part of a 2 MB frame mapped by one PDE? */
+	bool pinned;           /* Busy with I/O, not to be evicted? */
+	size_t sharer_cnt;     /* Pages besides PAGE mapping it read-only. */
+	uint64_t ksm_checksum; /* Contents when ksmd last looked, hashed. */
+	bool ksm_listed;       /* In ksmd's table of merge candidates? */
+	struct hash_elem ksm_elem;    /* Element in that table. */
+	struct text_key text;  /* Executable page it holds, if listed... */
+	bool text_listed;      /* ...in the table of shared text? */
+	struct hash_elem text_elem;   /* Element in that table. */
+	struct list_elem clock_elem;  /* Element in the eviction clock. */
 };
 
 /* The function table for page operations.
@@ -85,8 +109,33 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	void **root;                /* Radix tree of pages, see vm.c. */
+	size_t page_cnt;            /* Number of pages in the tree. */
+	struct lock lock;           /* Guards the table and its mappings. */
+	struct thread *owner;       /* Thread whose address space this is. */
+	struct list thp_blocks;     /* 2 MB blocks to collapse, see hugepage.c. */
+	size_t around_window;       /* Pages to fault around, see vm.c. */
+	void *around_start;         /* Window of the last fault-around... */
+	uint64_t around_mask;       /* ...and the pages it mapped in it. */
+	bool around_used;           /* Has this table faulted around? */
+	struct list prefetch;       /* Ranges to read in, see vm.c. */
+	struct list mmaps;          /* File mappings, see file.c. */
+	size_t rss;                 /* Pages in memory. */
+	size_t rss_limit;           /* Most pages in memory, 0 for no limit. */
+	size_t wss;                 /* Working set estimate, in pages... */
+	bool wss_sampled;           /* ...once it has been sampled. */
+	long long fault_cnt;        /* Page faults taken... */
+	long long fault_causes[FAULT_CAUSE_CNT];  /* ...by cause. */
+	long long sampled_fault_cnt;  /* ...as of the last sample. */
+	unsigned fault_rate;        /* Faults per second since the one before. */
+	bool dying;                 /* Owner exited, see vm_reap_later(). */
+	struct list_elem elem;      /* Element in the list of live tables. */
 };
 
+typedef void spt_action_func (struct supplemental_page_table *spt,
+		void *aux);
+typedef void spt_page_func (struct page *page, void *aux);
+
 #include "threads/thread.h"
 void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
@@ -96,8 +145,32 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+void spt_for_each_page (struct supplemental_page_table *spt, void *start,
+		void *end, spt_page_func *action, void *aux);
+void spt_remove_range (struct supplemental_page_table *spt, void *start,
+		void *end);
+void spt_for_each (spt_action_func *action, void *aux);
+
+/* -faultaround: Most pages to map around a fault on a file page. */
+extern unsigned fault_around_pages;
+
+/* -nokswapd: Evict on faulting threads only, not ahead of time. */
+extern bool kswapd_enabled;
+
+/* -noreap: Tear address spaces down on the exiting thread. */
+extern bool reaper_enabled;
+
+/* -rsslimit: Most pages each new table may keep in memory, or 0. */
+extern size_t rss_limit_pages;
+
+/* Is some table's resident set well above its working set? */
+extern bool ws_excess;
+
+struct memstat;
 
 void vm_init (void);
+void vm_print_stats (void);
+void vm_print_pageout_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -106,7 +179,23 @@ bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
+void vm_free_frame (struct page *page);
+void vm_unmap_zero_page (struct page *page);
+bool vm_page_is_clean (struct page *page);
+bool vm_page_referenced (struct page *page);
+void vm_page_unreference (struct page *page);
 bool vm_claim_page (void *va);
+bool vm_madvise (void *addr, size_t length, int advice);
+bool vm_populate (void *addr, size_t length);
+bool vm_user_range (void *addr, size_t length, uint8_t **start,
+		uint8_t **end);
+bool vm_over_rss_limit (const struct supplemental_page_table *spt);
+bool vm_rss_room (const struct supplemental_page_table *spt, size_t cnt);
+bool vm_above_working_set (const struct supplemental_page_table *spt);
+bool vm_memstat (tid_t tid, struct memstat *st);
+bool vm_reap_later (void);
+bool vm_reap (struct thread *t);
+size_t vm_reap_backlog (void);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
@@ -0,0 +1,18 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stddef.h>
+
+struct zswap_entry;
+
+/* -zswap: Percentage of physical memory that the compressed swap
+ * pool may take up, 0 for none. */
+extern unsigned zswap_pct;
+
+void zswap_init (void);
+struct zswap_entry *zswap_store (const void *kpage);
+void zswap_dup (struct zswap_entry *);
+size_t zswap_load (struct zswap_entry *, void *kpage);
+void zswap_invalidate (struct zswap_entry *);
+void zswap_print_stats (void);
+
+#endif
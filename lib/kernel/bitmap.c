@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -23,10 +24,21 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   A bitmap may also have a summary, a second level of two arrays
+   with one bit per element of BITS: bit K of FULL is set if
+   element K has all of its bits set, and bit K of EMPTY if it has
+   none set.  Scans use it to skip ELEM_BITS elements, that is
+   ELEM_BITS * ELEM_BITS bits, that cannot hold what they are
+   looking for at a time.  Keeping it up to date makes every
+   update of a summarized bitmap a little slower. */
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
 	elem_type *bits;    /* Elements that represent bits. */
+	elem_type *full;    /* Summary of full elements, or null. */
+	elem_type *empty;   /* Summary of empty elements, or null. */
+	bool own_summary;   /* Summary allocated by bitmap_summarize()? */
 };
 
 /* Returns the index of the element that contains the bit
@@ -63,6 +75,119 @@ last_mask (const struct bitmap *b) {
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns the number of bits set in W. */
+static inline size_t
+popcount (elem_type w) {
+	w = w - ((w >> 1) & (elem_type) 0x5555555555555555ULL);
+	w = (w & (elem_type) 0x3333333333333333ULL)
+		+ ((w >> 2) & (elem_type) 0x3333333333333333ULL);
+	w = (w + (w >> 4)) & (elem_type) 0x0f0f0f0f0f0f0f0fULL;
+	return (w * (elem_type) 0x0101010101010101ULL) >> (ELEM_BITS - 8);
+}
+
+/* Returns the index of the lowest bit set in W, which must not be
+   zero. */
+static inline size_t
+lowest_bit (elem_type w) {
+	return __builtin_ctzl (w);
+}
+
+/* Returns a mask of the bits of an element from bit START, which
+   must be less than ELEM_BITS, to bit START + CNT, exclusive, or
+   to the end of the element, whichever comes first. */
+static inline elem_type
+range_mask (size_t start, size_t cnt) {
+	elem_type mask = (elem_type) -1 << start;
+	if (start + cnt < ELEM_BITS)
+		mask &= ((elem_type) 1 << (start + cnt)) - 1;
+	return mask;
+}
+
+/* Brings the summary bits of element IDX of B up to date. */
+static inline void
+update_summary (struct bitmap *b, size_t idx) {
+	elem_type used = idx == elem_cnt (b->bit_cnt) - 1 ?
+		last_mask (b) : (elem_type) -1;
+	elem_type w = b->bits[idx] & used;
+	elem_type mask = bit_mask (idx);
+
+	if (w == used)
+		b->full[elem_idx (idx)] |= mask;
+	else
+		b->full[elem_idx (idx)] &= ~mask;
+	if (w == 0)
+		b->empty[elem_idx (idx)] |= mask;
+	else
+		b->empty[elem_idx (idx)] &= ~mask;
+}
+
+/* Sets the bits of MASK in element IDX of B to VALUE, keeping the
+   summary up to date.  The element is updated atomically; with a
+   summary, interrupts are turned off so that the summary agrees
+   with it. */
+static void
+update_elem (struct bitmap *b, size_t idx, elem_type mask, bool value) {
+	enum intr_level old_level = INTR_OFF;
+
+	if (b->full != NULL)
+		old_level = intr_disable ();
+	if (value)
+		asm ("lock orq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	else
+		asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+	if (b->full != NULL) {
+		update_summary (b, idx);
+		intr_set_level (old_level);
+	}
+}
+
+/* Returns the index of the first element at or after IDX in B
+   that may hold a bit set to VALUE, going by B's summary, or the
+   number of elements in B if there is none.  Without a summary,
+   that is IDX itself. */
+static size_t
+next_candidate (const struct bitmap *b, size_t idx, bool value) {
+	const elem_type *skip = value ? b->empty : b->full;
+	size_t cnt = elem_cnt (b->bit_cnt);
+	size_t s;
+	elem_type w;
+
+	if (skip == NULL || idx >= cnt)
+		return idx;
+	s = elem_idx (idx);
+	w = ~skip[s] & ((elem_type) -1 << (idx % ELEM_BITS));
+	while (w == 0) {
+		if (++s >= elem_cnt (cnt))
+			return cnt;
+		w = ~skip[s];
+	}
+	idx = s * ELEM_BITS + lowest_bit (w);
+	return idx < cnt ? idx : cnt;
+}
+
+/* Returns the index of the first bit at or after START in B that
+   is set to VALUE, or B's size if there is none. */
+static size_t
+find_next (const struct bitmap *b, size_t start, bool value) {
+	elem_type flip = value ? 0 : (elem_type) -1;
+	size_t cnt = elem_cnt (b->bit_cnt);
+	size_t idx, bit;
+	elem_type w;
+
+	if (start >= b->bit_cnt)
+		return b->bit_cnt;
+	idx = elem_idx (start);
+	w = (b->bits[idx] ^ flip) & ((elem_type) -1 << (start % ELEM_BITS));
+	while (w == 0) {
+		idx = next_candidate (b, idx + 1, value);
+		if (idx >= cnt)
+			return b->bit_cnt;
+		w = b->bits[idx] ^ flip;
+	}
+	bit = idx * ELEM_BITS + lowest_bit (w);
+	return bit < b->bit_cnt ? bit : b->bit_cnt;
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -75,6 +200,8 @@ bitmap_create (size_t bit_cnt) {
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
 		b->bits = malloc (byte_cnt (bit_cnt));
+		b->full = b->empty = NULL;
+		b->own_summary = false;
 		if (b->bits != NULL || bit_cnt == 0) {
 			bitmap_set_all (b, false);
 			return b;
@@ -95,6 +222,8 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 
 	b->bit_cnt = bit_cnt;
 	b->bits = (elem_type *) (b + 1);
+	b->full = b->empty = NULL;
+	b->own_summary = false;
 	bitmap_set_all (b, false);
 	return b;
 }
@@ -112,10 +241,58 @@ bitmap_buf_size (size_t bit_cnt) {
 void
 bitmap_destroy (struct bitmap *b) {
 	if (b != NULL) {
+		if (b->own_summary)
+			free (b->full);
 		free (b->bits);
 		free (b);
 	}
 }
+
+/* Summaries. */
+
+/* Returns the number of bytes required for the summary of a
+   bitmap with BIT_CNT bits (for use with
+   bitmap_summarize_in_buf()). */
+size_t
+bitmap_summary_buf_size (size_t bit_cnt) {
+	return 2 * byte_cnt (elem_cnt (bit_cnt));
+}
+
+/* Gives B a summary in the BLOCK_SIZE bytes of storage
+   preallocated at BLOCK, which must be at least
+   bitmap_summary_buf_size() bytes for B's size.  A summary makes
+   scanning a large, mostly full or mostly empty bitmap much
+   faster. */
+void
+bitmap_summarize_in_buf (struct bitmap *b, void *block,
+		size_t block_size UNUSED) {
+	size_t summary_elems = elem_cnt (elem_cnt (b->bit_cnt));
+	size_t i;
+
+	ASSERT (b->full == NULL);
+	ASSERT (block_size >= bitmap_summary_buf_size (b->bit_cnt));
+
+	b->full = block;
+	b->empty = b->full + summary_elems;
+	for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+		update_summary (b, i);
+}
+
+/* Gives B a summary allocated with malloc(), which
+   bitmap_destroy() frees.  Returns false if memory allocation
+   failed, in which case B works as before, only without a
+   summary. */
+bool
+bitmap_summarize (struct bitmap *b) {
+	size_t size = bitmap_summary_buf_size (b->bit_cnt);
+	void *block = malloc (size);
+
+	if (block == NULL)
+		return false;
+	bitmap_summarize_in_buf (b, block, size);
+	b->own_summary = true;
+	return true;
+}
 
 /* Bitmap size. */
 
@@ -147,7 +324,7 @@ bitmap_mark (struct bitmap *b, size_t bit_idx) {
 	/* This is equivalent to `b->bits[idx] |= mask' except that it
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the OR instruction in [IA32-v2b]. */
-	asm ("lock orq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	update_elem (b, idx, mask, true);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -159,7 +336,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx) {
 	/* This is equivalent to `b->bits[idx] &= ~mask' except that it
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the AND instruction in [IA32-v2a]. */
-	asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+	update_elem (b, idx, mask, false);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -173,7 +350,15 @@ bitmap_flip (struct bitmap *b, size_t bit_idx) {
 	/* This is equivalent to `b->bits[idx] ^= mask' except that it
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the XOR instruction in [IA32-v2b]. */
+	enum intr_level old_level = INTR_OFF;
+
+	if (b->full != NULL)
+		old_level = intr_disable ();
 	asm ("lock xorq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	if (b->full != NULL) {
+		update_summary (b, idx);
+		intr_set_level (old_level);
+	}
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -194,50 +379,55 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is set atomically, but not the range as a whole. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	while (cnt > 0) {
+		size_t ofs = start % ELEM_BITS;
+		size_t n = cnt < ELEM_BITS - ofs ? cnt : ELEM_BITS - ofs;
+
+		update_elem (b, elem_idx (start), range_mask (ofs, n), value);
+		start += n;
+		cnt -= n;
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t i, true_cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
-	return value_cnt;
+	true_cnt = 0;
+	for (i = 0; i < cnt; ) {
+		size_t ofs = (start + i) % ELEM_BITS;
+		size_t n = cnt - i < ELEM_BITS - ofs ? cnt - i : ELEM_BITS - ofs;
+
+		true_cnt += popcount (b->bits[elem_idx (start + i)]
+				& range_mask (ofs, n));
+		i += n;
+	}
+	return value ? true_cnt : cnt - true_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return cnt > 0 && find_next (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -272,12 +462,21 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
+	if (cnt == 0)
+		return start;
+
+	/* Jump from each run of VALUE bits to the next, a word at a
+	   time, until one is long enough. */
+	while (start + cnt <= b->bit_cnt) {
+		size_t end;
+
+		start = find_next (b, start, value);
+		if (start + cnt > b->bit_cnt)
+			break;
+		end = find_next (b, start, !value);
+		if (end - start >= cnt)
+			return start;
+		start = end;
 	}
 	return BITMAP_ERROR;
 }
@@ -315,6 +514,9 @@ bitmap_read (struct bitmap *b, struct file *file) {
 		off_t size = byte_cnt (b->bit_cnt);
 		success = file_read_at (file, b->bits, size, 0) == size;
 		b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+		if (b->full != NULL)
+			for (size_t i = 0; i < elem_cnt (b->bit_cnt); i++)
+				update_summary (b, i);
 	}
 	return success;
 }
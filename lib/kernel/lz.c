@@ -0,0 +1,186 @@
+#include "lz.h"
+#include <debug.h>
+#include <stdint.h>
+#include <string.h>
+
+/* LZ77-style compression in the manner of LZ4: fast and simple
+   rather than tight.
+
+   The compressed form is a series of sequences.  Each one starts
+   with a token byte whose high nibble is the number of literal
+   bytes that follow and whose low nibble is the length of the
+   match after them, minus LZ_MIN_MATCH.  A nibble of 15 is
+   followed by more length bytes, each added in, up to and
+   including the first one that is not 255.  Then come the
+   literals, then the match's distance back into the output as
+   two little-endian bytes.  The last sequence ends after its
+   literals and has no match.
+
+   The compressor finds matches through a hash table of the
+   positions of the last four-byte strings seen, so it looks at
+   each input byte a small, fixed number of times. */
+
+/* Shortest match worth a sequence. */
+#define LZ_MIN_MATCH 4
+
+/* Reads 4 bytes at P. */
+static uint32_t
+read32 (const uint8_t *p) {
+	uint32_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+/* Hash table index for the 4 bytes V. */
+static unsigned
+hash32 (uint32_t v) {
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes the excess LEN of a length nibble at *OP, not past END.
+   Returns false if it does not fit. */
+static bool
+put_length (uint8_t **op, uint8_t *end, size_t len) {
+	for (; len >= 255; len -= 255) {
+		if (*op >= end)
+			return false;
+		*(*op)++ = 255;
+	}
+	if (*op >= end)
+		return false;
+	*(*op)++ = len;
+	return true;
+}
+
+/* Writes a sequence of the LIT_LEN literals at LIT, followed,
+   unless MATCH_LEN is 0, by a match of MATCH_LEN bytes at
+   DISTANCE back, at *OP, not past END.  Returns false if it does
+   not fit. */
+static bool
+put_sequence (uint8_t **op, uint8_t *end, const uint8_t *lit,
+		size_t lit_len, size_t distance, size_t match_len) {
+	size_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+	uint8_t *token = *op;
+
+	if (*op >= end)
+		return false;
+	*token = (lit_len < 15 ? lit_len : 15) << 4
+		| (match_code < 15 ? match_code : 15);
+	(*op)++;
+	if (lit_len >= 15 && !put_length (op, end, lit_len - 15))
+		return false;
+	if ((size_t) (end - *op) < lit_len)
+		return false;
+	memcpy (*op, lit, lit_len);
+	*op += lit_len;
+	if (match_len == 0)
+		return true;
+	if (end - *op < 2)
+		return false;
+	*(*op)++ = distance;
+	*(*op)++ = distance >> 8;
+	return match_code < 15 || put_length (op, end, match_code - 15);
+}
+
+/* Compresses the SRC_SIZE bytes at SRC, at most LZ_MAX_SIZE, into
+   DST, which has room for DST_CAP bytes, using WORK, which must
+   have room for LZ_WORK_SIZE bytes, as scratch space.  Returns the
+   size of the compressed data, or 0 if it does not fit in
+   DST_CAP bytes. */
+size_t
+lz_compress (const void *src_, size_t src_size, void *dst_, size_t dst_cap,
+		void *work) {
+	const uint8_t *src = src_;
+	uint8_t *dst = dst_, *op = dst, *end = dst + dst_cap;
+	unsigned short *table = work;
+	size_t ip = 0, anchor = 0;
+
+	ASSERT (src_size <= LZ_MAX_SIZE);
+
+	memset (table, 0, LZ_WORK_SIZE);
+	while (ip + LZ_MIN_MATCH <= src_size) {
+		uint32_t seq = read32 (src + ip);
+		unsigned h = hash32 (seq);
+		size_t ref = table[h];
+		size_t len;
+
+		table[h] = ip;
+		if (ref >= ip || read32 (src + ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		for (len = LZ_MIN_MATCH; ip + len < src_size
+				&& src[ref + len] == src[ip + len]; len++)
+			continue;
+		if (!put_sequence (&op, end, src + anchor, ip - anchor, ip - ref, len))
+			return 0;
+		ip += len;
+		anchor = ip;
+	}
+	if (anchor < src_size
+			&& !put_sequence (&op, end, src + anchor, src_size - anchor, 0, 0))
+		return 0;
+	return op - dst;
+}
+
+/* Reads the rest of a length whose nibble was 15 from *IP, not past
+   END, and adds it to *LEN.  Returns false if the input runs out. */
+static bool
+get_length (const uint8_t **ip, const uint8_t *end, size_t *len) {
+	uint8_t b;
+
+	do {
+		if (*ip >= end)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC, which lz_compress()
+   produced, into the DST_SIZE bytes at DST.  Returns true if
+   successful, false if the data is corrupt or does not decompress
+   to exactly DST_SIZE bytes. */
+bool
+lz_decompress (const void *src_, size_t src_size, void *dst_,
+		size_t dst_size) {
+	const uint8_t *ip = src_, *in_end = ip + src_size;
+	uint8_t *dst = dst_, *op = dst, *out_end = dst + dst_size;
+
+	while (ip < in_end) {
+		uint8_t token = *ip++;
+		size_t lit_len = token >> 4;
+		size_t match_len = (token & 15) + LZ_MIN_MATCH;
+		size_t distance;
+
+		if (lit_len == 15 && !get_length (&ip, in_end, &lit_len))
+			return false;
+		if ((size_t) (in_end - ip) < lit_len
+				|| (size_t) (out_end - op) < lit_len)
+			return false;
+		memcpy (op, ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+		if (ip == in_end)
+			break;
+
+		if (in_end - ip < 2)
+			return false;
+		distance = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (match_len == 15 + LZ_MIN_MATCH
+				&& !get_length (&ip, in_end, &match_len))
+			return false;
+		if (distance == 0 || distance > (size_t) (op - dst)
+				|| (size_t) (out_end - op) < match_len)
+			return false;
+
+		/* The match may overlap what it produces, so copy it a byte
+		   at a time. */
+		for (; match_len > 0; match_len--, op++)
+			*op = op[-distance];
+	}
+	return op == out_end;
+}
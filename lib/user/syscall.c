@@ -155,6 +155,31 @@ munmap (void *addr) {
 	syscall1 (SYS_MUNMAP, addr);
 }
 
+int
+msync (void *addr, size_t length, int flags) {
+	return syscall3 (SYS_MSYNC, addr, length, flags);
+}
+
+int
+madvise (void *addr, size_t length, int advice) {
+	return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+bool
+memstat (pid_t pid, struct memstat *st) {
+	return syscall2 (SYS_MEMSTAT, pid, st);
+}
+
+bool
+faultstat (pid_t pid, struct faultstat *st) {
+	return syscall2 (SYS_FAULTSTAT, pid, st);
+}
+
+void
+ksmctl (const struct ksm_info *set, struct ksm_info *get) {
+	syscall2 (SYS_KSMCTL, set, get);
+}
+
 bool
 chdir (const char *dir) {
 	return syscall1 (SYS_CHDIR, dir);
@@ -0,0 +1,180 @@
+/* Test program and microbenchmarks for lib/kernel/bitmap.c.
+
+   First checks bitmap_set_multiple(), bitmap_count(),
+   bitmap_contains() and bitmap_scan() against a plain array of
+   bools, with and without a summary, on bitmaps of many sizes.
+   Then times the operations that palloc and the free map depend
+   on, on a large bitmap that is mostly full, mostly empty, or
+   fragmented, and prints the cycles each one takes.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/test.h"
+#include "intrinsic.h"
+
+/* Largest bitmap to check, and number of random operations per
+   bitmap. */
+#define MAX_BITS 4200
+#define OP_CNT 200
+
+/* Size of the bitmap to time, in bits, and number of repetitions
+   per measurement. */
+#define BENCH_BITS (1024 * 1024)
+#define BENCH_REPEAT 16
+
+static void check (size_t bit_cnt, bool summarize);
+static void bench (const char *layout, bool summarize);
+static void fill (struct bitmap *, const char *layout);
+
+/* Test and time the bitmap implementation. */
+void
+test (void) 
+{
+  size_t bit_cnt;
+
+  printf ("testing various size bitmaps:");
+  for (bit_cnt = 0; bit_cnt < MAX_BITS; bit_cnt = bit_cnt * 5 / 4 + 1)
+    {
+      printf (" %zu", bit_cnt);
+      check (bit_cnt, false);
+      check (bit_cnt, true);
+    }
+  printf (" done\n");
+
+  bench ("full", false);
+  bench ("full", true);
+  bench ("empty", false);
+  bench ("empty", true);
+  bench ("fragmented", false);
+  bench ("fragmented", true);
+}
+
+/* Checks random operations on a bitmap of BIT_CNT bits, with a
+   summary if SUMMARIZE is true, against an array of bools. */
+static void
+check (size_t bit_cnt, bool summarize) 
+{
+  static bool ref[MAX_BITS];
+  struct bitmap *b = bitmap_create (bit_cnt);
+  size_t i;
+  int op;
+
+  if (b == NULL || (summarize && !bitmap_summarize (b)))
+    PANIC ("out of memory");
+  for (i = 0; i < bit_cnt; i++)
+    ref[i] = false;
+
+  for (op = 0; op < OP_CNT; op++) 
+    {
+      size_t start = random_ulong () % (bit_cnt + 1);
+      size_t cnt = random_ulong () % (bit_cnt - start + 1);
+      bool value = random_ulong () % 2;
+      size_t value_cnt, expected;
+
+      if (random_ulong () % 3 == 0) 
+        {
+          bitmap_set_multiple (b, start, cnt, value);
+          for (i = start; i < start + cnt; i++)
+            ref[i] = value;
+        }
+      else if (bit_cnt > 0) 
+        {
+          i = random_ulong () % bit_cnt;
+          bitmap_flip (b, i);
+          ref[i] = !ref[i];
+        }
+
+      /* Short runs make bitmap_scan() skip past most of them. */
+      if (random_ulong () % 2 == 0)
+        cnt %= 70;
+      if (start + cnt > bit_cnt)
+        cnt = bit_cnt - start;
+
+      for (value_cnt = 0, i = start; i < start + cnt; i++)
+        value_cnt += ref[i] == value;
+      ASSERT (bitmap_count (b, start, cnt, value) == value_cnt);
+      ASSERT (bitmap_contains (b, start, cnt, value) == (value_cnt > 0));
+
+      expected = cnt == 0 ? start : BITMAP_ERROR;
+      for (i = start; cnt > 0 && i + cnt <= bit_cnt; i++) 
+        {
+          size_t j;
+          for (j = 0; j < cnt && ref[i + j] == value; j++)
+            continue;
+          if (j == cnt) 
+            {
+              expected = i;
+              break;
+            }
+        }
+      ASSERT (bitmap_scan (b, start, cnt, value) == expected);
+
+      for (i = 0; i < bit_cnt; i++)
+        ASSERT (bitmap_test (b, i) == ref[i]);
+    }
+  bitmap_destroy (b);
+}
+
+/* Times scans and counts on a BENCH_BITS-bit bitmap laid out as
+   LAYOUT, with a summary if SUMMARIZE is true. */
+static void
+bench (const char *layout, bool summarize) 
+{
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  uint64_t start, scan, scan_flip, count;
+  int i;
+
+  if (b == NULL || (summarize && !bitmap_summarize (b)))
+    PANIC ("out of memory");
+  fill (b, layout);
+
+  start = rdtsc ();
+  for (i = 0; i < BENCH_REPEAT; i++)
+    bitmap_scan (b, 0, 8, false);
+  scan = (rdtsc () - start) / BENCH_REPEAT;
+
+  start = rdtsc ();
+  for (i = 0; i < BENCH_REPEAT; i++) 
+    {
+      size_t idx = bitmap_scan_and_flip (b, 0, 1, false);
+      if (idx != BITMAP_ERROR)
+        bitmap_reset (b, idx);
+    }
+  scan_flip = (rdtsc () - start) / BENCH_REPEAT;
+
+  start = rdtsc ();
+  for (i = 0; i < BENCH_REPEAT; i++)
+    bitmap_count (b, 0, BENCH_BITS, true);
+  count = (rdtsc () - start) / BENCH_REPEAT;
+
+  printf ("%s, %s summary: scan for 8 free bits %llu cycles, "
+          "allocate one bit %llu cycles, count %llu cycles\n",
+          layout, summarize ? "with" : "without", scan, scan_flip, count);
+  bitmap_destroy (b);
+}
+
+/* Sets the bits of B according to LAYOUT: "full" leaves only the
+   last 8 bits free, "empty" sets none, and "fragmented" sets
+   every other bit, plus a free run of 8 at the end. */
+static void
+fill (struct bitmap *b, const char *layout) 
+{
+  size_t bit_cnt = bitmap_size (b);
+  size_t i;
+
+  bitmap_set_all (b, false);
+  if (!strcmp (layout, "full"))
+    bitmap_set_multiple (b, 0, bit_cnt - 8, true);
+  else if (!strcmp (layout, "fragmented"))
+    for (i = 0; i < bit_cnt - 8; i += 2)
+      bitmap_mark (b, i);
+}
@@ -0,0 +1,107 @@
+/* Test program for lib/kernel/lz.c.
+
+   Compresses buffers of several kinds and sizes, checks that they
+   decompress to what went in, and that corrupt or truncated input
+   is rejected rather than overrunning the output.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <lz.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/test.h"
+
+/* Largest buffer that we will test. */
+#define MAX_SIZE 8192
+
+static unsigned char src[MAX_SIZE];
+static unsigned char packed[MAX_SIZE * 2];
+static unsigned char unpacked[MAX_SIZE];
+static unsigned short work[LZ_WORK_SIZE / sizeof (unsigned short)];
+
+static void fill (int kind, size_t size);
+static void round_trip (size_t size);
+
+/* Test the compressor. */
+void
+test (void) 
+{
+  static const size_t sizes[] = {0, 1, 3, 4, 5, 15, 16, 19, 270, 4096, MAX_SIZE};
+  size_t i;
+  int kind;
+
+  printf ("testing compression of various buffers:");
+  for (kind = 0; kind < 5; kind++)
+    for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+      {
+        fill (kind, sizes[i]);
+        round_trip (sizes[i]);
+        putchar ('.');
+      }
+  putchar ('\n');
+
+  printf ("testing a full output buffer...");
+  fill (4, 4096);
+  ASSERT (lz_compress (src, 4096, packed, 100, work) == 0);
+  printf ("done\n");
+}
+
+/* Fills the first SIZE bytes of SRC with data of the given KIND:
+   zeros, a short repeating pattern, text-like runs, a page of
+   words with a few changes, or random bytes. */
+static void
+fill (int kind, size_t size) 
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    switch (kind) 
+      {
+      case 0:
+        src[i] = 0;
+        break;
+      case 1:
+        src[i] = "abc"[i % 3];
+        break;
+      case 2:
+        src[i] = random_ulong () % 4 == 0 ? 'a' + random_ulong () % 26 : ' ';
+        break;
+      case 3:
+        src[i] = i % 8 == 0 && random_ulong () % 16 == 0 ? random_ulong () : 0;
+        break;
+      default:
+        src[i] = random_ulong ();
+        break;
+      }
+}
+
+/* Compresses and decompresses the first SIZE bytes of SRC, and
+   tries some broken variations of the compressed data. */
+static void
+round_trip (size_t size) 
+{
+  size_t n = lz_compress (src, size, packed, sizeof packed, work);
+
+  ASSERT (n > 0 || size == 0);
+  ASSERT (lz_decompress (packed, n, unpacked, size));
+  ASSERT (!memcmp (src, unpacked, size));
+
+  /* The output size must match exactly. */
+  if (size > 0)
+    {
+      ASSERT (!lz_decompress (packed, n, unpacked, size - 1));
+      ASSERT (!lz_decompress (packed, n - 1, unpacked, size));
+    }
+
+  /* Garbage must not decompress past the end of the buffer. */
+  if (n > 0)
+    {
+      packed[random_ulong () % n] ^= 1 << random_ulong () % 8;
+      lz_decompress (packed, n, unpacked, size);
+    }
+}
@@ -0,0 +1,234 @@
+/* Test program and benchmark for the block routines in
+   lib/string.c.
+
+   First checks memcpy(), memmove(), memset(), memcmp() and
+   strlen() on blocks of many sizes and alignments against
+   byte-at-a-time versions.  Then prints the throughput of each
+   routine, and of its byte-at-a-time version, in bytes per
+   thousand cycles, for sizes from 8 bytes to 64 kB.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/test.h"
+#include "intrinsic.h"
+
+/* Largest block, plus room for misaligning it. */
+#define MAX_SIZE (64 * 1024)
+#define BUF_SIZE (MAX_SIZE + 64)
+
+/* Bytes to move per measurement, at least. */
+#define BENCH_BYTES (1024 * 1024)
+
+static unsigned char buf_a[BUF_SIZE], buf_b[BUF_SIZE], buf_c[BUF_SIZE];
+
+static void check (size_t size, size_t ofs_a, size_t ofs_b);
+static void bench (size_t size);
+
+static void byte_copy (unsigned char *, const unsigned char *, size_t);
+static void byte_set (unsigned char *, int, size_t);
+static int byte_cmp (const unsigned char *, const unsigned char *, size_t);
+static size_t byte_len (const char *);
+
+/* Test and time the block routines. */
+void
+test (void) 
+{
+  size_t size;
+
+  printf ("testing various sizes and alignments:");
+  for (size = 0; size < 4096; size = size * 3 / 2 + 1)
+    {
+      size_t ofs_a, ofs_b;
+
+      printf (" %zu", size);
+      for (ofs_a = 0; ofs_a < 8; ofs_a++)
+        for (ofs_b = 0; ofs_b < 8; ofs_b++)
+          check (size, ofs_a, ofs_b);
+    }
+  printf (" done\n");
+
+  printf ("bytes per 1000 cycles, optimized / byte loop:\n");
+  for (size = 8; size <= MAX_SIZE; size *= 4)
+    bench (size);
+}
+
+/* Fills BUF_A and BUF_B with the same random bytes. */
+static void
+randomize (void) 
+{
+  size_t i;
+
+  for (i = 0; i < BUF_SIZE; i++)
+    buf_a[i] = buf_b[i] = random_ulong ();
+}
+
+/* Checks each routine on SIZE-byte blocks at offsets OFS_A and
+   OFS_B into the buffers. */
+static void
+check (size_t size, size_t ofs_a, size_t ofs_b) 
+{
+  unsigned char *a = buf_a + ofs_a;
+  unsigned char *b = buf_b + ofs_a;
+  unsigned char *c = buf_c + ofs_b;
+  size_t i;
+
+  randomize ();
+  for (i = 0; i < size; i++)
+    c[i] = random_ulong ();
+  ASSERT (memcpy (a, c, size) == a);
+  byte_copy (b, c, size);
+  ASSERT (!byte_cmp (buf_a, buf_b, BUF_SIZE));
+
+  /* Overlapping moves, in both directions. */
+  randomize ();
+  ASSERT (memmove (a, a + ofs_b, size) == a);
+  byte_copy (b, b + ofs_b, size);
+  ASSERT (!byte_cmp (buf_a, buf_b, BUF_SIZE));
+  ASSERT (memmove (a + ofs_b, a, size) == a + ofs_b);
+  for (i = size; i-- > 0; )
+    b[ofs_b + i] = b[i];
+  ASSERT (!byte_cmp (buf_a, buf_b, BUF_SIZE));
+
+  randomize ();
+  ASSERT (memset (a, size, size) == a);
+  byte_set (b, size, size);
+  ASSERT (!byte_cmp (buf_a, buf_b, BUF_SIZE));
+
+  /* Equal blocks, and blocks that differ in their last byte. */
+  randomize ();
+  byte_copy (c, a, size);
+  ASSERT (memcmp (a, c, size) == 0);
+  if (size > 0)
+    {
+      c[size - 1]++;
+      ASSERT (memcmp (a, c, size) == byte_cmp (a, c, size));
+    }
+
+  randomize ();
+  for (i = 0; i < size; i++)
+    a[i] |= 1;
+  a[size] = '\0';
+  ASSERT (strlen ((char *) a) == size);
+  ASSERT (byte_len ((char *) a) == size);
+}
+
+/* Returns bytes per thousand cycles for moving SIZE bytes
+   REPEAT times in START cycles ago. */
+static unsigned long long
+rate (uint64_t start, size_t size, size_t repeat) 
+{
+  uint64_t cycles = rdtsc () - start;
+  return cycles > 0 ? size * repeat * 1000 / cycles : 0;
+}
+
+/* Times each routine and its byte loop on SIZE-byte blocks. */
+static void
+bench (size_t size) 
+{
+  size_t repeat = BENCH_BYTES / size, i;
+  unsigned long long fast[5], slow[5];
+  volatile size_t sink = 0;
+  uint64_t start;
+
+  randomize ();
+  buf_a[size] = '\0';
+  for (i = 0; i < size; i++)
+    buf_a[i] |= 1;
+  byte_copy (buf_c, buf_a, size);
+
+  start = rdtsc ();
+  for (i = 0; i < repeat; i++)
+    memcpy (buf_b, buf_a, size);
+  fast[0] = rate (start, size, repeat);
+  start = rdtsc ();
+  for (i = 0; i < repeat; i++)
+    byte_copy (buf_b, buf_a, size);
+  slow[0] = rate (start, size, repeat);
+
+  start = rdtsc ();
+  for (i = 0; i < repeat; i++)
+    memmove (buf_b + 1, buf_b, size);
+  fast[1] = rate (start, size, repeat);
+  start = rdtsc ();
+  for (i = 0; i < repeat; i++)
+    {
+      size_t j;
+      for (j = size; j-- > 0; )
+        buf_b[j + 1] = buf_b[j];
+    }
+  slow[1] = rate (start, size, repeat);
+
+  start = rdtsc ();
+  for (i = 0; i < repeat; i++)
+    memset (buf_b, 0, size);
+  fast[2] = rate (start, size, repeat);
+  start = rdtsc ();
+  for (i = 0; i < repeat; i++)
+    byte_set (buf_b, 0, size);
+  slow[2] = rate (start, size, repeat);
+
+  start = rdtsc ();
+  for (i = 0; i < repeat; i++)
+    sink += memcmp (buf_a, buf_c, size);
+  fast[3] = rate (start, size, repeat);
+  start = rdtsc ();
+  for (i = 0; i < repeat; i++)
+    sink += byte_cmp (buf_a, buf_c, size);
+  slow[3] = rate (start, size, repeat);
+
+  start = rdtsc ();
+  for (i = 0; i < repeat; i++)
+    sink += strlen ((char *) buf_a);
+  fast[4] = rate (start, size, repeat);
+  start = rdtsc ();
+  for (i = 0; i < repeat; i++)
+    sink += byte_len ((char *) buf_a);
+  slow[4] = rate (start, size, repeat);
+
+  printf ("%6zu bytes: memcpy %llu/%llu, memmove %llu/%llu, "
+          "memset %llu/%llu, memcmp %llu/%llu, strlen %llu/%llu\n",
+          size, fast[0], slow[0], fast[1], slow[1], fast[2], slow[2],
+          fast[3], slow[3], fast[4], slow[4]);
+}
+
+/* Byte-at-a-time versions, as lib/string.c used to have them. */
+
+static void
+byte_copy (unsigned char *dst, const unsigned char *src, size_t size) 
+{
+  while (size-- > 0)
+    *dst++ = *src++;
+}
+
+static void
+byte_set (unsigned char *dst, int value, size_t size) 
+{
+  while (size-- > 0)
+    *dst++ = value;
+}
+
+static int
+byte_cmp (const unsigned char *a, const unsigned char *b, size_t size) 
+{
+  for (; size-- > 0; a++, b++)
+    if (*a != *b)
+      return *a > *b ? +1 : -1;
+  return 0;
+}
+
+static size_t
+byte_len (const char *string) 
+{
+  const char *p;
+
+  for (p = string; *p != '\0'; p++)
+    continue;
+  return p - string;
+}
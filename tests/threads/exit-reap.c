@@ -0,0 +1,124 @@
+/* Measures how long a process with a large resident set takes to
+   exit, as its parent's wait() would see it.
+
+   Starts a worker in its own address space, in the manner of
+   vm-stress, that fills half of the free user memory and then
+   exits through process_exit().  The main thread runs below the
+   worker's priority, so that it gets the CPU back once the worker
+   is gone, and reports the cycles from the start of the exit to
+   then.  The run is done twice: first with the address space torn
+   down on the exiting thread, then with it left to the reaper, in
+   which case it also reports how long the reaper took to give the
+   memory back.
+
+   Fails if the worker is still around once it has exited, or if
+   fewer user pages are free once its address space is torn down
+   than before it started. */
+
+#include <mman.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "tests/threads/vm-space.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+#include "intrinsic.h"
+#ifdef VM
+#include "vm/vm.h"
+
+/* Where the worker's memory starts. */
+#define BASE ((uint8_t *) 0x10000000)
+
+struct worker
+  {
+    size_t page_cnt;            /* Pages of memory. */
+    uint64_t exit_start;        /* When it started to exit. */
+    struct semaphore ready;     /* Upped when its memory is filled. */
+    struct semaphore go;        /* Upped to make it exit. */
+  };
+
+static void run (size_t page_cnt, bool reap);
+static thread_func worker;
+
+void
+test_exit_reap (void)
+{
+  size_t page_cnt = palloc_free_cnt (PAL_USER) / 2;
+  bool saved = reaper_enabled;
+
+  msg ("Worker with %zu pages.", page_cnt);
+  thread_set_priority (PRI_DEFAULT - 1);
+  run (page_cnt, false);
+  run (page_cnt, true);
+  thread_set_priority (PRI_DEFAULT);
+  reaper_enabled = saved;
+  vm_print_pageout_stats ();
+  pass ();
+}
+
+/* Runs a worker with PAGE_CNT pages, whose address space is left to
+   the reaper if REAP is true. */
+static void
+run (size_t page_cnt, bool reap)
+{
+  struct worker w = { .page_cnt = page_cnt };
+  struct memstat st;
+  uint64_t latency;
+  int64_t start;
+  size_t free_cnt;
+  tid_t tid;
+
+  free_cnt = palloc_free_cnt (PAL_USER);
+  reaper_enabled = reap;
+  sema_init (&w.ready, 0);
+  sema_init (&w.go, 0);
+  tid = thread_create ("worker", PRI_DEFAULT, worker, &w);
+  sema_down (&w.ready);
+
+  /* The worker runs until it is gone. */
+  sema_up (&w.go);
+  latency = rdtsc () - w.exit_start;
+  if (vm_memstat (tid, &st))
+    fail ("worker is still around after exiting");
+  msg ("%s: exit took %llu cycles, %llu per page",
+       reap ? "reaper" : "no reaper", latency, latency / page_cnt);
+
+  start = timer_ticks ();
+  while (vm_reap_backlog () > 0)
+    timer_sleep (1);
+  if (reap)
+    msg ("reaper: memory back after %lld ticks", timer_elapsed (start));
+  if (palloc_free_cnt (PAL_USER) < free_cnt)
+    fail ("%zu user pages were not given back",
+          free_cnt - palloc_free_cnt (PAL_USER));
+}
+
+/* A worker: sets up an address space, fills its memory, and exits,
+   leaving the address space for process_exit() to tear down. */
+static void
+worker (void *w_)
+{
+  struct worker *w = w_;
+  size_t i;
+
+  space_create ();
+  space_reserve (BASE, w->page_cnt);
+
+  for (i = 0; i < w->page_cnt; i++)
+    BASE[i * PGSIZE] = 1;
+  sema_up (&w->ready);
+  sema_down (&w->go);
+  w->exit_start = rdtsc ();
+}
+#else /* !VM */
+void
+test_exit_reap (void)
+{
+  msg ("There is no reaper in this kernel; build with VM to measure it.");
+}
+#endif /* VM */
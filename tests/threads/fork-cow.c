@@ -0,0 +1,221 @@
+/* Measures fork's copy of an address space, which shares the
+   parent's frames copy-on-write, as the parent grows.
+
+   First, in the manner of fork-multiple, gives the running thread
+   an address space with a growing number of touched anonymous
+   pages and forks a thread off it for each size, which copies the
+   address space, writes to one page in WRITE_RATIO, which breaks
+   the sharing of those, checks that it sees the parent's data,
+   and tears its copy down again, as an exec would.  The parent
+   then checks that none of the child's writes reached it.
+   Reports the cycles per page of the copy, of a write that breaks
+   the sharing, and of the teardown.  Fails if a copy takes as many
+   frames from the user pool as its child goes on to write, since
+   it should have shared them all.
+
+   The parent stops growing at half of the free user memory, so
+   that the children's copies fit too.
+
+   Then, in the manner of fork-recursive, forks a chain of
+   CHAIN_DEPTH threads, each off the one before, each of which
+   writes to a few pages before forking the next, and reports how
+   long each fork took.
+
+   Every page is stamped with its owner and checked after each
+   fork, so a write that reaches another thread's copy fails the
+   test. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "tests/threads/vm-space.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+#ifdef VM
+#include "vm/vm.h"
+
+/* Where the memory starts, the largest parent, in pages, and how
+   many of its pages a child writes to. */
+#define BASE ((uint8_t *) 0x10000000)
+#define MAX_PAGES 16384
+#define WRITE_RATIO 8
+
+/* Length of the fork chain, and pages each link writes to. */
+#define CHAIN_DEPTH 8
+#define CHAIN_WRITES 64
+
+/* A forked thread. */
+struct child
+  {
+    struct thread *parent;      /* Thread to copy. */
+    size_t page_cnt;            /* Pages in its address space. */
+    int depth;                  /* Place in the fork chain, or -1. */
+    uint64_t fork_cycles;       /* Time the copy took. */
+    uint64_t write_cycles;      /* Time its writes took. */
+    uint64_t exit_cycles;       /* Time its teardown took. */
+    long copy_frames;           /* User frames the copy took. */
+    struct semaphore done;      /* Upped when finished. */
+  };
+
+static thread_func child_main;
+static void fork_child (struct child *);
+static void stamp (size_t page_no, size_t owner);
+static void check (size_t page_no, size_t owner);
+
+void
+test_fork_cow (void)
+{
+  struct thread *t = thread_current ();
+  size_t page_cnt, populated = 0, max_pages, i;
+  struct child c;
+
+  max_pages = palloc_free_cnt (PAL_USER) / 2;
+  if (max_pages > MAX_PAGES)
+    max_pages = MAX_PAGES;
+  space_create ();
+  msg ("fork of a parent with N touched pages, child writes 1/%d:",
+       WRITE_RATIO);
+  for (page_cnt = 256; page_cnt <= max_pages; page_cnt *= 4)
+    {
+      for (; populated < page_cnt; populated++)
+        {
+          if (!vm_alloc_page (VM_ANON, BASE + populated * PGSIZE, true))
+            fail ("couldn't reserve page %zu", populated);
+          stamp (populated, 0);
+        }
+
+      c = (struct child) {
+        .parent = t,
+        .page_cnt = page_cnt,
+        .depth = -1,
+      };
+      fork_child (&c);
+      for (i = 0; i < page_cnt; i++)
+        check (i, 0);
+      if (c.copy_frames >= (long) (page_cnt / WRITE_RATIO))
+        fail ("fork of %zu pages took %ld frames instead of sharing them",
+              page_cnt, c.copy_frames);
+      msg ("N=%5zu: fork %llu cycles (%llu per page), "
+           "write %llu per page, exit %llu per page",
+           page_cnt, c.fork_cycles, c.fork_cycles / page_cnt,
+           c.write_cycles / (page_cnt / WRITE_RATIO),
+           c.exit_cycles / page_cnt);
+    }
+  if (populated == 0)
+    fail ("not enough free memory for %d pages", 256);
+
+  msg ("chain of %d forks off a parent with %zu pages:",
+       CHAIN_DEPTH, populated);
+  c = (struct child) {
+    .parent = t,
+    .page_cnt = populated,
+    .depth = 0,
+  };
+  fork_child (&c);
+  for (i = 0; i < populated; i++)
+    check (i, 0);
+
+  space_destroy ();
+  vm_print_stats ();
+  pass ();
+}
+
+/* Runs C as a child of the running thread and waits for it, as a
+   parent blocks in fork until its child has copied it. */
+static void
+fork_child (struct child *c)
+{
+  sema_init (&c->done, 0);
+  thread_create ("child", PRI_DEFAULT, child_main, c);
+  sema_down (&c->done);
+}
+
+/* A forked thread: copies its parent's address space, writes to
+   some of it, forks the next link of a chain, and exits. */
+static void
+child_main (void *c_)
+{
+  struct child *c = c_;
+  struct thread *t = thread_current ();
+  size_t owner = c->depth + 2;
+  uint64_t start;
+  size_t free_cnt, i;
+
+  space_create ();
+  free_cnt = palloc_free_cnt (PAL_USER);
+  start = rdtsc ();
+  if (!supplemental_page_table_copy (&t->spt, &c->parent->spt))
+    fail ("couldn't copy an address space of %zu pages", c->page_cnt);
+  c->fork_cycles = rdtsc () - start;
+  c->copy_frames = (long) free_cnt - (long) palloc_free_cnt (PAL_USER);
+
+  if (c->depth < 0)
+    {
+      start = rdtsc ();
+      for (i = 0; i < c->page_cnt; i += WRITE_RATIO)
+        {
+          check (i, 0);
+          stamp (i, owner);
+        }
+      c->write_cycles = rdtsc () - start;
+      for (i = 0; i < c->page_cnt; i++)
+        check (i, i % WRITE_RATIO ? 0 : owner);
+    }
+  else
+    {
+      for (i = 0; i < CHAIN_WRITES; i++)
+        stamp (i, owner);
+      msg ("depth %d: fork %llu cycles", c->depth, c->fork_cycles);
+      if (c->depth + 1 < CHAIN_DEPTH)
+        {
+          struct child next = {
+            .parent = t,
+            .page_cnt = c->page_cnt,
+            .depth = c->depth + 1,
+          };
+          fork_child (&next);
+        }
+      for (i = 0; i < CHAIN_WRITES; i++)
+        check (i, owner);
+    }
+
+  start = rdtsc ();
+  space_destroy ();
+  c->exit_cycles = rdtsc () - start;
+  sema_up (&c->done);
+}
+
+/* Writes OWNER and PAGE_NO into page PAGE_NO. */
+static void
+stamp (size_t page_no, size_t owner)
+{
+  size_t *p = (size_t *) (BASE + page_no * PGSIZE);
+
+  p[0] = owner;
+  p[1] = page_no;
+}
+
+/* Fails unless page PAGE_NO holds what stamp() wrote there for
+   OWNER. */
+static void
+check (size_t page_no, size_t owner)
+{
+  size_t *p = (size_t *) (BASE + page_no * PGSIZE);
+
+  if (p[0] != owner || p[1] != page_no)
+    fail ("page %zu holds %zu/%zu, expected %zu/%zu",
+          page_no, p[0], p[1], owner, page_no);
+}
+#else /* !VM */
+void
+test_fork_cow (void)
+{
+  msg ("There is no copy-on-write fork in this kernel; "
+       "build with VM to measure it.");
+}
+#endif /* VM */
@@ -0,0 +1,194 @@
+/* Measures same-page merging on workers whose memory holds the
+   same contents.
+
+   Starts WORKER_CNT threads, each in its own address space with
+   PAGE_CNT anonymous pages, in the manner of page-parallel.  Page
+   N of every worker is filled with pattern N % PATTERN_CNT, so
+   that after merging only PATTERN_CNT frames should remain for
+   all WORKER_CNT * PAGE_CNT pages.  Turns ksmd on at run time
+   and reports, once a second, how many pages it has saved so
+   far, until that stops growing.  Then every worker writes to
+   one page in WRITE_RATIO, which breaks the sharing of those,
+   and checks that it still sees its own data everywhere, and
+   that no worker's write reached another.  Restores ksmd's
+   tunables at the end.
+
+   Fails unless merging saved at least half of the pages it should
+   have, and unless the writes unshared some pages but no more
+   than they wrote to. */
+
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "tests/threads/vm-space.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+#include "intrinsic.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/vm.h"
+
+/* Workers, pages per worker, where they start, distinct page
+   contents, and how many of its pages a worker writes to. */
+#define WORKER_CNT 4
+#define PAGE_CNT 256
+#define BASE ((uint8_t *) 0x10000000)
+#define PATTERN_CNT 16
+#define WRITE_RATIO 8
+
+/* ksmd's settings for the run, and longest to wait for it. */
+#define SCAN_PAGES 256
+#define SCAN_SLEEP_MS 10
+#define WAIT_SECONDS 30
+
+struct worker
+  {
+    int id;                     /* Worker number. */
+    struct semaphore filled;    /* Upped when its pages are filled. */
+    struct semaphore go;        /* Down to write, then to leave. */
+    struct semaphore written;   /* Upped when its writes are checked. */
+    struct semaphore done;      /* Upped when finished. */
+  };
+
+static thread_func worker;
+static void fill (size_t page_no);
+static void check (int id, size_t page_no, bool written);
+
+void
+test_ksm_merge (void)
+{
+  struct worker workers[WORKER_CNT];
+  unsigned old_pages = ksm_pages_to_scan, old_sleep = ksm_sleep_ms;
+  size_t expected = WORKER_CNT * PAGE_CNT - PATTERN_CNT;
+  size_t write_cnt = WORKER_CNT * PAGE_CNT / WRITE_RATIO;
+  size_t before, saved, unshared, last = 0;
+  int64_t start;
+  int i, seconds;
+
+  for (i = 0; i < WORKER_CNT; i++)
+    {
+      char name[16];
+
+      workers[i].id = i;
+      sema_init (&workers[i].filled, 0);
+      sema_init (&workers[i].go, 0);
+      sema_init (&workers[i].written, 0);
+      sema_init (&workers[i].done, 0);
+      snprintf (name, sizeof name, "worker %d", i);
+      thread_create (name, PRI_DEFAULT, worker, &workers[i]);
+    }
+  for (i = 0; i < WORKER_CNT; i++)
+    sema_down (&workers[i].filled);
+
+  before = frame_shared_cnt ();
+  msg ("%d workers with %d pages each in %d patterns; "
+       "merging should save %zu pages.",
+       WORKER_CNT, PAGE_CNT, PATTERN_CNT, expected);
+  ksm_sleep_ms = SCAN_SLEEP_MS;
+  ksm_pages_to_scan = SCAN_PAGES;
+  start = timer_ticks ();
+  for (seconds = 1; seconds <= WAIT_SECONDS; seconds++)
+    {
+      timer_sleep (TIMER_FREQ);
+      saved = frame_shared_cnt () - before;
+      msg ("after %ds: %zu pages saved", seconds, saved);
+      if (saved >= expected || (saved > 0 && saved == last))
+        break;
+      last = saved;
+    }
+  msg ("%zu of %zu pages saved in %lld ms", saved, expected,
+       timer_elapsed (start) * 1000 / TIMER_FREQ);
+  if (saved < expected / 2)
+    fail ("merging saved only %zu of %zu pages", saved, expected);
+
+  /* Stop merging, so that what the writes unshare stays so, and
+     let a pass that is under way finish. */
+  ksm_pages_to_scan = 0;
+  timer_msleep (2 * SCAN_SLEEP_MS);
+  saved = frame_shared_cnt () - before;
+  for (i = 0; i < WORKER_CNT; i++)
+    sema_up (&workers[i].go);
+  for (i = 0; i < WORKER_CNT; i++)
+    sema_down (&workers[i].written);
+  unshared = before + saved - frame_shared_cnt ();
+  if (unshared == 0 || unshared > write_cnt)
+    fail ("%zu writes unshared %zu pages", write_cnt, unshared);
+  for (i = 0; i < WORKER_CNT; i++)
+    sema_up (&workers[i].go);
+  for (i = 0; i < WORKER_CNT; i++)
+    sema_down (&workers[i].done);
+
+  ksm_pages_to_scan = old_pages;
+  ksm_sleep_ms = old_sleep;
+  frame_print_stats ();
+  pass ();
+}
+
+/* A worker: fills its memory, waits for merging, writes to some
+   of it, checks all of it, and tears it down. */
+static void
+worker (void *w_)
+{
+  struct worker *w = w_;
+  uint64_t start;
+  size_t i;
+
+  space_create ();
+  space_reserve (BASE, PAGE_CNT);
+
+  for (i = 0; i < PAGE_CNT; i++)
+    fill (i);
+  sema_up (&w->filled);
+  sema_down (&w->go);
+
+  start = rdtsc ();
+  for (i = 0; i < PAGE_CNT; i += WRITE_RATIO)
+    *(size_t *) (BASE + i * PGSIZE) = w->id + 1;
+  if (w->id == 0)
+    msg ("write that breaks sharing: %llu cycles per page",
+         (rdtsc () - start) / (PAGE_CNT / WRITE_RATIO));
+  for (i = 0; i < PAGE_CNT; i++)
+    check (w->id, i, i % WRITE_RATIO == 0);
+  sema_up (&w->written);
+  sema_down (&w->go);
+
+  space_destroy ();
+  sema_up (&w->done);
+}
+
+/* Fills page PAGE_NO with its pattern. */
+static void
+fill (size_t page_no)
+{
+  memset (BASE + page_no * PGSIZE, 'a' + page_no % PATTERN_CNT, PGSIZE);
+}
+
+/* Fails unless page PAGE_NO of worker ID holds its pattern, with
+   ID + 1 in its first word if WRITTEN. */
+static void
+check (int id, size_t page_no, bool written)
+{
+  uint8_t *p = BASE + page_no * PGSIZE;
+  uint8_t pattern = 'a' + page_no % PATTERN_CNT;
+  size_t i;
+
+  if (written && *(size_t *) p != (size_t) id + 1)
+    fail ("worker %d's write to page %zu was lost", id, page_no);
+  for (i = written ? sizeof (size_t) : 0; i < PGSIZE; i++)
+    if (p[i] != pattern)
+      fail ("worker %d found page %zu corrupted at byte %zu",
+            id, page_no, i);
+}
+#else /* !VM */
+void
+test_ksm_merge (void)
+{
+  msg ("There is no same-page merging in this kernel; "
+       "build with VM to measure it.");
+}
+#endif /* VM */
@@ -0,0 +1,76 @@
+/* Checks that kswapd frees user memory ahead of demand.
+
+   Touches fresh anonymous pages of the running thread's own
+   address space until the user pool drops below its low
+   watermark, which should wake kswapd.  Then sleeps, touching
+   nothing, and checks that kswapd evicts pages until the pool is
+   back at its high watermark, and that every page still holds
+   what was written to it.
+
+   Needs a VM kernel with kswapd and a swap disk, so it runs from
+   vm/build. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "tests/threads/vm-space.h"
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/disk.h"
+#include "devices/timer.h"
+#ifdef VM
+#include "vm/vm.h"
+
+/* Where the memory starts, and longest to wait for kswapd. */
+#define BASE ((uint8_t *) 0x10000000)
+#define WAIT_SECONDS 10
+
+void
+test_kswapd_wmark (void)
+{
+  size_t page_cnt = palloc_free_cnt (PAL_USER);
+  size_t touched, i;
+  int ticks;
+
+  if (!kswapd_enabled)
+    fail ("kswapd is off; run without -nokswapd");
+  if (disk_get (1, 1) == NULL)
+    fail ("no swap disk; run with one to evict anonymous pages");
+
+  space_create ();
+  space_reserve (BASE, page_cnt);
+  for (touched = 0; touched < page_cnt; touched++)
+    {
+      if (palloc_below_wmark (PAL_USER, WMARK_LOW))
+        break;
+      *(size_t *) (BASE + touched * PGSIZE) = touched;
+    }
+  if (touched == page_cnt)
+    fail ("touched %zu pages without running low", touched);
+  msg ("user pool below its low watermark");
+
+  for (ticks = 0; palloc_below_wmark (PAL_USER, WMARK_HIGH); ticks++)
+    {
+      if (ticks >= WAIT_SECONDS * TIMER_FREQ)
+        fail ("user pool still below its high watermark after %d s",
+              WAIT_SECONDS);
+      timer_sleep (1);
+    }
+  msg ("kswapd brought it back to its high watermark");
+
+  for (i = 0; i < touched; i++)
+    if (*(size_t *) (BASE + i * PGSIZE) != i)
+      fail ("page %zu lost its contents", i);
+  msg ("evicted pages kept their contents");
+
+  space_destroy ();
+  pass ();
+}
+#else /* !VM */
+void
+test_kswapd_wmark (void)
+{
+  fail ("kswapd needs a VM kernel; run this test from vm/build.");
+}
+#endif /* VM */
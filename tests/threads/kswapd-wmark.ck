@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(kswapd-wmark) begin
+(kswapd-wmark) user pool below its low watermark
+(kswapd-wmark) kswapd brought it back to its high watermark
+(kswapd-wmark) evicted pages kept their contents
+(kswapd-wmark) PASS
+(kswapd-wmark) end
+EOF
+pass;
@@ -0,0 +1,143 @@
+/* Measures the cost of switching between two address spaces.
+
+   Two threads, each running in its own page map level 4 with a
+   private working set mapped, ping-pong through a pair of
+   semaphores.  On each turn a thread touches every page of its
+   working set, so a switch costs a TLB refill whenever the
+   switch flushed the TLB.  Reports the cycles per round trip:
+   compare a normal boot against one with -nopcid.
+
+   This is a benchmark, not a pass/fail test. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+#ifdef USERPROG
+/* Pages in each thread's working set, where it is mapped, and
+   number of round trips. */
+#define WS_PAGES 64
+#define WS_BASE ((uint8_t *) 0x10000000)
+#define ROUND_CNT 1000
+
+struct pingpong
+  {
+    struct semaphore ready;     /* Upped once per player when mapped. */
+    struct semaphore turn[2];   /* Whose turn it is. */
+    struct semaphore done;      /* Upped once per player when done. */
+    uint64_t end;               /* Time stamp after the last round. */
+  };
+
+struct player
+  {
+    struct pingpong *pp;
+    int id;
+  };
+
+static thread_func player;
+
+void
+test_pcid_switch (void)
+{
+  struct pingpong pp;
+  struct player players[2];
+  uint64_t start;
+  int i;
+
+  sema_init (&pp.ready, 0);
+  sema_init (&pp.turn[0], 0);
+  sema_init (&pp.turn[1], 0);
+  sema_init (&pp.done, 0);
+
+  for (i = 0; i < 2; i++)
+    {
+      char name[16];
+      players[i].pp = &pp;
+      players[i].id = i;
+      snprintf (name, sizeof name, "player %d", i);
+      thread_create (name, PRI_DEFAULT, player, &players[i]);
+    }
+  sema_down (&pp.ready);
+  sema_down (&pp.ready);
+
+  start = rdtsc ();
+  sema_up (&pp.turn[0]);
+  sema_down (&pp.done);
+  sema_down (&pp.done);
+
+  msg ("%d round trips, %d pages touched per turn.", ROUND_CNT, WS_PAGES);
+  msg ("PCIDs %s.", pml4_use_pcid ? "requested" : "disabled by -nopcid");
+  msg ("%llu cycles per round trip", (pp.end - start) / ROUND_CNT);
+}
+
+/* A player: switches to its own address space, then takes its
+   turns until the game is over. */
+static void
+player (void *player_)
+{
+  struct player *p = player_;
+  struct pingpong *pp = p->pp;
+  struct thread *t = thread_current ();
+  enum intr_level old_level;
+  uint64_t *pml4;
+  void *frames[WS_PAGES];
+  int i, round;
+
+  pml4 = pml4_create ();
+  if (pml4 == NULL)
+    fail ("couldn't allocate a page table");
+  for (i = 0; i < WS_PAGES; i++)
+    {
+      frames[i] = palloc_get_page (PAL_ZERO);
+      if (frames[i] == NULL
+          || !pml4_set_page (pml4, WS_BASE + i * PGSIZE, frames[i], true))
+        fail ("couldn't map working set page %d", i);
+    }
+
+  /* From now on the scheduler switches to PML4 whenever we run. */
+  old_level = intr_disable ();
+  t->pml4 = pml4;
+  pml4_activate (pml4);
+  intr_set_level (old_level);
+  sema_up (&pp->ready);
+
+  for (round = 0; round < ROUND_CNT; round++)
+    {
+      sema_down (&pp->turn[p->id]);
+      for (i = 0; i < WS_PAGES; i++)
+        ((volatile uint8_t *) WS_BASE)[i * PGSIZE]++;
+      sema_up (&pp->turn[!p->id]);
+    }
+  if (p->id == 1)
+    pp->end = rdtsc ();
+
+  old_level = intr_disable ();
+  t->pml4 = NULL;
+  pml4_activate (NULL);
+  intr_set_level (old_level);
+
+  /* Unmap the working set so that pml4_destroy() does not free
+     the frames behind our back. */
+  for (i = 0; i < WS_PAGES; i++)
+    {
+      pml4_clear_page (pml4, WS_BASE + i * PGSIZE);
+      palloc_free_page (frames[i]);
+    }
+  pml4_destroy (pml4);
+  sema_up (&pp->done);
+}
+#else /* !USERPROG */
+void
+test_pcid_switch (void)
+{
+  msg ("Threads share one address space in this kernel; "
+       "build with USERPROG to measure address space switches.");
+}
+#endif /* USERPROG */
@@ -0,0 +1,92 @@
+/* Swings memory demand back and forth between the kernel and
+   user page pools.
+
+   Alternates between a "cache" phase, which fills the kernel
+   pool the way a growing file cache would, and a "process"
+   phase, which fills the user pool the way a growing set of
+   processes would.  Each phase must get more pages than it gets
+   with lending disabled, by borrowing from the other, idle pool,
+   and must give every page back, so that the next phase can
+   borrow in the other direction. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+
+/* Number of cache/process round trips. */
+#define ROUND_CNT 3
+
+static size_t fill (enum palloc_flags, void **head);
+static void drain (void *head);
+
+void
+test_pool_swing (void)
+{
+  unsigned loan_pct = pool_loan_pct;
+  size_t static_kernel, static_user;
+  void *head;
+  int round;
+
+  if (loan_pct == 0)
+    fail ("lending is disabled; run without -loan=0");
+
+  /* Measure what each phase gets from its own pool alone. */
+  pool_loan_pct = 0;
+  static_kernel = fill (0, &head);
+  drain (head);
+  static_user = fill (PAL_USER, &head);
+  drain (head);
+  pool_loan_pct = loan_pct;
+  msg ("Measured both pools without lending.");
+
+  for (round = 0; round < ROUND_CNT; round++)
+    {
+      size_t cnt;
+
+      cnt = fill (0, &head);
+      drain (head);
+      if (cnt <= static_kernel)
+        fail ("round %d: cache phase got %zu pages, no more than the "
+              "%zu of the kernel pool", round, cnt, static_kernel);
+      msg ("Round %d: cache phase borrowed from the user pool.", round);
+
+      cnt = fill (PAL_USER, &head);
+      drain (head);
+      if (cnt <= static_user)
+        fail ("round %d: process phase got %zu pages, no more than the "
+              "%zu of the user pool", round, cnt, static_user);
+      msg ("Round %d: process phase borrowed from the kernel pool.", round);
+    }
+  pass ();
+}
+
+/* Allocates pages with FLAGS until none are left, chaining them
+   together through their first words starting from *HEAD, and
+   returns the number allocated. */
+static size_t
+fill (enum palloc_flags flags, void **head)
+{
+  size_t cnt = 0;
+  void *page;
+
+  *head = NULL;
+  while ((page = palloc_get_page (flags)) != NULL)
+    {
+      *(void **) page = *head;
+      *head = page;
+      cnt++;
+    }
+  return cnt;
+}
+
+/* Frees the chain of pages that starts at HEAD. */
+static void
+drain (void *head)
+{
+  while (head != NULL)
+    {
+      void *next = *(void **) head;
+      palloc_free_page (head);
+      head = next;
+    }
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pool-swing) begin
+(pool-swing) Measured both pools without lending.
+(pool-swing) Round 0: cache phase borrowed from the user pool.
+(pool-swing) Round 0: process phase borrowed from the kernel pool.
+(pool-swing) Round 1: cache phase borrowed from the user pool.
+(pool-swing) Round 1: process phase borrowed from the kernel pool.
+(pool-swing) Round 2: cache phase borrowed from the user pool.
+(pool-swing) Round 2: process phase borrowed from the kernel pool.
+(pool-swing) PASS
+(pool-swing) end
+EOF
+pass;
@@ -0,0 +1,184 @@
+/* Measures what the range operations on page tables save over
+   their one-page-at-a-time counterparts.
+
+   Maps a few thousand pages of a private address space, reads
+   back and clears their accessed bits after touching each of
+   them, and unmaps them again, first with a loop of per-page
+   calls, which walk all four levels and flush the TLB for every
+   page, and then with one call to pml4_set_range(),
+   pml4_harvest_range() and pml4_clear_range() each.  Reports the
+   cycles per page of each.
+
+   This is a benchmark, not a pass/fail test. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* Pages in the range, where it is mapped, and number of distinct
+   frames behind it. */
+#define RANGE_PAGES 4096
+#define RANGE_BASE ((uint8_t *) 0x10000000)
+#define FRAME_CNT 16
+
+/* Number of measurements of each kind. */
+#define ROUND_CNT 8
+
+struct timings
+  {
+    uint64_t set, harvest, clear;
+  };
+
+static void touch (uint64_t *pml4);
+static void run_per_page (uint64_t *pml4, void **kpages, struct timings *);
+static void run_range (uint64_t *pml4, void **kpages, struct timings *);
+
+void
+test_pt_range (void)
+{
+  struct timings per_page = {0, 0, 0}, range = {0, 0, 0};
+  void *frames[FRAME_CNT];
+  void **kpages;
+  uint64_t *pml4;
+  int round;
+  size_t i;
+
+  kpages = malloc (RANGE_PAGES * sizeof *kpages);
+  if (kpages == NULL)
+    fail ("couldn't allocate the frame list");
+  for (i = 0; i < FRAME_CNT; i++)
+    if ((frames[i] = palloc_get_page (PAL_ZERO)) == NULL)
+      fail ("couldn't allocate frame %zu", i);
+  for (i = 0; i < RANGE_PAGES; i++)
+    kpages[i] = frames[i % FRAME_CNT];
+
+  pml4 = pml4_create ();
+  if (pml4 == NULL)
+    fail ("couldn't allocate a page table");
+
+  /* The first round also allocates the page tables; both kinds of
+     calls find them in place afterward. */
+  for (round = 0; round <= ROUND_CNT; round++)
+    {
+      struct timings t;
+
+      run_per_page (pml4, kpages, &t);
+      if (round > 0)
+        {
+          per_page.set += t.set;
+          per_page.harvest += t.harvest;
+          per_page.clear += t.clear;
+        }
+      run_range (pml4, kpages, &t);
+      if (round > 0)
+        {
+          range.set += t.set;
+          range.harvest += t.harvest;
+          range.clear += t.clear;
+        }
+    }
+
+  msg ("%d pages, %d rounds.", RANGE_PAGES, ROUND_CNT);
+  msg ("map:     %llu cycles per page one by one, %llu as a range",
+       per_page.set / (ROUND_CNT * RANGE_PAGES),
+       range.set / (ROUND_CNT * RANGE_PAGES));
+  msg ("harvest: %llu cycles per page one by one, %llu as a range",
+       per_page.harvest / (ROUND_CNT * RANGE_PAGES),
+       range.harvest / (ROUND_CNT * RANGE_PAGES));
+  msg ("unmap:   %llu cycles per page one by one, %llu as a range",
+       per_page.clear / (ROUND_CNT * RANGE_PAGES),
+       range.clear / (ROUND_CNT * RANGE_PAGES));
+
+  pml4_destroy (pml4);
+  for (i = 0; i < FRAME_CNT; i++)
+    palloc_free_page (frames[i]);
+  free (kpages);
+}
+
+/* Touches every page of the range through PML4, which sets their
+   accessed bits. */
+static void
+touch (uint64_t *pml4)
+{
+  enum intr_level old_level;
+  size_t i;
+
+  /* Keep the scheduler from switching page tables under us. */
+  old_level = intr_disable ();
+  pml4_activate (pml4);
+  for (i = 0; i < RANGE_PAGES; i++)
+    ((volatile uint8_t *) RANGE_BASE)[i * PGSIZE];
+  pml4_activate (NULL);
+  intr_set_level (old_level);
+}
+
+/* Maps, harvests, and unmaps the range in PML4 one page at a
+   time, storing the cycles each step took in *T. */
+static void
+run_per_page (uint64_t *pml4, void **kpages, struct timings *t)
+{
+  size_t accessed_cnt = 0;
+  uint64_t start;
+  size_t i;
+
+  start = rdtsc ();
+  for (i = 0; i < RANGE_PAGES; i++)
+    if (!pml4_set_page (pml4, RANGE_BASE + i * PGSIZE, kpages[i], true))
+      fail ("couldn't map page %zu", i);
+  t->set = rdtsc () - start;
+
+  touch (pml4);
+  start = rdtsc ();
+  for (i = 0; i < RANGE_PAGES; i++)
+    if (pml4_is_accessed (pml4, RANGE_BASE + i * PGSIZE))
+      {
+        pml4_set_accessed (pml4, RANGE_BASE + i * PGSIZE, false);
+        accessed_cnt++;
+      }
+  t->harvest = rdtsc () - start;
+  if (accessed_cnt != RANGE_PAGES)
+    fail ("%zu of %d touched pages found accessed",
+          accessed_cnt, RANGE_PAGES);
+
+  start = rdtsc ();
+  for (i = 0; i < RANGE_PAGES; i++)
+    pml4_clear_page (pml4, RANGE_BASE + i * PGSIZE);
+  t->clear = rdtsc () - start;
+}
+
+/* Maps, harvests, and unmaps the range in PML4 with one call
+   each, storing the cycles each step took in *T. */
+static void
+run_range (uint64_t *pml4, void **kpages, struct timings *t)
+{
+  size_t accessed_cnt;
+  uint64_t start;
+
+  start = rdtsc ();
+  if (!pml4_set_range (pml4, RANGE_BASE, kpages, RANGE_PAGES, true))
+    fail ("couldn't map the range");
+  t->set = rdtsc () - start;
+
+  touch (pml4);
+  start = rdtsc ();
+  accessed_cnt = pml4_harvest_range (pml4, RANGE_BASE, RANGE_PAGES, PTE_A,
+                                     NULL);
+  t->harvest = rdtsc () - start;
+  if (accessed_cnt != RANGE_PAGES)
+    fail ("%zu of %d touched pages found accessed",
+          accessed_cnt, RANGE_PAGES);
+  if (pml4_harvest_range (pml4, RANGE_BASE, RANGE_PAGES, PTE_A, NULL) != 0)
+    fail ("accessed bits survived a harvest");
+
+  start = rdtsc ();
+  pml4_clear_range (pml4, RANGE_BASE, RANGE_PAGES);
+  t->clear = rdtsc () - start;
+  if (pml4_get_page (pml4, RANGE_BASE + (RANGE_PAGES - 1) * PGSIZE) != NULL)
+    fail ("page still mapped after pml4_clear_range()");
+}
@@ -0,0 +1,208 @@
+/* Measures how well a resident-set limit shields a process from a
+   runaway neighbour.
+
+   Measures the free user memory, then starts two workers, each in
+   its own address space, in the manner of vm-stress.  The steady
+   worker fills a quarter of that memory and then touches it over
+   and over.  The runaway worker sweeps twice as much memory as
+   there is, PASS_CNT times.  The run is done twice: first with no
+   limit, then with the runaway's resident set limited to a quarter
+   of the memory.  For each run, reports how many page faults the
+   steady worker took per pass over its memory while the runaway
+   ran, and both workers' resident sets, working sets and fault
+   rates halfway through, as memstat() reports them.
+
+   Fails if the limited runaway has more pages resident than its
+   limit, or if the steady worker, whose memory then fits beside
+   the runaway's, still faults on more than one page in 8 of it
+   per pass.  Needs a swap disk. */
+
+#include <mman.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "tests/threads/vm-space.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/disk.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/vm.h"
+
+/* Where the workers' memory starts, and how often the runaway
+   sweeps its memory. */
+#define BASE ((uint8_t *) 0x10000000)
+#define PASS_CNT 2
+
+struct worker
+  {
+    const char *name;           /* "steady" or "runaway". */
+    bool steady;                /* The steady worker? */
+    size_t page_cnt;            /* Pages of memory. */
+    size_t rss_limit;           /* Limit on its resident set, or 0. */
+    tid_t tid;                  /* Its thread. */
+    size_t rss;                 /* Resident pages halfway through. */
+    long long faults;           /* Faults taken while the other ran. */
+    long long passes;           /* Passes over its memory meanwhile. */
+    struct semaphore ready;     /* Upped when its memory is filled. */
+    struct semaphore done;      /* Upped when finished. */
+  };
+
+static void run (size_t free_cnt, size_t limit);
+static void report (struct worker *);
+static thread_func worker;
+
+/* Set once the runaway is done, to stop the steady worker. */
+static volatile bool runaway_done;
+
+void
+test_rss_limit (void)
+{
+  size_t free_cnt;
+
+  if (disk_get (1, 1) == NULL)
+    fail ("no swap disk; run with one to evict anonymous pages");
+
+  free_cnt = palloc_free_cnt (PAL_USER);
+  msg ("%zu user pages free; steady worker with %zu pages, "
+       "runaway with %zu.", free_cnt, free_cnt / 4, free_cnt * 2);
+  msg ("No limit:");
+  run (free_cnt, 0);
+  msg ("Runaway limited to %zu pages:", free_cnt / 4);
+  run (free_cnt, free_cnt / 4);
+  frame_print_stats ();
+  pass ();
+}
+
+/* Runs the steady worker against a runaway whose resident set is
+   limited to LIMIT pages, or not at all if LIMIT is 0. */
+static void
+run (size_t free_cnt, size_t limit)
+{
+  struct worker steady = {
+    .name = "steady",
+    .steady = true,
+    .page_cnt = free_cnt / 4,
+  };
+  struct worker runaway = {
+    .name = "runaway",
+    .page_cnt = free_cnt * 2,
+    .rss_limit = limit,
+  };
+
+  runaway_done = false;
+  sema_init (&steady.ready, 0);
+  sema_init (&steady.done, 0);
+  sema_init (&runaway.ready, 0);
+  sema_init (&runaway.done, 0);
+  steady.tid = thread_create ("steady", PRI_DEFAULT, worker, &steady);
+  sema_down (&steady.ready);
+  runaway.tid = thread_create ("runaway", PRI_DEFAULT, worker, &runaway);
+
+  /* Look halfway through the runaway's sweeps, by which time kwsd
+     has sampled both workers. */
+  sema_down (&runaway.ready);
+  report (&steady);
+  report (&runaway);
+  sema_down (&runaway.done);
+  sema_down (&steady.done);
+
+  msg ("steady worker: %lld faults in %lld passes, %lld per pass",
+       steady.faults, steady.passes,
+       steady.passes ? steady.faults / steady.passes : steady.faults);
+  if (limit == 0)
+    return;
+  if (runaway.rss > limit)
+    fail ("runaway worker has %zu pages resident, over its limit of %zu",
+          runaway.rss, limit);
+  if (steady.faults > (steady.passes + 1) * (long long) (steady.page_cnt / 8))
+    fail ("steady worker still took %lld faults in %lld passes",
+          steady.faults, steady.passes);
+}
+
+/* Prints what memstat() says about W, and records its resident
+   set. */
+static void
+report (struct worker *w)
+{
+  struct memstat st;
+
+  if (!vm_memstat (w->tid, &st))
+    {
+      msg ("%s worker: gone", w->name);
+      return;
+    }
+  w->rss = st.rss;
+  msg ("%s worker: %zu pages resident (limit %zu), working set %zu, "
+       "%u faults/s", w->name, st.rss, st.rss_limit, st.wss, st.fault_rate);
+}
+
+/* Stamps page N of W's memory, after checking the stamp it has. */
+static void
+touch (struct worker *w, size_t n)
+{
+  size_t *stamp = (size_t *) (BASE + n * PGSIZE);
+
+  if (stamp[0] != 0 && (stamp[0] != (size_t) w->name[0] || stamp[1] != n))
+    fail ("%s worker found page %zu corrupted", w->name, n);
+  stamp[0] = w->name[0];
+  stamp[1] = n;
+}
+
+/* A worker: sets up an address space with its memory and touches
+   it.  The runaway sweeps it PASS_CNT times, upping READY halfway.
+   The steady worker fills it, ups READY, and sweeps it until the
+   runaway is done, counting its faults. */
+static void
+worker (void *w_)
+{
+  struct worker *w = w_;
+  struct thread *t = thread_current ();
+  long long start_faults;
+  size_t pass, i;
+
+  space_create ();
+  t->spt.rss_limit = w->rss_limit;
+  space_reserve (BASE, w->page_cnt);
+
+  if (w->steady)
+    {
+      for (i = 0; i < w->page_cnt; i++)
+        touch (w, i);
+      sema_up (&w->ready);
+      start_faults = t->spt.fault_cnt;
+      while (!runaway_done)
+        {
+          for (i = 0; i < w->page_cnt; i++)
+            touch (w, i);
+          w->passes++;
+        }
+      w->faults = t->spt.fault_cnt - start_faults;
+    }
+  else
+    {
+      for (pass = 0; pass < PASS_CNT; pass++)
+        for (i = 0; i < w->page_cnt; i++)
+          {
+            touch (w, i);
+            if (pass == PASS_CNT / 2 && i == 0)
+              sema_up (&w->ready);
+          }
+      runaway_done = true;
+    }
+
+  space_destroy ();
+  sema_up (&w->done);
+}
+#else /* !VM */
+void
+test_rss_limit (void)
+{
+  msg ("There are no resident-set limits in this kernel; "
+       "build with VM to measure them.");
+}
+#endif /* VM */
@@ -0,0 +1,87 @@
+/* Measures the supplemental page table on the page fault path
+   of a large address space.
+
+   Gives the running thread an address space of its own and
+   reserves over a hundred thousand lazily allocated anonymous
+   pages in it, timing each insertion, so that any pause to grow
+   the table shows up as the slowest one.  Then looks every page
+   up in a scattered order, brings a sample of them in as a page
+   fault would, and tears the address space down.  Reports the
+   cycles per page of each step.
+
+   This is a benchmark, not a pass/fail test. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "tests/threads/vm-space.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+#ifdef VM
+#include "vm/vm.h"
+
+/* Pages to reserve, where they start, and how many of them to
+   bring in. */
+#define PAGE_CNT 131072
+#define BASE ((uint8_t *) 0x10000000)
+#define CLAIM_CNT 1024
+
+/* Step between consecutive lookups, in pages.  Odd, so that the
+   lookups visit every page once. */
+#define LOOKUP_STRIDE 4099
+
+void
+test_spt_fault (void)
+{
+  struct thread *t = thread_current ();
+  uint64_t start, elapsed, slowest = 0, insert = 0;
+  size_t page_cnt, i;
+
+  space_create ();
+
+  for (page_cnt = 0; page_cnt < PAGE_CNT; page_cnt++)
+    {
+      start = rdtsc ();
+      if (!vm_alloc_page (VM_ANON, BASE + page_cnt * PGSIZE, true))
+        break;
+      elapsed = rdtsc () - start;
+      insert += elapsed;
+      if (elapsed > slowest)
+        slowest = elapsed;
+    }
+  if (page_cnt < CLAIM_CNT)
+    fail ("only %zu pages fit in kernel memory", page_cnt);
+  msg ("%zu pages reserved.", page_cnt);
+  msg ("insert: %llu cycles per page, slowest %llu",
+       insert / page_cnt, slowest);
+
+  start = rdtsc ();
+  for (i = 0; i < page_cnt; i++)
+    {
+      uint8_t *va = BASE + (i * LOOKUP_STRIDE % page_cnt) * PGSIZE;
+      if (spt_find_page (&t->spt, va + PGSIZE / 2) == NULL)
+        fail ("page at %p went missing", va);
+    }
+  msg ("lookup: %llu cycles per page", (rdtsc () - start) / page_cnt);
+
+  start = rdtsc ();
+  for (i = 0; i < CLAIM_CNT; i++)
+    if (!vm_claim_page (BASE + i * (page_cnt / CLAIM_CNT) * PGSIZE))
+      fail ("couldn't bring in page %zu", i);
+  msg ("fault-in: %llu cycles per page", (rdtsc () - start) / CLAIM_CNT);
+
+  start = rdtsc ();
+  space_destroy ();
+  msg ("teardown: %llu cycles per page", (rdtsc () - start) / page_cnt);
+}
+#else /* !VM */
+void
+test_spt_fault (void)
+{
+  msg ("There are no supplemental page tables in this kernel; "
+       "build with VM to measure them.");
+}
+#endif /* VM */
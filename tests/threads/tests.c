@@ -38,6 +38,19 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"pool-swing", test_pool_swing},
+    {"tlb-sweep", test_tlb_sweep},
+    {"pcid-switch", test_pcid_switch},
+    {"pt-range", test_pt_range},
+    {"spt-fault", test_spt_fault},
+    {"vm-stress", test_vm_stress},
+    {"fork-cow", test_fork_cow},
+    {"ksm-merge", test_ksm_merge},
+    {"rss-limit", test_rss_limit},
+    {"exit-reap", test_exit_reap},
+    {"vm-advice", test_vm_advice},
+    {"vm-msync", test_vm_msync},
+    {"kswapd-wmark", test_kswapd_wmark},
   };
 
 static const char *test_name;
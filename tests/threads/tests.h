@@ -32,6 +32,19 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_pool_swing;
+extern test_func test_tlb_sweep;
+extern test_func test_pcid_switch;
+extern test_func test_pt_range;
+extern test_func test_spt_fault;
+extern test_func test_vm_stress;
+extern test_func test_fork_cow;
+extern test_func test_ksm_merge;
+extern test_func test_rss_limit;
+extern test_func test_exit_reap;
+extern test_func test_vm_advice;
+extern test_func test_vm_msync;
+extern test_func test_kswapd_wmark;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
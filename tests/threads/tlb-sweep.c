@@ -0,0 +1,96 @@
+/* Measures how much the large pages of the kernel's direct map
+   save on TLB-bound accesses.
+
+   Sweeps a multi-megabyte kernel buffer touching one byte per
+   page, so that nearly every access needs a fresh translation,
+   first through the direct map, which is built from 2 MB pages,
+   and then through an alias of the same frames built from 4 kB
+   pages.  Reports the cycles spent per touch through each
+   mapping.
+
+   This is a benchmark, not a pass/fail test. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* Largest buffer to try, in pages, and the user virtual address
+   at which the 4 kB alias of the buffer is mapped. */
+#define SWEEP_PAGES 2048
+#define ALIAS_BASE ((uint8_t *) 0x10000000)
+
+/* Number of passes over the buffer per measurement. */
+#define SWEEP_ROUNDS 16
+
+static uint64_t sweep (volatile uint8_t *, size_t page_cnt);
+
+void
+test_tlb_sweep (void)
+{
+  enum intr_level old_level;
+  uint64_t direct, alias;
+  uint64_t *pml4;
+  uint8_t *buf = NULL;
+  size_t page_cnt;
+  size_t i;
+
+  for (page_cnt = SWEEP_PAGES; page_cnt > 0; page_cnt /= 2)
+    if ((buf = palloc_get_multiple (PAL_ZERO, page_cnt)) != NULL)
+      break;
+  if (buf == NULL)
+    fail ("couldn't allocate a buffer to sweep");
+
+  /* Build the 4 kB alias of the buffer in a private page table. */
+  pml4 = pml4_create ();
+  if (pml4 == NULL)
+    fail ("couldn't allocate a page table");
+  for (i = 0; i < page_cnt; i++)
+    if (!pml4_set_page (pml4, ALIAS_BASE + i * PGSIZE, buf + i * PGSIZE,
+                        true))
+      fail ("couldn't map alias page %zu", i);
+
+  msg ("Sweeping %zu kB, %d rounds, one byte per page.",
+       page_cnt * PGSIZE / 1024, SWEEP_ROUNDS);
+
+  /* Keep the scheduler from switching page tables under us. */
+  old_level = intr_disable ();
+  pml4_activate (pml4);
+  direct = sweep (buf, page_cnt);
+  alias = sweep (ALIAS_BASE, page_cnt);
+  pml4_activate (NULL);
+  intr_set_level (old_level);
+
+  msg ("direct map (large pages): %llu cycles per touch", direct);
+  msg ("alias (4 kB pages): %llu cycles per touch", alias);
+
+  /* Unmap the alias before destroying it, so that
+     pml4_destroy() does not free the buffer's frames. */
+  for (i = 0; i < page_cnt; i++)
+    pml4_clear_page (pml4, ALIAS_BASE + i * PGSIZE);
+  pml4_destroy (pml4);
+  palloc_free_multiple (buf, page_cnt);
+}
+
+/* Touches one byte in each of the PAGE_CNT pages at BUF,
+   SWEEP_ROUNDS times after a warm-up pass, and returns the
+   average number of cycles per touch. */
+static uint64_t
+sweep (volatile uint8_t *buf, size_t page_cnt)
+{
+  uint64_t start;
+  size_t round, i;
+
+  for (i = 0; i < page_cnt; i++)
+    buf[i * PGSIZE]++;
+
+  start = rdtsc ();
+  for (round = 0; round < SWEEP_ROUNDS; round++)
+    for (i = 0; i < page_cnt; i++)
+      buf[i * PGSIZE + round * 64 % PGSIZE]++;
+  return (rdtsc () - start) / (SWEEP_ROUNDS * page_cnt);
+}
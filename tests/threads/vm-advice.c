@@ -0,0 +1,83 @@
+/* Checks madvise() and MAP_POPULATE from the kernel, on the
+   running thread's own address space, where it can look at the
+   page table and the pages' advice directly.
+
+   Reserves a few anonymous pages and checks that vm_madvise()
+   rejects bad ranges and advice, that vm_populate() brings every
+   page in so that touching them takes no fault, that
+   MADV_DONTNEED drops written pages, which then read back as
+   zeros, and that access pattern advice sticks to the pages.
+
+   Needs a VM kernel, so it runs from vm/build. */
+
+#include <mman.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "tests/threads/vm-space.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/vm.h"
+
+/* Where the pages start, and how many there are. */
+#define BASE ((uint8_t *) 0x10000000)
+#define PAGE_CNT 8
+#define SIZE (PAGE_CNT * PGSIZE)
+
+void
+test_vm_advice (void)
+{
+  struct thread *t = thread_current ();
+  long long before;
+  size_t i;
+
+  space_create ();
+  space_reserve (BASE, PAGE_CNT);
+
+  if (vm_madvise (BASE + 1, PGSIZE, MADV_NORMAL)
+      || vm_madvise (BASE, SIZE + PGSIZE, MADV_NORMAL)
+      || vm_madvise (BASE, SIZE, MADV_DONTNEED + 1)
+      || vm_populate (BASE, SIZE + PGSIZE))
+    fail ("a bad range or bad advice was accepted");
+  msg ("madvise rejected bad ranges and advice");
+
+  if (!vm_populate (BASE, SIZE))
+    fail ("populating failed");
+  before = t->spt.fault_cnt;
+  for (i = 0; i < SIZE; i += PGSIZE)
+    BASE[i] = 0x5a;
+  if (t->spt.fault_cnt != before)
+    fail ("%lld faults on populated pages", t->spt.fault_cnt - before);
+  msg ("populated pages did not fault");
+
+  if (!vm_madvise (BASE, SIZE, MADV_DONTNEED))
+    fail ("MADV_DONTNEED failed");
+  for (i = 0; i < SIZE; i += PGSIZE)
+    if (pml4_get_page (t->pml4, BASE + i) != NULL)
+      fail ("page %zu is still in memory", i / PGSIZE);
+  msg ("pages dropped");
+  for (i = 0; i < SIZE; i++)
+    if (BASE[i] != 0)
+      fail ("byte %zu is %02hhx instead of 0", i, BASE[i]);
+  msg ("pages read back as zeros");
+
+  if (!vm_madvise (BASE, SIZE, MADV_SEQUENTIAL))
+    fail ("MADV_SEQUENTIAL failed");
+  for (i = 0; i < SIZE; i += PGSIZE)
+    if (spt_find_page (&t->spt, BASE + i)->advice != MADV_SEQUENTIAL)
+      fail ("page %zu lost its advice", i / PGSIZE);
+  msg ("advice recorded");
+
+  space_destroy ();
+  pass ();
+}
+#else /* !VM */
+void
+test_vm_advice (void)
+{
+  fail ("madvise() needs a VM kernel; run this test from vm/build.");
+}
+#endif /* VM */
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(vm-advice) begin
+(vm-advice) madvise rejected bad ranges and advice
+(vm-advice) populated pages did not fault
+(vm-advice) pages dropped
+(vm-advice) pages read back as zeros
+(vm-advice) advice recorded
+(vm-advice) PASS
+(vm-advice) end
+EOF
+pass;
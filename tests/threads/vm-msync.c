@@ -0,0 +1,104 @@
+/* Checks the write-back of file mappings from the kernel, on the
+   running thread's own address space, where it can change the file
+   behind a mapping's back, as tests/vm/mmap-msync cannot.
+
+   Maps a two-page file, writes to the first page and only reads
+   the second, then changes the second page in the file behind the
+   mapping's back.  msync() must write the first page to the file
+   and leave the second alone, since it is clean.  Then writes to
+   the second page and checks that munmap() writes it back.
+
+   Needs a VM kernel and a file system, so it runs from vm/build. */
+
+#include <mman.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "tests/threads/vm-space.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "vm/vm.h"
+
+/* Where the mapping starts, and the file it maps. */
+#define BASE ((uint8_t *) 0x10000000)
+#define FILE_NAME "vm-msync"
+
+static void check_file (struct file *, off_t ofs, char first, char rest,
+                        const char *what);
+
+/* A page-sized buffer for reading and writing the file. */
+static uint8_t *buf;
+
+void
+test_vm_msync (void)
+{
+  struct file *file;
+
+  buf = palloc_get_page (PAL_ASSERT);
+  if (!filesys_create (FILE_NAME, 2 * PGSIZE)
+      || (file = filesys_open (FILE_NAME)) == NULL)
+    fail ("couldn't create \"%s\"", FILE_NAME);
+  memset (buf, 'a', PGSIZE);
+  file_write_at (file, buf, PGSIZE, 0);
+  memset (buf, 'b', PGSIZE);
+  file_write_at (file, buf, PGSIZE, PGSIZE);
+
+  space_create ();
+
+  if (do_mmap (BASE, 2 * PGSIZE, true, file, 0) != BASE)
+    fail ("mmap failed");
+  if (BASE[PGSIZE] != 'b')
+    fail ("second page reads %02hhx instead of 'b'", BASE[PGSIZE]);
+  memset (BASE, 'A', PGSIZE);
+  memset (buf, 'C', PGSIZE);
+  file_write_at (file, buf, PGSIZE, PGSIZE);
+
+  if (do_msync (BASE + 1, PGSIZE, MS_SYNC)
+      || do_msync (BASE, 2 * PGSIZE, MS_SYNC | MS_ASYNC))
+    fail ("a bad range or bad flags were accepted");
+  if (!do_msync (BASE, 2 * PGSIZE, MS_SYNC))
+    fail ("msync failed");
+  check_file (file, 0, 'A', 'A', "msync wrote back the written page");
+  check_file (file, PGSIZE, 'C', 'C', "msync left the clean page alone");
+
+  BASE[PGSIZE] = 'D';
+  do_munmap (BASE);
+  check_file (file, PGSIZE, 'D', 'b', "munmap wrote back the written page");
+
+  space_destroy ();
+  file_close (file);
+  filesys_remove (FILE_NAME);
+  palloc_free_page (buf);
+  pass ();
+}
+
+/* Checks that the page at OFS in FILE holds FIRST followed by
+   bytes of REST, and says WHAT if so. */
+static void
+check_file (struct file *file, off_t ofs, char first, char rest,
+            const char *what)
+{
+  size_t i;
+
+  if (file_read_at (file, buf, PGSIZE, ofs) != PGSIZE)
+    fail ("couldn't read \"%s\"", FILE_NAME);
+  for (i = 0; i < PGSIZE; i++)
+    if (buf[i] != (i == 0 ? first : rest))
+      fail ("byte %zu at offset %d is %02hhx instead of '%c'",
+            i, (int) ofs, buf[i], i == 0 ? first : rest);
+  msg ("%s", what);
+}
+#else /* !VM */
+void
+test_vm_msync (void)
+{
+  fail ("msync() needs a VM kernel; run this test from vm/build.");
+}
+#endif /* VM */
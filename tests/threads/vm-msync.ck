@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(vm-msync) begin
+(vm-msync) msync wrote back the written page
+(vm-msync) msync left the clean page alone
+(vm-msync) munmap wrote back the written page
+(vm-msync) PASS
+(vm-msync) end
+EOF
+pass;
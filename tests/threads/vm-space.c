@@ -0,0 +1,60 @@
+/* Address spaces for the kernel tests of virtual memory, which
+   run in kernel threads that have none of their own. */
+
+#include "tests/threads/vm-space.h"
+#include "tests/threads/tests.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/vm.h"
+
+/* Gives the running thread an empty address space and switches
+   to it, so that its accesses to user addresses fault their
+   pages in. */
+void
+space_create (void)
+{
+  struct thread *t = thread_current ();
+  enum intr_level old_level;
+  uint64_t *pml4;
+
+  pml4 = pml4_create ();
+  if (pml4 == NULL)
+    fail ("couldn't allocate a page table");
+  supplemental_page_table_init (&t->spt);
+  old_level = intr_disable ();
+  t->pml4 = pml4;
+  pml4_activate (pml4);
+  intr_set_level (old_level);
+}
+
+/* Reserves PAGE_CNT writable anonymous pages starting at BASE in
+   the running thread's address space. */
+void
+space_reserve (uint8_t *base, size_t page_cnt)
+{
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    if (!vm_alloc_page (VM_ANON, base + i * PGSIZE, true))
+      fail ("%s couldn't reserve page %zu", thread_name (), i);
+}
+
+/* Tears down the running thread's address space. */
+void
+space_destroy (void)
+{
+  struct thread *t = thread_current ();
+  enum intr_level old_level;
+  uint64_t *pml4 = t->pml4;
+
+  supplemental_page_table_kill (&t->spt);
+  old_level = intr_disable ();
+  t->pml4 = NULL;
+  pml4_activate (NULL);
+  intr_set_level (old_level);
+  pml4_destroy (pml4);
+}
+#endif /* VM */
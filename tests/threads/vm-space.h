@@ -0,0 +1,11 @@
+#ifndef TESTS_THREADS_VM_SPACE_H
+#define TESTS_THREADS_VM_SPACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+void space_create (void);
+void space_reserve (uint8_t *base, size_t page_cnt);
+void space_destroy (void);
+
+#endif /* tests/threads/vm-space.h */
@@ -0,0 +1,144 @@
+/* Puts the page replacement policy under twice as much demand
+   for memory as there is.
+
+   Measures the free user memory, then starts WORKER_CNT threads,
+   each in its own address space with half that much anonymous
+   memory, in the manner of page-parallel and page-merge-par.
+   Half of them sweep their memory linearly, the other half touch
+   it in a random order.  Every page is stamped with its owner and
+   number, and checked whenever it is touched again, so a page
+   lost in swap fails the run.  Reports the cycles per touch and
+   the eviction and swap counters, including frames scanned per
+   eviction and swap-in latency, how many pages kswapd evicted
+   ahead of the faults and how many the faulting threads had to,
+   and, with -zswap, how well the compressed pool did.  Run with
+   -nokswapd to compare against eviction on faults alone.
+
+   Needs a swap disk.  This is a benchmark, not a pass/fail
+   test. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "tests/threads/vm-space.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/disk.h"
+#include "intrinsic.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
+#include "vm/vm.h"
+
+/* Number of workers, where their memory starts, and how often
+   each one touches every page of it. */
+#define WORKER_CNT 4
+#define BASE ((uint8_t *) 0x10000000)
+#define PASS_CNT 4
+
+struct worker
+  {
+    int id;                     /* Worker number. */
+    bool random;                /* Touch pages in random order? */
+    size_t page_cnt;            /* Pages of memory. */
+    uint64_t cycles;            /* Time spent touching them. */
+    struct semaphore *done;     /* Upped when finished. */
+  };
+
+static thread_func worker;
+
+void
+test_vm_stress (void)
+{
+  struct worker workers[WORKER_CNT];
+  struct semaphore done;
+  uint64_t cycles = 0;
+  size_t free_cnt;
+  int i;
+
+  if (disk_get (1, 1) == NULL)
+    {
+      msg ("No swap disk; run with one to evict anonymous pages.");
+      return;
+    }
+
+  free_cnt = palloc_free_cnt (PAL_USER);
+  msg ("%zu user pages free; %d workers with %zu pages each.",
+       free_cnt, WORKER_CNT, free_cnt / 2);
+
+  sema_init (&done, 0);
+  for (i = 0; i < WORKER_CNT; i++)
+    {
+      char name[16];
+
+      workers[i] = (struct worker) {
+        .id = i,
+        .random = i % 2,
+        .page_cnt = free_cnt / 2,
+        .done = &done,
+      };
+      snprintf (name, sizeof name, "worker %d", i);
+      thread_create (name, PRI_DEFAULT, worker, &workers[i]);
+    }
+  for (i = 0; i < WORKER_CNT; i++)
+    sema_down (&done);
+
+  for (i = 0; i < WORKER_CNT; i++)
+    cycles += workers[i].cycles;
+  msg ("%llu cycles per touch",
+       cycles / (WORKER_CNT * PASS_CNT * (free_cnt / 2)));
+  frame_print_stats ();
+  vm_print_pageout_stats ();
+  swap_print_stats ();
+  zswap_print_stats ();
+}
+
+/* A worker: sets up an address space with its memory, touches
+   each page of it PASS_CNT times, and tears it down. */
+static void
+worker (void *w_)
+{
+  struct worker *w = w_;
+  uint64_t start;
+  unsigned seed = w->id + 1;
+  size_t pass, i;
+
+  space_create ();
+  space_reserve (BASE, w->page_cnt);
+
+  start = rdtsc ();
+  for (pass = 0; pass < PASS_CNT; pass++)
+    for (i = 0; i < w->page_cnt; i++)
+      {
+        size_t n = i;
+        size_t *stamp;
+
+        if (w->random)
+          {
+            seed = seed * 1103515245 + 12345;
+            n = seed % w->page_cnt;
+          }
+        stamp = (size_t *) (BASE + n * PGSIZE);
+        if (stamp[0] != 0 && (stamp[0] != (size_t) w->id + 1 || stamp[1] != n))
+          fail ("worker %d found page %zu corrupted", w->id, n);
+        stamp[0] = w->id + 1;
+        stamp[1] = n;
+      }
+  w->cycles = rdtsc () - start;
+
+  space_destroy ();
+  sema_up (w->done);
+}
+#else /* !VM */
+void
+test_vm_stress (void)
+{
+  msg ("There is no page replacement in this kernel; "
+       "build with VM to exercise it.");
+}
+#endif /* VM */
@@ -0,0 +1,41 @@
+/* Child process of text-share.
+   Run as "child-text outer", forks and execs "child-text inner",
+   which exits with the number of the frame that holds its code,
+   and returns 0x42 if that is the frame that holds its own code.
+   Two processes running the same executable should share it. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+/* Returns the number of the frame that holds this function, which
+   is in memory since it is running. */
+static int
+code_frame (void)
+{
+  return (uintptr_t) get_phys_addr ((void *) code_frame) >> 12;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int frame = code_frame ();
+  pid_t pid;
+
+  test_name = "child-text";
+  if (frame == 0)
+    fail ("code is not in memory");
+  if (argc < 2 || strcmp (argv[1], "outer"))
+    return frame;
+
+  pid = fork ("child-text");
+  if (pid == 0)
+    {
+      exec ("child-text inner");
+      fail ("failed to exec child-text inner");
+    }
+  if (wait (pid) != frame)
+    fail ("second process got its own copy of the code");
+  return 0x42;
+}
@@ -0,0 +1,80 @@
+/* Maps part of a file, reads one byte of its first page, and checks
+   that fault-around mapped the pages after it too, with the file's
+   data, so that reading them all took fewer faults than there are
+   pages.  Then maps the file again with MADV_RANDOM advice and
+   checks that a read there brings in only the page it touches. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 16
+#define SIZE (PAGE_CNT * PAGE_SIZE)
+
+/* Where the mappings go.  Both are aligned to any fault-around
+   window, so that a fault on the first page maps those after it. */
+#define BASE ((char *) 0x10000000)
+#define RANDOM_BASE ((char *) 0x20000000)
+
+static char buf[PAGE_SIZE];
+
+/* Returns the faults on pages of file mappings that the process has
+   taken. */
+static long long
+file_fault_cnt (void)
+{
+  struct faultstat st;
+
+  if (!faultstat (MEMSTAT_SELF, &st))
+    fail ("faultstat failed");
+  return st.proc_cnt[FAULT_FILE];
+}
+
+void
+test_main (void)
+{
+  long long before, faults;
+  int handle;
+  size_t i;
+
+  CHECK ((handle = open ("large.txt")) > 1, "open \"large.txt\"");
+  CHECK (mmap (BASE, SIZE, 0, handle, 0) != MAP_FAILED,
+         "mmap \"large.txt\"");
+
+  before = file_fault_cnt ();
+  (void) *(volatile char *) BASE;
+  if (get_phys_addr (BASE + PAGE_SIZE) == 0)
+    fail ("page 1 was not mapped around page 0");
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    (void) *(volatile char *) (BASE + i);
+  faults = file_fault_cnt () - before;
+  if (faults > PAGE_CNT / 2)
+    fail ("%lld faults to read %d pages", faults, PAGE_CNT);
+  msg ("pages mapped around the fault");
+
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      seek (handle, i * PAGE_SIZE);
+      if (read (handle, buf, PAGE_SIZE) != PAGE_SIZE)
+        fail ("read of page %zu failed", i);
+      if (memcmp (BASE + i * PAGE_SIZE, buf, PAGE_SIZE))
+        fail ("page %zu does not hold the file's data", i);
+    }
+  msg ("mapped pages hold the file's data");
+
+  CHECK (mmap (RANDOM_BASE, SIZE, 0, handle, 0) != MAP_FAILED,
+         "mmap \"large.txt\" again");
+  CHECK (madvise (RANDOM_BASE, SIZE, MADV_RANDOM) == 0,
+         "madvise MADV_RANDOM");
+  (void) *(volatile char *) RANDOM_BASE;
+  for (i = PAGE_SIZE; i < SIZE; i += PAGE_SIZE)
+    if (get_phys_addr (RANDOM_BASE + i) != 0)
+      fail ("page %zu was mapped around a random access", i / PAGE_SIZE);
+  msg ("random access mapped one page");
+
+  munmap (RANDOM_BASE);
+  munmap (BASE);
+  close (handle);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fault-around) begin
+(fault-around) open "large.txt"
+(fault-around) mmap "large.txt"
+(fault-around) pages mapped around the fault
+(fault-around) mapped pages hold the file's data
+(fault-around) mmap "large.txt" again
+(fault-around) madvise MADV_RANDOM
+(fault-around) random access mapped one page
+(fault-around) end
+EOF
+pass;
@@ -0,0 +1,85 @@
+/* Takes a known sequence of page faults and checks that faultstat()
+   counts each of them, under the right cause, both for the process
+   and for everyone, and in the latency histograms: a read and then
+   a write of each of some fresh BSS pages, which are zero-fill
+   faults, and a read of each page of a file mapping advised as
+   MADV_RANDOM, which are file faults. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 8
+#define SIZE (PAGE_CNT * PAGE_SIZE)
+#define FILE_PAGE_CNT 4
+
+/* Where the file mapping goes. */
+#define MAP ((char *) 0x10000000)
+
+static char buf[SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+/* In memory before the faults counted, so that filling them in
+   faults on nothing. */
+static struct faultstat before, after;
+
+/* Fails unless AFTER counts CNT more faults of CAUSE than BEFORE,
+   for the process, for everyone, and in CAUSE's histogram. */
+static void
+check_cause (int cause, const char *name, long long cnt)
+{
+  long long hist_cnt = 0;
+  int i;
+
+  if (after.proc_cnt[cause] - before.proc_cnt[cause] != cnt)
+    fail ("process took %lld %s faults instead of %lld",
+          after.proc_cnt[cause] - before.proc_cnt[cause], name, cnt);
+  if (after.cnt[cause] - before.cnt[cause] != cnt)
+    fail ("everyone took %lld %s faults instead of %lld",
+          after.cnt[cause] - before.cnt[cause], name, cnt);
+  for (i = 0; i < FAULT_HIST_BUCKETS; i++)
+    hist_cnt += after.hist[cause][i] - before.hist[cause][i];
+  if (hist_cnt != cnt)
+    fail ("histogram has %lld %s faults instead of %lld",
+          hist_cnt, name, cnt);
+  if (cnt > 0 && after.cycles[cause] == before.cycles[cause])
+    fail ("%s faults took no time", name);
+}
+
+void
+test_main (void)
+{
+  int handle;
+  size_t i;
+
+  memset (&before, 0, sizeof before);
+  memset (&after, 0, sizeof after);
+  CHECK ((handle = open ("large.txt")) > 1, "open \"large.txt\"");
+  CHECK (mmap (MAP, FILE_PAGE_CNT * PAGE_SIZE, 0, handle, 0) != MAP_FAILED,
+         "mmap \"large.txt\"");
+  CHECK (madvise (MAP, FILE_PAGE_CNT * PAGE_SIZE, MADV_RANDOM) == 0,
+         "madvise MADV_RANDOM");
+
+  /* Nothing but the faults counted from here on. */
+  if (!faultstat (MEMSTAT_SELF, &before))
+    fail ("faultstat failed");
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    (void) *(volatile char *) (buf + i);
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    buf[i] = 1;
+  for (i = 0; i < FILE_PAGE_CNT * PAGE_SIZE; i += PAGE_SIZE)
+    (void) *(volatile char *) (MAP + i);
+  if (!faultstat (MEMSTAT_SELF, &after))
+    fail ("faultstat failed");
+
+  check_cause (FAULT_ZERO, "zero-fill", 2 * PAGE_CNT);
+  check_cause (FAULT_FILE, "file", FILE_PAGE_CNT);
+  check_cause (FAULT_SWAP, "swap-in", 0);
+  check_cause (FAULT_COW, "copy-on-write", 0);
+  check_cause (FAULT_BAD, "bad", 0);
+  msg ("faults counted by cause");
+
+  munmap (MAP);
+  close (handle);
+}
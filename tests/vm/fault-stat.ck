@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fault-stat) begin
+(fault-stat) open "large.txt"
+(fault-stat) mmap "large.txt"
+(fault-stat) madvise MADV_RANDOM
+(fault-stat) faults counted by cause
+(fault-stat) end
+EOF
+pass;
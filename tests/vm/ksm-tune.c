@@ -0,0 +1,74 @@
+/* Turns same-page merging on with ksmctl(), fills some pages with
+   the same contents, and checks that ksmd merges them into one
+   frame, that a write to one of them gives it a frame of its own
+   again, and that ksmctl() turns merging back off. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 8
+#define SIZE (PAGE_CNT * PAGE_SIZE)
+
+/* Times to ask ksmctl() whether ksmd is done before giving up. */
+#define POLL_MAX 4000000
+
+static char buf[SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+/* Returns true if all of BUF's pages are in the same frame. */
+static bool
+all_merged (void)
+{
+  size_t i;
+
+  for (i = PAGE_SIZE; i < SIZE; i += PAGE_SIZE)
+    if (get_phys_addr (&buf[i]) != get_phys_addr (buf))
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  struct ksm_info old, on, info;
+  long poll;
+  size_t i;
+
+  ksmctl (NULL, &old);
+  on = old;
+  on.pages_to_scan = 64;
+  on.sleep_ms = 1;
+  ksmctl (&on, NULL);
+  ksmctl (NULL, &info);
+  CHECK (info.pages_to_scan == 64 && info.sleep_ms == 1,
+         "turn merging on");
+
+  msg ("fill pages");
+  memset (buf, 0x5a, SIZE);
+
+  for (poll = 0; !all_merged (); poll++)
+    {
+      if (poll == POLL_MAX)
+        fail ("pages not merged after %ld polls", poll);
+      ksmctl (NULL, &info);
+    }
+  ksmctl (NULL, &info);
+  CHECK (info.merge_cnt >= PAGE_CNT - 1 && info.pages_shared >= PAGE_CNT - 1,
+         "pages merged");
+
+  buf[0] = 1;
+  CHECK (get_phys_addr (buf) != get_phys_addr (&buf[PAGE_SIZE]),
+         "write breaks sharing");
+  for (i = 1; i < SIZE; i++)
+    if (buf[i] != 0x5a)
+      fail ("byte %zu is %02hhx instead of 5a", i, buf[i]);
+  msg ("other pages intact");
+
+  on.pages_to_scan = 0;
+  ksmctl (&on, NULL);
+  ksmctl (NULL, &info);
+  CHECK (info.pages_to_scan == 0, "turn merging off");
+  ksmctl (&old, NULL);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(ksm-tune) begin
+(ksm-tune) turn merging on
+(ksm-tune) fill pages
+(ksm-tune) pages merged
+(ksm-tune) write breaks sharing
+(ksm-tune) other pages intact
+(ksm-tune) turn merging off
+(ksm-tune) end
+EOF
+pass;
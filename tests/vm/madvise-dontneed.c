@@ -0,0 +1,41 @@
+/* Writes to some anonymous pages, advises them as MADV_DONTNEED,
+   and checks that they are dropped at once, read back as zeros,
+   and keep what is written to them afterward. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 8
+#define SIZE (PAGE_CNT * PAGE_SIZE)
+
+static char buf[SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+  size_t i;
+
+  msg ("write pages");
+  memset (buf, 0x5a, SIZE);
+
+  CHECK (madvise (buf, SIZE, MADV_DONTNEED) == 0, "madvise MADV_DONTNEED");
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    if (get_phys_addr (&buf[i]) != 0)
+      fail ("page %zu is still in memory", i / PAGE_SIZE);
+  msg ("pages dropped");
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu is %02hhx instead of 0", i, buf[i]);
+  msg ("pages read back as zeros");
+
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    buf[i] = (char) (i / PAGE_SIZE + 1);
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    if (buf[i] != (char) (i / PAGE_SIZE + 1))
+      fail ("page %zu lost its contents", i / PAGE_SIZE);
+  msg ("pages kept new writes");
+}
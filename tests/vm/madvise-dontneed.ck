@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madvise-dontneed) begin
+(madvise-dontneed) write pages
+(madvise-dontneed) madvise MADV_DONTNEED
+(madvise-dontneed) pages dropped
+(madvise-dontneed) pages read back as zeros
+(madvise-dontneed) pages kept new writes
+(madvise-dontneed) end
+EOF
+pass;
@@ -0,0 +1,55 @@
+/* Reads two read-only arrays of the executable page by page, one
+   advised as MADV_RANDOM and one as MADV_SEQUENTIAL, and checks
+   that the first faults once per page while the second, which the
+   kernel reads ahead of the faults, faults much less often. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 32
+#define SIZE (PAGE_CNT * PAGE_SIZE)
+
+/* Initialized, so that they are read in from the executable. */
+static const char random_buf[SIZE] __attribute__ ((aligned (PAGE_SIZE)))
+  = { 1 };
+static const char seq_buf[SIZE] __attribute__ ((aligned (PAGE_SIZE)))
+  = { 1 };
+
+/* Reads a byte from each page of BUF and returns the number of
+   page faults that took. */
+static long long
+read_pages (const char *buf)
+{
+  long long before = get_page_fault_cnt ();
+  int sum = 0;
+  size_t i;
+
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    sum += *(volatile const char *) &buf[i];
+  if (sum != 1)
+    fail ("read back %d instead of 1", sum);
+  return get_page_fault_cnt () - before;
+}
+
+void
+test_main (void)
+{
+  long long random_faults, seq_faults;
+
+  CHECK (madvise ((void *) random_buf, SIZE, MADV_RANDOM) == 0,
+         "madvise MADV_RANDOM");
+  CHECK (madvise ((void *) seq_buf, SIZE, MADV_SEQUENTIAL) == 0,
+         "madvise MADV_SEQUENTIAL");
+
+  random_faults = read_pages (random_buf);
+  seq_faults = read_pages (seq_buf);
+  if (random_faults < PAGE_CNT)
+    fail ("%lld faults for %d random pages", random_faults, PAGE_CNT);
+  if (seq_faults * 4 > random_faults)
+    fail ("%lld faults for %d sequential pages, %lld for random ones",
+          seq_faults, PAGE_CNT, random_faults);
+  msg ("sequential pages faulted less");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madvise-seq) begin
+(madvise-seq) madvise MADV_RANDOM
+(madvise-seq) madvise MADV_SEQUENTIAL
+(madvise-seq) sequential pages faulted less
+(madvise-seq) end
+EOF
+pass;
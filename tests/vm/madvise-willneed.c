@@ -0,0 +1,43 @@
+/* Advises a read-only array of the executable as MADV_WILLNEED,
+   waits for the kernel to read it in behind our back, and checks
+   that reading it then takes no page faults. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 16
+#define SIZE (PAGE_CNT * PAGE_SIZE)
+
+/* Initialized, so that it is read in from the executable. */
+static const char buf[SIZE] __attribute__ ((aligned (PAGE_SIZE))) = { 1 };
+
+void
+test_main (void)
+{
+  long long before;
+  int sum = 0;
+  size_t i;
+
+  CHECK (madvise ((void *) buf, SIZE, MADV_WILLNEED) == 0,
+         "madvise MADV_WILLNEED");
+
+  /* The prefetch is asynchronous, and goes in order of address. */
+  for (i = 0; i < 100000000; i++)
+    if (get_phys_addr ((void *) &buf[SIZE - PAGE_SIZE]) != 0)
+      break;
+  if (get_phys_addr ((void *) &buf[SIZE - PAGE_SIZE]) == 0)
+    fail ("last page was never prefetched");
+
+  before = get_page_fault_cnt ();
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    sum += *(volatile const char *) &buf[i];
+  if (sum != 1)
+    fail ("read back %d instead of 1", sum);
+  if (get_page_fault_cnt () != before)
+    fail ("%lld faults reading prefetched pages",
+          get_page_fault_cnt () - before);
+  msg ("prefetched pages did not fault");
+}
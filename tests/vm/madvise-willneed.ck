@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madvise-willneed) begin
+(madvise-willneed) madvise MADV_WILLNEED
+(madvise-willneed) prefetched pages did not fault
+(madvise-willneed) end
+EOF
+pass;
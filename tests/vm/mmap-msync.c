@@ -0,0 +1,42 @@
+/* Writes to two pages of a mapped file, syncs them with msync(),
+   and checks with read() that the file has the data before the
+   file is unmapped. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+#define PAGE_SIZE 4096
+#define SIZE (3 * PAGE_SIZE)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  int handle;
+  void *map;
+  size_t i;
+
+  CHECK (create ("data", SIZE), "create \"data\"");
+  CHECK ((handle = open ("data")) > 1, "open \"data\"");
+  CHECK ((map = mmap (ACTUAL, SIZE, 1, handle, 0)) != MAP_FAILED,
+         "mmap \"data\"");
+
+  /* Dirty the first two pages only. */
+  for (i = 0; i < 2 * PAGE_SIZE; i++)
+    ACTUAL[i] = i % 251 + 1;
+  CHECK (msync (ACTUAL, SIZE, MS_SYNC) == 0, "msync MS_SYNC");
+
+  CHECK (read (handle, buf, SIZE) == SIZE, "read \"data\"");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (i < 2 * PAGE_SIZE ? (char) (i % 251 + 1) : 0))
+      fail ("byte %zu of file is %02hhx after msync", i, buf[i]);
+  msg ("file has the written data");
+
+  CHECK (msync (ACTUAL, SIZE, MS_ASYNC) == 0, "msync MS_ASYNC");
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-msync) begin
+(mmap-msync) create "data"
+(mmap-msync) open "data"
+(mmap-msync) mmap "data"
+(mmap-msync) msync MS_SYNC
+(mmap-msync) read "data"
+(mmap-msync) file has the written data
+(mmap-msync) msync MS_ASYNC
+(mmap-msync) end
+EOF
+pass;
@@ -0,0 +1,37 @@
+/* Maps a file with MAP_POPULATE and checks that reading the
+   mapping takes no page faults. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char *actual = (char *) 0x10000000;
+  size_t len = strlen (sample);
+  long long before;
+  int handle;
+  void *map;
+
+  /* Fault in SAMPLE and memcmp()'s code before counting. */
+  if (memcmp (sample, sample, len))
+    fail ("sample differs from itself");
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (actual, 4096, MAP_POPULATE, handle, 0))
+         != MAP_FAILED, "mmap \"sample.txt\" with MAP_POPULATE");
+
+  before = get_page_fault_cnt ();
+  if (memcmp (actual, sample, len))
+    fail ("read of mmap'd file reported bad data");
+  if (get_page_fault_cnt () != before)
+    fail ("%lld faults reading a populated mapping",
+          get_page_fault_cnt () - before);
+  msg ("mapping did not fault");
+
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,35 @@
+/* Checks that a large zero-filled array, which the kernel may back
+   with 2 MB huge pages, reads as zeros and keeps what is written
+   to each of its pages. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define SIZE (6 * 1024 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+
+  msg ("touch one page");
+  buf[SIZE / 2] = 1;
+
+  msg ("zero pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (i == SIZE / 2))
+      fail ("byte %zu is %d", i, buf[i]);
+
+  msg ("write pass");
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    buf[i] = (char) (i / PAGE_SIZE);
+
+  msg ("read pass");
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    if (buf[i] != (char) (i / PAGE_SIZE))
+      fail ("page %zu lost its contents", i / PAGE_SIZE);
+}
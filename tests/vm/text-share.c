@@ -0,0 +1,20 @@
+/* Runs child-text, which runs a second copy of itself and checks
+   that the code of both is in the same frame. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  pid_t pid;
+
+  pid = fork ("child-text");
+  if (pid == 0)
+    {
+      exec ("child-text outer");
+      fail ("failed to exec child-text");
+    }
+  CHECK (wait (pid) == 0x42, "wait for child-text");
+}
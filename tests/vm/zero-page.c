@@ -0,0 +1,49 @@
+/* Reads some fresh pages of BSS and checks that they read as zeros
+   and are all mapped to one frame, the shared zero page.  Then
+   writes to one of them and checks that only that page gets a frame
+   of its own, which holds the write. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 8
+#define SIZE (PAGE_CNT * PAGE_SIZE)
+
+/* The page written to. */
+#define WRITTEN 3
+
+static char buf[SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+  void *zero;
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu is %02hhx instead of 0", i, buf[i]);
+  msg ("pages read as zeros");
+
+  zero = get_phys_addr (buf);
+  if (zero == 0)
+    fail ("page 0 is not in memory");
+  for (i = PAGE_SIZE; i < SIZE; i += PAGE_SIZE)
+    if (get_phys_addr (&buf[i]) != zero)
+      fail ("page %zu is not in page 0's frame", i / PAGE_SIZE);
+  msg ("pages share one frame");
+
+  buf[WRITTEN * PAGE_SIZE] = 'x';
+  if (get_phys_addr (&buf[WRITTEN * PAGE_SIZE]) == zero)
+    fail ("written page is still in the zero page");
+  if (buf[WRITTEN * PAGE_SIZE] != 'x')
+    fail ("write was lost");
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    if (i != WRITTEN * PAGE_SIZE
+        && (get_phys_addr (&buf[i]) != zero || buf[i] != 0))
+      fail ("write reached page %zu", i / PAGE_SIZE);
+  msg ("write gave one page a frame of its own");
+}
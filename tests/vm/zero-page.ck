@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(zero-page) begin
+(zero-page) pages read as zeros
+(zero-page) pages share one frame
+(zero-page) write gave one page a frame of its own
+(zero-page) end
+EOF
+pass;
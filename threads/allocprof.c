@@ -0,0 +1,145 @@
+#include "threads/allocprof.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "threads/interrupt.h"
+
+/* Allocation profiler.
+
+   With -allocprof, malloc() and palloc record each allocation
+   against its call site, the return address of the call into the
+   allocator, and its size class: the block size malloc() rounds
+   the request up to, or the bytes in a run of pages.  Each
+   allocation remembers the number of its site, so that freeing it
+   takes its bytes off the same site.  Sites live in a fixed-size
+   open-addressing hash table, so profiling never allocates; once
+   the table is full, allocations from new sites go unrecorded.
+   The pages that malloc() itself takes for arenas and big blocks
+   show up as "kpage" sites in malloc.c.
+
+   At shutdown, allocprof_print_stats() prints the sites with the
+   most bytes at their peak, followed by a line of addresses for
+   the `backtrace' program to symbolize. */
+
+/* Number of slots in the site table, a power of 2, and number of
+   sites printed. */
+#define SITE_CNT 1024
+#define PRINT_CNT 40
+
+/* A call site and size class, with its statistics. */
+struct site {
+	void *caller;               /* Return address; null if unused. */
+	enum allocprof_kind kind;   /* What it allocates. */
+	size_t size_class;          /* Bytes per allocation. */
+	long long alloc_cnt;        /* Allocations made. */
+	size_t live_bytes;          /* Bytes allocated and not freed. */
+	size_t peak_bytes;          /* Most live bytes at once. */
+};
+
+bool allocprof_enabled;
+
+/* Site table.  Slot I has site number I + 1; site number 0 means
+   "not recorded". */
+static struct site sites[SITE_CNT];
+static size_t site_cnt;             /* Slots in use. */
+static long long dropped_cnt;       /* Allocations not recorded. */
+
+/* Records an allocation of SIZE_CLASS bytes of KIND made by the
+   call that returns to CALLER, and returns the number of its
+   site, or 0 if the table is full. */
+unsigned
+allocprof_alloc (void *caller, enum allocprof_kind kind, size_t size_class) {
+	uint64_t hash = ((uint64_t) caller ^ size_class * 0x9e3779b97f4a7c15ULL
+			^ kind) * 0xff51afd7ed558ccdULL;
+	enum intr_level old_level;
+	unsigned site = 0;
+	size_t i;
+
+	ASSERT (caller != NULL);
+
+	old_level = intr_disable ();
+	for (i = 0; i < SITE_CNT; i++) {
+		struct site *s = &sites[((hash >> 32) + i) & (SITE_CNT - 1)];
+
+		if (s->caller == NULL) {
+			if (site_cnt >= SITE_CNT * 3 / 4)
+				break;
+			site_cnt++;
+			*s = (struct site) {
+				.caller = caller,
+				.kind = kind,
+				.size_class = size_class,
+			};
+		} else if (s->caller != caller || s->kind != kind
+				|| s->size_class != size_class)
+			continue;
+
+		s->alloc_cnt++;
+		s->live_bytes += size_class;
+		if (s->live_bytes > s->peak_bytes)
+			s->peak_bytes = s->live_bytes;
+		site = s - sites + 1;
+		break;
+	}
+	if (site == 0)
+		dropped_cnt++;
+	intr_set_level (old_level);
+
+	return site;
+}
+
+/* Takes BYTES that were allocated at SITE off its live bytes. */
+void
+allocprof_free (unsigned site, size_t bytes) {
+	enum intr_level old_level;
+
+	if (site == 0)
+		return;
+	ASSERT (site <= SITE_CNT);
+
+	old_level = intr_disable ();
+	sites[site - 1].live_bytes -= bytes;
+	intr_set_level (old_level);
+}
+
+/* Orders sites by descending peak bytes. */
+static int
+compare_peak (const void *a_, const void *b_) {
+	const struct site *a = *(const struct site **) a_;
+	const struct site *b = *(const struct site **) b_;
+
+	return a->peak_bytes < b->peak_bytes ? 1 : a->peak_bytes > b->peak_bytes ? -1 : 0;
+}
+
+/* Prints the sites with the highest peaks, if profiling. */
+void
+allocprof_print_stats (void) {
+	static const char *kind_names[] = { "malloc", "kpage", "upage" };
+	static struct site *order[SITE_CNT];
+	size_t cnt = 0, i;
+
+	if (!allocprof_enabled)
+		return;
+
+	for (i = 0; i < SITE_CNT; i++)
+		if (sites[i].caller != NULL)
+			order[cnt++] = &sites[i];
+	qsort (order, cnt, sizeof *order, compare_peak);
+	if (cnt > PRINT_CNT)
+		cnt = PRINT_CNT;
+
+	printf ("Allocation profile: %zu call sites, %lld allocations "
+			"not recorded\n", site_cnt, dropped_cnt);
+	printf ("  %-18s %-6s %8s %10s %10s %10s\n",
+			"call site", "kind", "class", "allocs", "live", "peak");
+	for (i = 0; i < cnt; i++)
+		printf ("  %-18p %-6s %8zu %10lld %10zu %10zu\n",
+				order[i]->caller, kind_names[order[i]->kind],
+				order[i]->size_class, order[i]->alloc_cnt,
+				order[i]->live_bytes, order[i]->peak_bytes);
+	printf ("Symbolize the call sites with:\nbacktrace");
+	for (i = 0; i < cnt; i++)
+		printf (" %p", order[i]->caller);
+	printf ("\n");
+}
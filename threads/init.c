@@ -13,6 +13,7 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "devices/vga.h"
+#include "threads/allocprof.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -21,6 +22,7 @@
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -31,6 +33,9 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/frame.h"
+#include "vm/hugepage.h"
+#include "vm/zswap.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -105,6 +110,7 @@ main (void) {
 	thread_start ();
 	serial_init_queue ();
 	timer_calibrate ();
+	palloc_start_reclaim ();
 
 #ifdef FILESYS
 	/* Initialize file system. */
@@ -140,31 +146,82 @@ bss_init (void) {
 	memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Returns true if the CPU can map 1 GB pages.
+ * See [IA32-v3a] 4.1.4 "Enumeration of Paging Features by CPUID". */
+static bool
+cpu_has_1gb_pages (void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid (0x80000000, 0, &eax, &ebx, &ecx, &edx);
+	if (eax < 0x80000001)
+		return false;
+	cpuid (0x80000001, 0, &eax, &ebx, &ecx, &edx);
+	return (edx & (1 << 26)) != 0;
+}
+
+/* Returns the size of the largest page that can map physical
+ * address PA at kernel virtual address VA in the direct map of
+ * [0, MEM_END).  Both addresses must be aligned to the page, the
+ * page must not run past MEM_END, and it must lie entirely inside
+ * or entirely outside of the read-only kernel text
+ * [TEXT_START, TEXT_END), which keeps its own permissions. */
+static size_t
+direct_map_page_size (uint64_t pa, uint64_t va, uint64_t mem_end,
+		uint64_t text_start, uint64_t text_end, bool gbpages) {
+	static const size_t sizes[] = { PDPE_PGSIZE, PDE_PGSIZE };
+
+	for (size_t i = gbpages ? 0 : 1; i < sizeof sizes / sizeof *sizes; i++) {
+		size_t size = sizes[i];
+		if (pa % size != 0 || va % size != 0 || pa + size > mem_end)
+			continue;
+		if ((va < text_start && va + size > text_start)
+				|| (va < text_end && va + size > text_end))
+			continue;
+		return size;
+	}
+	return PGSIZE;
+}
+
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
- * Points base_pml4 to the pml4 it creates. */
+ * Points base_pml4 to the pml4 it creates.
+ * The mapping is made of the largest pages the CPU supports, so
+ * that the kernel's accesses to physical memory take as few TLB
+ * entries, and the page tables as few pages, as possible. */
 static void
 paging_init (uint64_t mem_end) {
 	uint64_t *pml4, *pte;
+	size_t size;
+	bool gbpages = cpu_has_1gb_pages ();
 	int perm;
 	pml4 = base_pml4 = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 
 	extern char start, _end_kernel_text;
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
+	for (uint64_t pa = 0; pa < mem_end; pa += size) {
 		uint64_t va = (uint64_t) ptov(pa);
 
-		perm = PTE_P | PTE_W;
+		size = direct_map_page_size (pa, va, mem_end, (uint64_t) &start,
+				(uint64_t) &_end_kernel_text, gbpages);
+
+		perm = PTE_P | PTE_W | PTE_G;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
 
-		if ((pte = pml4e_walk (pml4, va, 1)) != NULL)
+		if (size == PGSIZE)
+			pte = pml4e_walk (pml4, va, 1);
+		else {
+			pte = pml4e_walk_large (pml4, va, size);
+			perm |= PTE_PS;
+		}
+		if (pte != NULL)
 			*pte = pa | perm;
 	}
 
 	// reload cr3
 	pml4_activate(0);
+	pml4_init_pcid ();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -221,6 +278,32 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-nopcid"))
+			pml4_use_pcid = false;
+		else if (!strcmp (name, "-loan"))
+			pool_loan_pct = atoi (value);
+		else if (!strcmp (name, "-allocprof"))
+			allocprof_enabled = true;
+#ifdef VM
+		else if (!strcmp (name, "-nothp"))
+			thp_enabled = false;
+		else if (!strcmp (name, "-zswap"))
+			zswap_pct = atoi (value);
+		else if (!strcmp (name, "-faultaround"))
+			fault_around_pages = atoi (value);
+		else if (!strcmp (name, "-ksm"))
+			ksm_pages_to_scan = atoi (value);
+		else if (!strcmp (name, "-ksm-sleep"))
+			ksm_sleep_ms = atoi (value);
+		else if (!strcmp (name, "-nokswapd"))
+			kswapd_enabled = false;
+		else if (!strcmp (name, "-noreap"))
+			reaper_enabled = false;
+		else if (!strcmp (name, "-rsslimit"))
+			rss_limit_pages = atoi (value);
+		else if (!strcmp (name, "-flush"))
+			flush_interval_ms = atoi (value);
+#endif
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
@@ -326,6 +409,20 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -nopcid            Flush the TLB on every address space switch.\n"
+			"  -loan=PCT          Let a page pool lend up to PCT%% of itself.\n"
+			"  -allocprof         Profile allocations by call site.\n"
+#ifdef VM
+			"  -nothp             Back user memory with 4 kB pages only.\n"
+			"  -zswap=PCT         Compress swapped pages into up to PCT%% of RAM.\n"
+			"  -faultaround=N     Read up to N pages around a file page fault.\n"
+			"  -ksm=PAGES         Merge identical pages, scanning PAGES per pass.\n"
+			"  -ksm-sleep=MS      Sleep MS milliseconds between merging passes.\n"
+			"  -nokswapd          Evict pages only when a fault finds none free.\n"
+			"  -noreap            Free an exiting process's memory before it exits.\n"
+			"  -rsslimit=PAGES    Keep at most PAGES pages of a process in memory.\n"
+			"  -flush=MS          Write file mappings back every MS ms, 0 never.\n"
+#endif
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -362,4 +459,9 @@ print_stats (void) {
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+	palloc_print_stats ();
+#ifdef VM
+	vm_print_stats ();
+#endif
+	allocprof_print_stats ();
 }
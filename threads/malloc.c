@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/allocprof.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -26,7 +27,11 @@
    When we free a block, we add it to its descriptor's free list.
    But if the arena that the block was in now has no in-use
    blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
+   and give the arena back to the page allocator.  Up to
+   EMPTY_ARENA_MAX empty arenas per descriptor are kept instead,
+   so that a workload hovering around an arena boundary does not
+   go to the page allocator on every other call; a shrinker gives
+   them back when the kernel pool runs low.
 
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
@@ -40,8 +45,12 @@ struct desc {
 	size_t blocks_per_arena;    /* Number of blocks in an arena. */
 	struct list free_list;      /* List of free blocks. */
 	struct lock lock;           /* Lock. */
+	size_t empty_cnt;           /* Arenas with no block in use. */
 };
 
+/* Number of empty arenas each descriptor keeps. */
+#define EMPTY_ARENA_MAX 2
+
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
@@ -57,12 +66,35 @@ struct block {
 	struct list_elem free_elem; /* Free list element. */
 };
 
+/* With -allocprof, each allocation is preceded by this header,
+   for free() to take it off its call site.  Its size keeps blocks
+   16-byte aligned. */
+struct prof_header {
+	size_t bytes;               /* Bytes recorded against SITE. */
+	unsigned site;              /* Call site number. */
+};
+
 /* Our set of descriptors. */
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static void release_arena (struct arena *);
+static void *malloc_for (size_t, void *caller);
+static void *allocate (size_t);
+static void deallocate (void *);
+
+static size_t empty_arena_count (struct shrinker *);
+static size_t empty_arena_scan (struct shrinker *, size_t page_cnt);
+
+/* Gives empty arenas back under memory pressure. */
+static struct shrinker empty_arena_shrinker = {
+	.name = "malloc",
+	.pool = 0,
+	.count = empty_arena_count,
+	.scan = empty_arena_scan,
+};
 
 /* Initializes the malloc() descriptors. */
 void
@@ -77,12 +109,51 @@ malloc_init (void) {
 		list_init (&d->free_list);
 		lock_init (&d->lock);
 	}
+	palloc_register_shrinker (&empty_arena_shrinker);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) {
+	return malloc_for (size, __builtin_return_address (0));
+}
+
+/* Returns the bytes that a block of SIZE bytes takes up: the
+   block size of its descriptor, or whole pages for a big block. */
+static size_t
+size_class (size_t size) {
+	struct desc *d;
+
+	for (d = descs; d < descs + desc_cnt; d++)
+		if (d->block_size >= size)
+			return d->block_size;
+	return ROUND_UP (size + sizeof (struct arena), PGSIZE);
+}
+
+/* Does the work of malloc() for the call that returns to
+   CALLER. */
+static void *
+malloc_for (size_t size, void *caller) {
+	struct prof_header *h;
+
+	if (!allocprof_enabled)
+		return allocate (size);
+	if (size == 0 || size + sizeof *h < size)
+		return NULL;
+
+	h = allocate (size + sizeof *h);
+	if (h == NULL)
+		return NULL;
+	h->bytes = size_class (size);
+	h->site = allocprof_alloc (caller, ALLOCPROF_MALLOC, h->bytes);
+	return h + 1;
+}
+
+/* Obtains and returns a new block of at least SIZE bytes,
+   without profiling it. */
+static void *
+allocate (size_t size) {
 	struct desc *d;
 	struct block *b;
 	struct arena *a;
@@ -138,7 +209,8 @@ malloc (size_t size) {
 	/* Get a block from free list and return it. */
 	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
 	a = block_to_arena (b);
-	a->free_cnt--;
+	if (a->free_cnt-- == d->blocks_per_arena)
+		d->empty_cnt--;
 	lock_release (&d->lock);
 	return b;
 }
@@ -156,7 +228,7 @@ calloc (size_t a, size_t b) {
 		return NULL;
 
 	/* Allocate and zero memory. */
-	p = malloc (size);
+	p = malloc_for (size, __builtin_return_address (0));
 	if (p != NULL)
 		memset (p, 0, size);
 
@@ -185,9 +257,11 @@ realloc (void *old_block, size_t new_size) {
 		free (old_block);
 		return NULL;
 	} else {
-		void *new_block = malloc (new_size);
+		void *new_block = malloc_for (new_size, __builtin_return_address (0));
 		if (old_block != NULL && new_block != NULL) {
-			size_t old_size = block_size (old_block);
+			size_t old_size = allocprof_enabled ?
+				block_size ((struct prof_header *) old_block - 1)
+				- sizeof (struct prof_header) : block_size (old_block);
 			size_t min_size = new_size < old_size ? new_size : old_size;
 			memcpy (new_block, old_block, min_size);
 			free (old_block);
@@ -200,6 +274,17 @@ realloc (void *old_block, size_t new_size) {
    malloc(), calloc(), or realloc(). */
 void
 free (void *p) {
+	if (p != NULL && allocprof_enabled) {
+		struct prof_header *h = (struct prof_header *) p - 1;
+		allocprof_free (h->site, h->bytes);
+		p = h;
+	}
+	deallocate (p);
+}
+
+/* Frees block P, which was obtained from allocate(). */
+static void
+deallocate (void *p) {
 	if (p != NULL) {
 		struct block *b = p;
 		struct arena *a = block_to_arena (b);
@@ -218,16 +303,14 @@ free (void *p) {
 			/* Add block to free list. */
 			list_push_front (&d->free_list, &b->free_elem);
 
-			/* If the arena is now entirely unused, free it. */
+			/* If the arena is now entirely unused, keep it or
+			   free it. */
 			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
-
 				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
+				if (d->empty_cnt < EMPTY_ARENA_MAX)
+					d->empty_cnt++;
+				else
+					release_arena (a);
 			}
 
 			lock_release (&d->lock);
@@ -239,6 +322,62 @@ free (void *p) {
 	}
 }
 
+/* Removes the blocks of empty arena A from its descriptor's free
+   list and gives A back to the page allocator.  The caller holds
+   the descriptor's lock. */
+static void
+release_arena (struct arena *a) {
+	struct desc *d = a->desc;
+	size_t i;
+
+	for (i = 0; i < d->blocks_per_arena; i++) {
+		struct block *b = arena_to_block (a, i);
+		list_remove (&b->free_elem);
+	}
+	palloc_free_page (a);
+}
+
+/* Returns the number of empty arenas kept. */
+static size_t
+empty_arena_count (struct shrinker *s UNUSED) {
+	size_t cnt = 0;
+
+	for (struct desc *d = descs; d < descs + desc_cnt; d++)
+		cnt += d->empty_cnt;
+	return cnt;
+}
+
+/* Frees up to PAGE_CNT empty arenas.  Skips descriptors whose lock
+   is taken, which includes the one whose malloc() is reclaiming. */
+static size_t
+empty_arena_scan (struct shrinker *s UNUSED, size_t page_cnt) {
+	size_t freed = 0;
+
+	for (struct desc *d = descs; d < descs + desc_cnt; d++) {
+		struct list_elem *e;
+
+		if (lock_held_by_current_thread (&d->lock)
+				|| !lock_try_acquire (&d->lock))
+			continue;
+		e = list_begin (&d->free_list);
+		while (freed < page_cnt && d->empty_cnt > 0
+				&& e != list_end (&d->free_list)) {
+			struct block *b = list_entry (e, struct block, free_elem);
+			struct arena *a = block_to_arena (b);
+
+			if (a->free_cnt == d->blocks_per_arena) {
+				release_arena (a);
+				d->empty_cnt--;
+				freed++;
+				e = list_begin (&d->free_list);
+			} else
+				e = list_next (e);
+		}
+		lock_release (&d->lock);
+	}
+	return freed;
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b) {
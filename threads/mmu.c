@@ -2,12 +2,55 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+static void tlb_flush_page (uint64_t *pml4, uint64_t va);
+static void tlb_flush_pml4 (uint64_t *pml4);
+
+/* Returns true if no entry of TABLE is present. */
+static bool
+table_is_empty (const uint64_t *table) {
+	for (unsigned i = 0; i < PGSIZE / sizeof (uint64_t); i++)
+		if (table[i] & PTE_P)
+			return false;
+	return true;
+}
+
+/* Replaces the large page mapping in *ENTRY, which maps the
+ * SIZE-byte page containing VA, by a new table of next-level
+ * entries that map the same memory with the same permissions.
+ * Returns false if memory allocation fails, in which case *ENTRY
+ * is left untouched. */
+static bool
+split_large_page (uint64_t *entry, const uint64_t va, size_t size) {
+	const unsigned entry_cnt = PGSIZE / sizeof (uint64_t);
+	size_t child_size = size / entry_cnt;
+	uint64_t pa = PTE_ADDR (*entry);
+	uint64_t flags = *entry & PTE_FLAGS;
+	uint64_t *table;
+
+	ASSERT (*entry & PTE_PS);
+	table = palloc_get_page (0);
+	if (table == NULL)
+		return false;
+
+	/* A 1 GB page splits into 2 MB pages, a 2 MB page into 4 kB
+	 * pages, which do not carry the PS bit. */
+	if (child_size == PGSIZE)
+		flags &= ~PTE_PS;
+	for (unsigned i = 0; i < entry_cnt; i++)
+		table[i] = (pa + i * child_size) | flags;
+
+	*entry = vtop (table) | PTE_U | PTE_W | PTE_P;
+	invlpg (va & ~(size - 1));
+	return true;
+}
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
@@ -22,6 +65,13 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 					return NULL;
 			} else
 				return NULL;
+		} else if (pdp[idx] & PTE_PS) {
+			/* 2 MB page.  It is the leaf entry, unless the caller
+			 * wants a 4 kB entry, which we get by splitting it. */
+			if (!create)
+				return &pdp[idx];
+			if (!split_large_page (&pdp[idx], va, PDE_PGSIZE))
+				return NULL;
 		}
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
@@ -45,6 +95,12 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 					return NULL;
 			} else
 				return NULL;
+		} else if (pdpe[idx] & PTE_PS) {
+			/* 1 GB page. */
+			if (!create)
+				return &pdpe[idx];
+			if (!split_large_page (&pdpe[idx], va, PDPE_PGSIZE))
+				return NULL;
 		}
 		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
 	}
@@ -60,7 +116,10 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * pointer is returned.
+ * If VADDR is mapped by a large page, the returned entry is the
+ * PDE or PDPE with PTE_PS set, unless CREATE is true, in which
+ * case the large page is split so that a 4 kB entry exists. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -88,6 +147,49 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the entry for a SIZE-byte large page at virtual address
+ * VA in PML4E, where SIZE is PDE_PGSIZE or PDPE_PGSIZE, creating
+ * the upper-level tables as needed.  The caller fills in the entry
+ * and must set PTE_PS in it.  A page table that is in the way of a
+ * 2 MB entry but maps nothing is freed.  Returns a null pointer if
+ * memory allocation fails or if VA is already covered by smaller
+ * pages. */
+uint64_t *
+pml4e_walk_large (uint64_t *pml4e, const uint64_t va, size_t size) {
+	uint64_t *pdpe, *pde;
+
+	ASSERT (size == PDE_PGSIZE || size == PDPE_PGSIZE);
+	ASSERT (va % size == 0);
+
+	if (!(pml4e[PML4 (va)] & PTE_P)) {
+		uint64_t *new_page = palloc_get_page (PAL_ZERO);
+		if (new_page == NULL)
+			return NULL;
+		pml4e[PML4 (va)] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	pdpe = ptov (PTE_ADDR (pml4e[PML4 (va)]));
+	if (size == PDPE_PGSIZE)
+		return (pdpe[PDPE (va)] & PTE_P) && !(pdpe[PDPE (va)] & PTE_PS) ?
+			NULL : &pdpe[PDPE (va)];
+
+	if (!(pdpe[PDPE (va)] & PTE_P)) {
+		uint64_t *new_page = palloc_get_page (PAL_ZERO);
+		if (new_page == NULL)
+			return NULL;
+		pdpe[PDPE (va)] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	} else if (pdpe[PDPE (va)] & PTE_PS)
+		return NULL;
+	pde = ptov (PTE_ADDR (pdpe[PDPE (va)]));
+	if ((pde[PDX (va)] & PTE_P) && !(pde[PDX (va)] & PTE_PS)) {
+		uint64_t *pt = ptov (PTE_ADDR (pde[PDX (va)]));
+		if (!table_is_empty (pt))
+			return NULL;
+		pde[PDX (va)] = 0;
+		palloc_free_page (pt);
+	}
+	return &pde[PDX (va)];
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,10 +224,17 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+		if (((uint64_t) pte) & PTE_P) {
+			if (pdp[i] & PTE_PS) {
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) pdp_index << PDPESHIFT) |
+									 ((uint64_t) i << PDXSHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
+		}
 	}
 	return true;
 }
@@ -135,15 +244,23 @@ pdp_for_each (uint64_t *pdp,
 		pte_for_each_func *func, void *aux, unsigned pml4_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pde) & PTE_P)
-			if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
+		if (((uint64_t) pde) & PTE_P) {
+			if (pdp[i] & PTE_PS) {
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) i << PDPESHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
 					 aux, pml4_index, i))
 				return false;
+		}
 	}
 	return true;
 }
 
-/* Apply FUNC to each available pte entries including kernel's. */
+/* Apply FUNC to each available pte entries including kernel's.
+ * Large pages are passed to FUNC as their PDE or PDPE, which has
+ * PTE_PS set, with VA set to the start of the large page. */
 bool
 pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
@@ -169,8 +286,13 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			pt_destroy (PTE_ADDR (pte));
+		if (((uint64_t) pte) & PTE_P) {
+			if (pdp[i] & PTE_PS)
+				palloc_free_multiple ((void *) PTE_ADDR (pte),
+						PDE_PGSIZE / PGSIZE);
+			else
+				pt_destroy (PTE_ADDR (pte));
+		}
 	}
 	palloc_free_page ((void *) pdp);
 }
@@ -196,14 +318,142 @@ pml4_destroy (uint64_t *pml4) {
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
 		pdpe_destroy ((void *) PTE_ADDR (pdpe));
+	tlb_flush_pml4 (pml4);
 	palloc_free_page ((void *) pml4);
 }
 
+/* Process-context identifiers (PCIDs).
+ *
+ * With CR4.PCIDE set, the CPU tags each TLB entry with the PCID in
+ * the low 12 bits of CR3, and a CR3 load with bit 63 set keeps the
+ * entries of other address spaces instead of flushing the TLB.
+ * Each page map level 4 hashes to one of the PCIDs by its address.
+ * PCID_OWNER records whose translations a PCID may be caching:
+ * NULL if none, PCID_STALE if they must be flushed before the PCID
+ * is used again.  A pml4 that finds its PCID owned by someone else
+ * takes it over with a flushing CR3 load. */
+#define PCID_CNT 4096
+#define PCID_STALE ((uint64_t *) -1)
+#define CR3_NOFLUSH (1ULL << 63)
+#define CR4_PGE (1 << 7)
+#define CR4_PCIDE (1 << 17)
+
+/* Set to false by the kernel command line option -nopcid. */
+bool pml4_use_pcid = true;
+
+static bool pcid_enabled;       /* CR4.PCIDE is set. */
+static bool invpcid_enabled;    /* INVPCID is available. */
+static uint64_t *pcid_owner[PCID_CNT];
+
+/* Returns the PCID of PML4, which is never 0, the PCID that was
+ * current while paging was set up. */
+static uint64_t
+pcid_of (uint64_t *pml4) {
+	return pg_no (vtop (pml4)) % (PCID_CNT - 1) + 1;
+}
+
+/* Enables global pages, for the kernel mappings that every address
+ * space shares, and PCIDs if the CPU supports them.  Must be called
+ * while base_pml4 is loaded in CR3 with PCID 0. */
+void
+pml4_init_pcid (void) {
+	uint32_t eax, ebx, ecx, edx;
+	uint64_t cr4 = rcr4 () | CR4_PGE;
+
+	cpuid (1, 0, &eax, &ebx, &ecx, &edx);
+	if (pml4_use_pcid && (ecx & (1 << 17))) {
+		cr4 |= CR4_PCIDE;
+		pcid_enabled = true;
+
+		cpuid (0, 0, &eax, &ebx, &ecx, &edx);
+		if (eax >= 7) {
+			cpuid (7, 0, &eax, &ebx, &ecx, &edx);
+			invpcid_enabled = (ebx & (1 << 10)) != 0;
+		}
+	}
+	lcr4 (cr4);
+}
+
+/* Invalidates the TLB entry for virtual address VA in PML4,
+ * which need not be the active page map level 4. */
+static void
+tlb_flush_page (uint64_t *pml4, uint64_t va) {
+	uint64_t pcid;
+
+	if (PTE_ADDR (rcr3 ()) == vtop (pml4)) {
+		invlpg (va);
+		return;
+	}
+	if (!pcid_enabled)
+		return;
+
+	/* PML4 is not active, but its PCID may still hold entries. */
+	pcid = pcid_of (pml4);
+	if (pcid_owner[pcid] == pml4) {
+		if (invpcid_enabled)
+			invpcid (0, pcid, va);
+		else
+			pcid_owner[pcid] = PCID_STALE;
+	}
+}
+
+/* Drops every TLB entry that PML4, which is about to be freed, may
+ * have left behind under its PCID. */
+static void
+tlb_flush_pml4 (uint64_t *pml4) {
+	uint64_t pcid;
+
+	if (!pcid_enabled)
+		return;
+	pcid = pcid_of (pml4);
+	if (pcid_owner[pcid] == pml4) {
+		if (invpcid_enabled) {
+			invpcid (1, pcid, 0);
+			pcid_owner[pcid] = NULL;
+		} else
+			pcid_owner[pcid] = PCID_STALE;
+	}
+}
+
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  With PCIDs, the TLB entries of the other address
+ * spaces survive the switch. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	enum intr_level old_level;
+	uint64_t pcid, cr3;
+
+	if (pml4 == NULL)
+		pml4 = base_pml4;
+	if (!pcid_enabled) {
+		lcr3 (vtop (pml4));
+		return;
+	}
+
+	old_level = intr_disable ();
+	pcid = pcid_of (pml4);
+	cr3 = vtop (pml4) | pcid;
+	if (pcid_owner[pcid] == pml4 || pcid_owner[pcid] == NULL)
+		cr3 |= CR3_NOFLUSH;
+	pcid_owner[pcid] = pml4;
+	lcr3 (cr3);
+	intr_set_level (old_level);
+}
+
+/* Returns the offset of UADDR within the page that PTE, the leaf
+ * entry for UADDR in PML4, maps.  PTE may be a PDE or a PDPE of a
+ * large page, which we tell apart by comparing it against the
+ * entries found on the way down. */
+static uint64_t
+large_page_ofs (uint64_t *pml4, uint64_t *pte, const void *uaddr) {
+	uint64_t *pdpe;
+
+	if (!(*pte & PTE_PS))
+		return pg_ofs (uaddr);
+	pdpe = ptov (PTE_ADDR (pml4[PML4 (uaddr)]));
+	if (pte == &pdpe[PDPE (uaddr)])
+		return (uint64_t) uaddr & (PDPE_PGSIZE - 1);
+	return (uint64_t) uaddr & (PDE_PGSIZE - 1);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -217,7 +467,7 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
 	if (pte && (*pte & PTE_P))
-		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+		return ptov (PTE_ADDR (*pte)) + large_page_ofs (pml4, pte, uaddr);
 	return NULL;
 }
 
@@ -246,7 +496,10 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
- * UPAGE need not be mapped. */
+ * UPAGE need not be mapped.  If UPAGE lies in a large page, the
+ * large page is split first, or, if there is no memory to split
+ * it, unmapped as a whole.  Use pml4_split_huge_page() to tell
+ * these cases apart. */
 void
 pml4_clear_page (uint64_t *pml4, void *upage) {
 	uint64_t *pte;
@@ -254,11 +507,63 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 	ASSERT (is_user_vaddr (upage));
 
 	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	if (pte != NULL && (*pte & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+		uint64_t *small = pml4e_walk (pml4, (uint64_t) upage, true);
+		if (small != NULL)
+			pte = small;
+	}
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		tlb_flush_page (pml4, (uint64_t) upage);
+	}
+}
+
+/* Maps the PDE_PGSIZE bytes of user virtual memory at UPAGE to
+ * the physically contiguous frames at kernel virtual address
+ * KPAGE with a single 2 MB page.  Both addresses must be aligned
+ * to PDE_PGSIZE.  If WRITABLE is true, the new page is read/write;
+ * otherwise it is read-only.  Returns false if memory allocation
+ * fails or if part of the range is already mapped. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	uint64_t *pde;
+	ASSERT ((uint64_t) upage % PDE_PGSIZE == 0);
+	ASSERT (vtop (kpage) % PDE_PGSIZE == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	pde = pml4e_walk_large (pml4, (uint64_t) upage, PDE_PGSIZE);
+	if (pde == NULL || (*pde & PTE_P))
+		return false;
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	tlb_flush_page (pml4, (uint64_t) upage);
+	return true;
+}
+
+/* Replaces the 2 MB page that maps UPAGE in PML4, if there is one,
+ * by a page table of 4 kB entries that map the same frames with
+ * the same permissions.  Returns false if memory allocation fails,
+ * in which case the 2 MB page is left alone. */
+bool
+pml4_split_huge_page (uint64_t *pml4, void *upage) {
+	uint64_t *pde = pml4e_walk (pml4, (uint64_t) upage, false);
+
+	if (pde == NULL || (*pde & (PTE_P | PTE_PS)) != (PTE_P | PTE_PS))
+		return true;
+	return pml4e_walk (pml4, (uint64_t) upage, true) != NULL;
+}
+
+/* Marks the 2 MB page that maps UPAGE in PML4 "not present",
+ * without splitting it.  Does nothing if UPAGE is not mapped by a
+ * 2 MB page. */
+void
+pml4_clear_huge_page (uint64_t *pml4, void *upage) {
+	uint64_t *pde = pml4e_walk (pml4, (uint64_t) upage, false);
+
+	if (pde != NULL && (*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+		*pde &= ~PTE_P;
+		tlb_flush_page (pml4, (uint64_t) upage);
 	}
 }
 
@@ -281,10 +586,9 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		if (dirty)
 			*pte |= PTE_D;
 		else
-			*pte &= ~(uint32_t) PTE_D;
+			*pte &= ~(uint64_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_flush_page (pml4, (uint64_t) vpage);
 	}
 }
 
@@ -307,9 +611,232 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		if (accessed)
 			*pte |= PTE_A;
 		else
-			*pte &= ~(uint32_t) PTE_A;
+			*pte &= ~(uint64_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_flush_page (pml4, (uint64_t) vpage);
+	}
+}
+
+/* Range operations.
+ *
+ * The functions below work on runs of consecutive user pages.  They
+ * walk down to each page table once and then step through its
+ * entries, instead of walking all four levels for every page, skip
+ * whole unmapped tables at any level, and flush the TLB once at the
+ * end rather than once per page. */
+
+/* A TLB flush put off until the end of a range operation.  Up to
+ * TLB_BATCH_MAX pages are flushed one by one; past that, flushing
+ * everything the address space has cached is cheaper. */
+#define TLB_BATCH_MAX 32
+struct tlb_batch {
+	uint64_t *pml4;                 /* Address space to flush. */
+	size_t cnt;                     /* Number of pages to flush. */
+	uint64_t va[TLB_BATCH_MAX];     /* The pages, if CNT is small. */
+};
+
+/* Adds the page at VA to the pages BATCH is to flush. */
+static void
+tlb_batch_add (struct tlb_batch *batch, uint64_t va) {
+	if (batch->cnt < TLB_BATCH_MAX)
+		batch->va[batch->cnt] = va;
+	batch->cnt++;
+}
+
+/* Flushes the pages added to BATCH. */
+static void
+tlb_batch_flush (struct tlb_batch *batch) {
+	if (batch->cnt <= TLB_BATCH_MAX) {
+		for (size_t i = 0; i < batch->cnt; i++)
+			tlb_flush_page (batch->pml4, batch->va[i]);
+	} else if (PTE_ADDR (rcr3 ()) == vtop (batch->pml4)) {
+		/* Reloading CR3 without CR3_NOFLUSH drops the non-global
+		 * entries of the current PCID, or all of them without
+		 * PCIDs. */
+		lcr3 (rcr3 ());
+	} else
+		tlb_flush_pml4 (batch->pml4);
+	batch->cnt = 0;
+}
+
+/* Returns the first multiple of SIZE above VA, or END if that is
+ * lower. */
+static uint64_t
+next_boundary (uint64_t va, uint64_t size, uint64_t end) {
+	uint64_t next = (va & ~(size - 1)) + size;
+	return next < end ? next : end;
+}
+
+/* Finds the leaf entry for virtual address VA in PML4 without
+ * creating or splitting anything.  Stores in *NEXT the address,
+ * at most END, where the run of entries that starts at the
+ * returned one leaves its table: the entries for the pages from VA
+ * up to *NEXT follow each other in memory, unless the returned
+ * entry has PTE_PS set, in which case it maps all of them.  If VA
+ * is not covered by any table, returns a null pointer and stores in
+ * *NEXT where the hole ends. */
+static uint64_t *
+range_walk (uint64_t *pml4, uint64_t va, uint64_t end, uint64_t *next) {
+	uint64_t *pdp, *pd, *pt;
+
+	if (!(pml4[PML4 (va)] & PTE_P)) {
+		*next = next_boundary (va, 1ULL << PML4SHIFT, end);
+		return NULL;
+	}
+	pdp = ptov (PTE_ADDR (pml4[PML4 (va)]));
+	if ((pdp[PDPE (va)] & PTE_P) == 0 || (pdp[PDPE (va)] & PTE_PS) != 0) {
+		*next = next_boundary (va, PDPE_PGSIZE, end);
+		return pdp[PDPE (va)] & PTE_P ? &pdp[PDPE (va)] : NULL;
+	}
+	pd = ptov (PTE_ADDR (pdp[PDPE (va)]));
+	*next = next_boundary (va, PDE_PGSIZE, end);
+	if ((pd[PDX (va)] & PTE_P) == 0 || (pd[PDX (va)] & PTE_PS) != 0)
+		return pd[PDX (va)] & PTE_P ? &pd[PDX (va)] : NULL;
+	pt = ptov (PTE_ADDR (pd[PDX (va)]));
+	return &pt[PTX (va)];
+}
+
+/* Returns the size of the large page that LEAF, a leaf entry with
+ * PTE_PS set that range_walk() returned for VA in PML4, maps. */
+static uint64_t
+large_page_size (uint64_t *pml4, uint64_t *leaf, uint64_t va) {
+	uint64_t *pdp = ptov (PTE_ADDR (pml4[PML4 (va)]));
+	return leaf == &pdp[PDPE (va)] ? PDPE_PGSIZE : PDE_PGSIZE;
+}
+
+/* Maps the PAGE_CNT user virtual pages starting at UPAGE in PML4
+ * to the frames at kernel virtual addresses KPAGES[0], KPAGES[1],
+ * and so on, read/write if RW is true and read-only otherwise.
+ * None of the pages may be mapped yet.  Works like PAGE_CNT calls
+ * to pml4_set_page(), but walks the upper levels only once per
+ * page table.  Returns true if successful; if memory allocation
+ * fails, maps none of the pages and returns false. */
+bool
+pml4_set_range (uint64_t *pml4, void *upage, void **kpages, size_t page_cnt,
+		bool rw) {
+	uint64_t start = (uint64_t) upage;
+	uint64_t end = start + page_cnt * PGSIZE;
+	uint64_t flags = PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	uint64_t va;
+	size_t i = 0;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (page_cnt == 0 || is_user_vaddr ((void *) (end - 1)));
+	ASSERT (pml4 != base_pml4);
+
+	for (va = start; va < end; ) {
+		uint64_t next = next_boundary (va, PDE_PGSIZE, end);
+		uint64_t *pte = pml4e_walk (pml4, va, true);
+
+		if (pte == NULL) {
+			pml4_clear_range (pml4, upage, i);
+			return false;
+		}
+		for (; va < next; va += PGSIZE, pte++, i++) {
+			ASSERT (pg_ofs (kpages[i]) == 0);
+			*pte = vtop (kpages[i]) | flags;
+		}
+	}
+	return true;
+}
+
+/* Marks the PAGE_CNT user virtual pages starting at UPAGE "not
+ * present" in PML4, as PAGE_CNT calls to pml4_clear_page() would,
+ * and flushes their TLB entries once for the whole range.  A large
+ * page that lies wholly inside the range is cleared without being
+ * split; one that sticks out of it is split first, or, if there is
+ * no memory to split it, cleared as a whole. */
+void
+pml4_clear_range (uint64_t *pml4, void *upage, size_t page_cnt) {
+	struct tlb_batch batch = { .pml4 = pml4 };
+	uint64_t start = (uint64_t) upage;
+	uint64_t end = start + page_cnt * PGSIZE;
+	uint64_t va, next;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (page_cnt == 0 || is_user_vaddr ((void *) (end - 1)));
+
+	for (va = start; va < end; va = next) {
+		uint64_t *pte = range_walk (pml4, va, end, &next);
+
+		if (pte == NULL)
+			continue;
+		if (*pte & PTE_PS) {
+			uint64_t size = large_page_size (pml4, pte, va);
+			uint64_t base = va & ~(size - 1);
+
+			if ((base < start || base + size > end)
+					&& pml4e_walk (pml4, va, true) != NULL) {
+				/* Split; look again at the smaller entries. */
+				next = va;
+				continue;
+			}
+			*pte &= ~PTE_P;
+			tlb_batch_add (&batch, base);
+			next = next_boundary (va, size, end);
+			continue;
+		}
+		for (; va < next; va += PGSIZE, pte++)
+			if (*pte & PTE_P) {
+				*pte &= ~PTE_P;
+				tlb_batch_add (&batch, va);
+			}
+	}
+	tlb_batch_flush (&batch);
+}
+
+/* Harvests the bits among FLAGS, a combination of PTE_A, PTE_D and
+ * PTE_W, from the PTEs for the PAGE_CNT user virtual pages starting
+ * at UPAGE in PML4: clears them, flushes the TLB entries of the pages
+ * that had any of them set once for the whole range, and, unless
+ * FOUND is a null pointer, stores in FOUND[i] the bits that the
+ * i'th page had set.  A large page reports its bits for each page
+ * of it in the range.  Returns the number of pages that had any of
+ * the bits set.  Harvesting PTE_W write-protects the range. */
+size_t
+pml4_harvest_range (uint64_t *pml4, void *upage, size_t page_cnt,
+		uint64_t flags, uint8_t *found) {
+	struct tlb_batch batch = { .pml4 = pml4 };
+	uint64_t start = (uint64_t) upage;
+	uint64_t end = start + page_cnt * PGSIZE;
+	uint64_t va, next;
+	size_t hit_cnt = 0;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT ((flags & ~(uint64_t) (PTE_A | PTE_D | PTE_W)) == 0);
+
+	for (va = start; va < end; va = next) {
+		uint64_t *pte = range_walk (pml4, va, end, &next);
+		uint64_t bits;
+
+		if (pte == NULL || (*pte & PTE_PS)) {
+			/* No table, or one entry for the whole run. */
+			bits = 0;
+			if (pte != NULL && (*pte & PTE_P)) {
+				bits = *pte & flags;
+				if (bits) {
+					*pte &= ~bits;
+					tlb_batch_add (&batch, va);
+				}
+			}
+			if (bits)
+				hit_cnt += (next - va) / PGSIZE;
+			if (found != NULL)
+				memset (found + (va - start) / PGSIZE, bits,
+						(next - va) / PGSIZE);
+			continue;
+		}
+		for (; va < next; va += PGSIZE, pte++) {
+			bits = *pte & PTE_P ? *pte & flags : 0;
+			if (bits) {
+				*pte &= ~bits;
+				tlb_batch_add (&batch, va);
+				hit_cnt++;
+			}
+			if (found != NULL)
+				found[(va - start) / PGSIZE] = bits;
+		}
 	}
+	tlb_batch_flush (&batch);
+	return hit_cnt;
 }
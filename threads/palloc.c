@@ -7,9 +7,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
+#include "threads/allocprof.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,24 +28,112 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool has three watermarks on its count of free pages.  An
+   allocation that would leave fewer than "min" free pages first
+   asks the registered shrinkers to give pages back, as does one
+   that finds no free run at all.  Dropping below "low" wakes up
+   the reclaim thread, which shrinks caches until "high" pages are
+   free again, so that most allocations never reclaim directly.
+   The VM's kswapd evicts user pages against the user pool's "low"
+   and "high" watermarks in the same way.
+
+   The split between the pools is not fixed either.  A pool that
+   runs dry borrows a 2 MB chunk of free pages from the other one,
+   which keeps it as a loan until every page of it is free again,
+   then takes it back.  See "Loans" below. */
 
 /* A memory pool. */
 struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	uint16_t *sites;                /* Profiled call site of each page. */
+	size_t free_cnt;                /* Number of free pages. */
+	size_t wmark_min;               /* Allocations reclaim below this. */
+	size_t wmark_low;               /* The reclaim thread wakes below this. */
+	size_t wmark_high;              /* The reclaim thread stops at this. */
+
+	/* Chunks lent to the other pool. */
+	struct list loans;              /* Outstanding loans. */
+	size_t loan_cnt;                /* Number of outstanding loans. */
+	size_t loan_peak;               /* Most loans outstanding at once. */
+	long long lend_cnt;             /* Chunks lent so far. */
+	long long recall_cnt;           /* Chunks taken back so far. */
+};
+
+/* A chunk of LOAN_PGCNT pages, aligned on a multiple of its size,
+   that one pool lends to the other.  Its first page holds this
+   header and the chunk's bitmap. */
+struct loan {
+	struct list_elem elem;          /* Element in the lender's loans. */
+	struct bitmap *used_map;        /* Bitmap of free pages. */
+	size_t free_cnt;                /* Number of free pages. */
 };
 
+/* Pages in a loan, and how many of them the borrower gets. */
+#define LOAN_PGCNT 512
+#define LOAN_SIZE (LOAN_PGCNT * PGSIZE)
+#define LOAN_USABLE (LOAN_PGCNT - 1)
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
+
+/* Percentage of a pool's pages that it may lend to the other pool
+   at once.  0 keeps the split made at boot. */
+unsigned pool_loan_pct = 50;
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void count_free (struct pool *, long delta);
+static void init_watermarks (struct pool *);
+static size_t pool_scan (struct pool *, size_t page_cnt, size_t align);
+static size_t compact (struct pool *, size_t page_cnt, size_t align);
+static size_t shrink_pool (struct pool *, size_t page_cnt);
+static void wake_reclaim (void);
+static struct pool *other_pool (struct pool *);
+static void *borrow_pages (struct pool *, size_t page_cnt);
+static struct loan *find_loan (struct pool *, void *page);
+static bool recall_loans (struct pool *, bool force);
+static void *get_pages (enum palloc_flags, size_t page_cnt, size_t align,
+		void *caller);
+static void record_pages (enum palloc_flags, void *pages, size_t page_cnt,
+		void *caller);
+static void forget_pages (void *pages, size_t page_cnt);
+
+/* Moves user pages out of the way for compaction; see compact(). */
+static palloc_migrate_func *migrate_page;
+
+/* Compaction statistics. */
+static long long compact_cnt;       /* Compaction runs. */
+static long long compact_ok_cnt;    /* Runs that freed a window. */
+static long long migrate_cnt;       /* Pages migrated. */
+
+/* Registered shrinkers, and a lock that lets one thread at a time
+   run them. */
+static struct list shrinkers;
+static struct lock shrink_lock;
+
+/* Reclaim thread, upped when a pool drops below its low
+   watermark.  RECLAIM_PENDING keeps it from being upped again
+   before it gets to run. */
+static struct semaphore reclaim_sema;
+static bool reclaim_pending;
+
+/* How long the reclaim thread waits after a pass that freed
+   nothing, so that a pool stuck below its low watermark does not
+   keep it spinning. */
+#define RECLAIM_BACKOFF (TIMER_FREQ / 10)
+
+/* Reclaim statistics. */
+static long long direct_cnt;        /* Allocations that reclaimed. */
+static long long background_cnt;    /* Passes of the reclaim thread. */
+static long long shrunk_cnt;        /* Pages freed by shrinkers. */
 
 /* multiboot info */
 struct multiboot_info {
@@ -232,6 +324,9 @@ split:
 			}
 		}
 	}
+
+	init_watermarks (&kernel_pool);
+	init_watermarks (&user_pool);
 }
 
 /* Initializes the page allocator and get the memory size */
@@ -243,6 +338,10 @@ palloc_init (void) {
 	struct area base_mem = { .size = 0 };
 	struct area ext_mem = { .size = 0 };
 
+	list_init (&shrinkers);
+	lock_init (&shrink_lock);
+	sema_init (&reclaim_sema, 0);
+
 	resolve_area_info (&base_mem, &ext_mem);
 	printf ("Pintos booting with: \n");
 	printf ("\tbase_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
@@ -261,21 +360,61 @@ palloc_init (void) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
-	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	return get_pages (flags, page_cnt, PGSIZE, __builtin_return_address (0));
+}
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
+/* Obtains and returns a group of PAGE_CNT contiguous free pages
+   whose kernel virtual address is a multiple of ALIGN, a power of
+   two no smaller than PGSIZE, so that they can be mapped by one
+   large page.  FLAGS are interpreted as by palloc_get_multiple().
+   Returns a null pointer if no suitably aligned run of free pages
+   exists. */
+void *
+palloc_get_multiple_aligned (enum palloc_flags flags, size_t page_cnt,
+		size_t align) {
+	return get_pages (flags, page_cnt, align, __builtin_return_address (0));
+}
+
+/* Does the work of palloc_get_multiple_aligned() for the call
+   that returns to CALLER. */
+static void *
+get_pages (enum palloc_flags flags, size_t page_cnt, size_t align,
+		void *caller) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_idx;
 	void *pages;
 
+	ASSERT (align >= PGSIZE && (align & (align - 1)) == 0);
+
+	if (pool->free_cnt < pool->wmark_min + page_cnt
+			&& shrink_pool (pool, pool->wmark_low + page_cnt - pool->free_cnt))
+		direct_cnt++;
+
+	page_idx = pool_scan (pool, page_cnt, align);
+	if (page_idx == BITMAP_ERROR && recall_loans (pool, true))
+		page_idx = pool_scan (pool, page_cnt, align);
+	if (page_idx == BITMAP_ERROR && page_cnt > 1 && pool == &user_pool)
+		page_idx = compact (pool, page_cnt, align);
+	if (page_idx == BITMAP_ERROR && shrink_pool (pool, page_cnt)) {
+		direct_cnt++;
+		page_idx = pool_scan (pool, page_cnt, align);
+	}
+
+	if (pool->free_cnt < pool->wmark_low)
+		wake_reclaim ();
+
 	if (page_idx != BITMAP_ERROR)
 		pages = pool->base + PGSIZE * page_idx;
+	else if (align == PGSIZE)
+		pages = borrow_pages (pool, page_cnt);
 	else
 		pages = NULL;
 
 	if (pages) {
 		if (flags & PAL_ZERO)
 			memset (pages, 0, PGSIZE * page_cnt);
+		if (allocprof_enabled)
+			record_pages (flags, pages, page_cnt, caller);
 	} else {
 		if (flags & PAL_ASSERT)
 			PANIC ("palloc_get: out of pages");
@@ -284,6 +423,35 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	return pages;
 }
 
+/* Allocates PAGE_CNT contiguous free pages of POOL starting at a
+   multiple of ALIGN bytes, and returns the index of the first, or
+   BITMAP_ERROR if there is no such run. */
+static size_t
+pool_scan (struct pool *pool, size_t page_cnt, size_t align) {
+	size_t align_cnt = align / PGSIZE;
+	size_t pool_cnt, page_idx;
+
+	lock_acquire (&pool->lock);
+	if (align == PGSIZE)
+		page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+	else {
+		pool_cnt = bitmap_size (pool->used_map);
+		page_idx = pg_no (ROUND_UP ((uint64_t) pool->base, align))
+			- pg_no (pool->base);
+		for (; page_idx + page_cnt <= pool_cnt; page_idx += align_cnt)
+			if (!bitmap_contains (pool->used_map, page_idx, page_cnt, true))
+				break;
+		if (page_idx + page_cnt <= pool_cnt)
+			bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+		else
+			page_idx = BITMAP_ERROR;
+	}
+	if (page_idx != BITMAP_ERROR)
+		count_free (pool, -(long) page_cnt);
+	lock_release (&pool->lock);
+	return page_idx;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -293,14 +461,16 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_page (enum palloc_flags flags) {
-	return palloc_get_multiple (flags, 1);
+	return get_pages (flags, 1, PGSIZE, __builtin_return_address (0));
 }
 
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) {
 	struct pool *pool;
+	struct loan *loan;
 	size_t page_idx;
+	enum intr_level old_level;
 
 	ASSERT (pg_ofs (pages) == 0);
 	if (pages == NULL || page_cnt == 0)
@@ -313,13 +483,30 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 	else
 		NOT_REACHED ();
 
-	page_idx = pg_no (pages) - pg_no (pool->base);
-
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+	if (allocprof_enabled)
+		forget_pages (pages, page_cnt);
+
+	/* Pages of a loan go back to the loan, for the borrower. */
+	old_level = intr_disable ();
+	loan = find_loan (pool, pages);
+	if (loan != NULL) {
+		page_idx = pg_no (pages) - pg_no (loan);
+		ASSERT (bitmap_all (loan->used_map, page_idx, page_cnt));
+		bitmap_set_multiple (loan->used_map, page_idx, page_cnt, false);
+		loan->free_cnt += page_cnt;
+		count_free (other_pool (pool), page_cnt);
+	}
+	intr_set_level (old_level);
+	if (loan != NULL)
+		return;
+
+	page_idx = pg_no (pages) - pg_no (pool->base);
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	count_free (pool, page_cnt);
 }
 
 /* Frees the page at PAGE. */
@@ -328,17 +515,507 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of physical pages up to the end of the
+   highest pool, which bounds the physical page number of every
+   page that palloc hands out. */
+size_t
+palloc_phys_page_cnt (void) {
+	const struct pool *high = user_pool.base > kernel_pool.base ?
+		&user_pool : &kernel_pool;
+	return pg_no (vtop (high->base)) + bitmap_size (high->used_map);
+}
+
+/* Returns true if the pool that FLAGS allocate from has fewer free
+   pages than its WMARK watermark.  Reclaimers outside palloc, such
+   as the VM's page-out thread, use it to keep pace with the pool. */
+bool
+palloc_below_wmark (enum palloc_flags flags, enum palloc_wmark wmark) {
+	const struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t mark = wmark == WMARK_MIN ? pool->wmark_min
+		: wmark == WMARK_LOW ? pool->wmark_low : pool->wmark_high;
+
+	return pool->free_cnt < mark;
+}
+
+/* Returns the number of free pages in the pool that FLAGS allocate
+   from, without allocating any, so that callers can size their
+   work to it without setting off reclaim. */
+size_t
+palloc_free_cnt (enum palloc_flags flags) {
+	const struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+
+	return pool->free_cnt;
+}
+
+/* Compaction.
+
+   User pool pages hold the frames of user virtual memory, which
+   the VM can move: it copies the frame elsewhere and repoints the
+   page table entry that maps it.  When no run of free pages can
+   satisfy a multi-page user allocation, compact() picks the
+   suitably aligned window with the fewest used pages, reserves
+   its free pages, and asks the migrator to move the used ones
+   out. */
+
+/* Installs FUNC as the function that moves the contents of a used
+   user pool page elsewhere.  FUNC must leave the page itself
+   allocated, to the caller, and return true, or return false if
+   the page cannot be moved right now. */
+void
+palloc_set_migrator (palloc_migrate_func *func) {
+	migrate_page = func;
+}
+
+/* Tries to free up PAGE_CNT contiguous pages in POOL, starting at
+   a multiple of ALIGN bytes, by migrating the used pages in the
+   way, and allocates them.  Returns the index of the first page,
+   or BITMAP_ERROR on failure. */
+static size_t
+compact (struct pool *pool, size_t page_cnt, size_t align) {
+	size_t pool_cnt = bitmap_size (pool->used_map);
+	size_t stride = align > PGSIZE ? align / PGSIZE : page_cnt;
+	size_t best = BITMAP_ERROR, best_used = SIZE_MAX;
+	struct bitmap *moved;
+	size_t idx, i;
+
+	if (migrate_page == NULL)
+		return BITMAP_ERROR;
+	moved = bitmap_create (page_cnt);
+	if (moved == NULL)
+		return BITMAP_ERROR;
+
+	/* Choose a window, and reserve its free pages so that the
+	   migrated pages land outside of it. */
+	lock_acquire (&pool->lock);
+	idx = pg_no (ROUND_UP ((uint64_t) pool->base, align)) - pg_no (pool->base);
+	for (; idx + page_cnt <= pool_cnt; idx += stride) {
+		size_t used = bitmap_count (pool->used_map, idx, page_cnt, true);
+		if (used < best_used) {
+			best = idx;
+			best_used = used;
+		}
+	}
+	if (best == BITMAP_ERROR
+			|| bitmap_count (pool->used_map, 0, pool_cnt, false) < page_cnt) {
+		lock_release (&pool->lock);
+		bitmap_destroy (moved);
+		return BITMAP_ERROR;
+	}
+	for (i = 0; i < page_cnt; i++)
+		if (bitmap_test (pool->used_map, best + i))
+			bitmap_mark (moved, i);
+		else
+			bitmap_mark (pool->used_map, best + i);
+	count_free (pool, -(long) (page_cnt - best_used));
+	lock_release (&pool->lock);
+	compact_cnt++;
+
+	for (i = 0; i < page_cnt; i++) {
+		bool ours = false;
+
+		if (!bitmap_test (moved, i))
+			continue;
+		if (migrate_page (pool->base + PGSIZE * (best + i))) {
+			if (allocprof_enabled)
+				forget_pages (pool->base + PGSIZE * (best + i), 1);
+			migrate_cnt++;
+			continue;
+		}
+
+		/* Not movable, unless its owner freed it meanwhile. */
+		lock_acquire (&pool->lock);
+		if (!bitmap_test (pool->used_map, best + i)) {
+			bitmap_mark (pool->used_map, best + i);
+			count_free (pool, -1);
+			ours = true;
+		}
+		lock_release (&pool->lock);
+		if (!ours)
+			break;
+	}
+
+	if (i < page_cnt) {
+		/* Give back the pages we reserved or emptied, which are
+		   all but page I and the used pages past it. */
+		lock_acquire (&pool->lock);
+		for (idx = 0; idx < page_cnt; idx++)
+			if (idx < i || !bitmap_test (moved, idx)) {
+				bitmap_reset (pool->used_map, best + idx);
+				count_free (pool, 1);
+			}
+		lock_release (&pool->lock);
+		best = BITMAP_ERROR;
+	} else
+		compact_ok_cnt++;
+	bitmap_destroy (moved);
+	return best;
+}
+
+/* Reclaim.
+
+   Kernel caches register a shrinker with palloc_register_shrinker()
+   to be asked for pages when their pool runs low.  Each call to
+   shrink_pool() splits its target among the shrinkers of the pool
+   in proportion to how much each could free. */
+
+/* Registers shrinker S. */
+void
+palloc_register_shrinker (struct shrinker *s) {
+	ASSERT (s->count != NULL && s->scan != NULL);
+	ASSERT (s->pool == 0 || s->pool == PAL_USER);
+
+	s->freed = 0;
+	lock_acquire (&shrink_lock);
+	list_push_back (&shrinkers, &s->elem);
+	lock_release (&shrink_lock);
+}
+
+/* Asks the shrinkers of POOL to free PAGE_CNT pages between them,
+   and returns how many they freed.  Returns 0 without shrinking if
+   another thread is already running the shrinkers, or if the
+   current thread is, i.e. a shrinker itself is allocating. */
+static size_t
+shrink_pool (struct pool *pool, size_t page_cnt) {
+	enum palloc_flags flags = pool == &user_pool ? PAL_USER : 0;
+	size_t total = 0, freed = 0;
+	struct list_elem *e;
+
+	if (page_cnt == 0 || list_empty (&shrinkers)
+			|| lock_held_by_current_thread (&shrink_lock)
+			|| !lock_try_acquire (&shrink_lock))
+		return 0;
+
+	for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+			e = list_next (e)) {
+		struct shrinker *s = list_entry (e, struct shrinker, elem);
+		if (s->pool == flags)
+			total += s->count (s);
+	}
+	for (e = list_begin (&shrinkers);
+			total > 0 && e != list_end (&shrinkers); e = list_next (e)) {
+		struct shrinker *s = list_entry (e, struct shrinker, elem);
+		size_t cnt, share, done;
+
+		if (s->pool != flags || (cnt = s->count (s)) == 0)
+			continue;
+		share = DIV_ROUND_UP (page_cnt * cnt, total);
+		done = s->scan (s, share < cnt ? share : cnt);
+		s->freed += done;
+		freed += done;
+	}
+	lock_release (&shrink_lock);
+
+	shrunk_cnt += freed;
+	return freed;
+}
+
+/* Wakes up the reclaim thread, unless it is already awake. */
+static void
+wake_reclaim (void) {
+	if (!reclaim_pending) {
+		reclaim_pending = true;
+		sema_up (&reclaim_sema);
+	}
+}
+
+/* Reclaim thread.  Shrinks caches until every pool that dropped
+   below its low watermark is back at its high watermark. */
+static void
+reclaim (void *aux UNUSED) {
+	struct pool *pools[] = { &kernel_pool, &user_pool };
+
+	for (;;) {
+		size_t freed = 0;
+		bool low = false;
+		size_t i;
+
+		sema_down (&reclaim_sema);
+		background_cnt++;
+		for (i = 0; i < sizeof pools / sizeof *pools; i++) {
+			struct pool *pool = pools[i];
+			recall_loans (pool, pool->free_cnt < pool->wmark_low);
+			if (pool->free_cnt < pool->wmark_high)
+				freed += shrink_pool (pool, pool->wmark_high - pool->free_cnt);
+			low = low || pool->free_cnt < pool->wmark_low;
+		}
+		if (freed == 0 && low)
+			timer_sleep (RECLAIM_BACKOFF);
+		reclaim_pending = false;
+	}
+}
+
+/* Starts the reclaim thread.  Until then, pools that run low are
+   only ever reclaimed by the allocations themselves. */
+void
+palloc_start_reclaim (void) {
+	thread_create ("reclaim", PRI_DEFAULT, reclaim, NULL);
+}
+
+/* Loans.
+
+   When a pool has no run of free pages left for a single-page or
+   small multi-page allocation, even after shrinking, it borrows a
+   free, LOAN_SIZE aligned chunk from the other pool and allocates
+   from that.  The lender keeps the chunk marked used in its own
+   bitmap and tracks it in its list of loans, so freeing a page of
+   it, which finds the lender's pool by address, can send the page
+   back to the loan.  Kernel pages cannot be moved, so a loan is
+   only taken back once all of its pages are free: eagerly when
+   the lender itself runs dry, and otherwise by the reclaim thread
+   once the borrower has enough free pages without it.
+
+   A pool lends only while it stays above its high watermark and
+   within pool_loan_pct percent of its pages.  Loans and loan
+   bitmaps are changed with interrupts off, because
+   palloc_free_multiple() may run with interrupts off. */
+
+/* Returns the pool that is not POOL. */
+static struct pool *
+other_pool (struct pool *pool) {
+	return pool == &kernel_pool ? &user_pool : &kernel_pool;
+}
+
+/* Returns the loan of lender POOL that PAGE is in, or a null
+   pointer if PAGE is not lent out.  Interrupts must be off. */
+static struct loan *
+find_loan (struct pool *pool, void *page) {
+	void *chunk = (void *) ((uint64_t) page & ~(uint64_t) (LOAN_SIZE - 1));
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	for (e = list_begin (&pool->loans); e != list_end (&pool->loans);
+			e = list_next (e))
+		if ((void *) list_entry (e, struct loan, elem) == chunk)
+			return list_entry (e, struct loan, elem);
+	return NULL;
+}
+
+/* Lends a chunk of LENDER to the other pool, if LENDER's policy
+   allows, and returns true if it did. */
+static bool
+lend_chunk (struct pool *lender) {
+	size_t pool_cnt = bitmap_size (lender->used_map);
+	struct loan *loan;
+	enum intr_level old_level;
+	size_t page_idx;
+
+	if ((lender->loan_cnt + 1) * LOAN_PGCNT > pool_cnt * pool_loan_pct / 100
+			|| lender->free_cnt < lender->wmark_high + LOAN_PGCNT)
+		return false;
+	page_idx = pool_scan (lender, LOAN_PGCNT, LOAN_SIZE);
+	if (page_idx == BITMAP_ERROR && lender == &user_pool)
+		page_idx = compact (lender, LOAN_PGCNT, LOAN_SIZE);
+	if (page_idx == BITMAP_ERROR)
+		return false;
+
+	loan = (struct loan *) (lender->base + PGSIZE * page_idx);
+	loan->used_map = bitmap_create_in_buf (LOAN_PGCNT, loan + 1,
+			PGSIZE - sizeof *loan);
+	bitmap_mark (loan->used_map, 0);
+	loan->free_cnt = LOAN_USABLE;
+
+	old_level = intr_disable ();
+	list_push_back (&lender->loans, &loan->elem);
+	count_free (other_pool (lender), LOAN_USABLE);
+	if (++lender->loan_cnt > lender->loan_peak)
+		lender->loan_peak = lender->loan_cnt;
+	lender->lend_cnt++;
+	intr_set_level (old_level);
+	return true;
+}
+
+/* Allocates PAGE_CNT contiguous pages for POOL from a chunk that
+   it borrows from the other pool, borrowing a new chunk if none it
+   has will do.  Returns the pages, or a null pointer. */
+static void *
+borrow_pages (struct pool *pool, size_t page_cnt) {
+	struct pool *lender = other_pool (pool);
+	enum intr_level old_level;
+	struct list_elem *e;
+	void *pages = NULL;
+	bool lent = false;
+
+	if (page_cnt > LOAN_USABLE || pool_loan_pct == 0)
+		return NULL;
+
+	for (;;) {
+		old_level = intr_disable ();
+		for (e = list_begin (&lender->loans); e != list_end (&lender->loans);
+				e = list_next (e)) {
+			struct loan *loan = list_entry (e, struct loan, elem);
+			size_t page_idx;
+
+			if (loan->free_cnt < page_cnt)
+				continue;
+			page_idx = bitmap_scan_and_flip (loan->used_map, 0, page_cnt, false);
+			if (page_idx != BITMAP_ERROR) {
+				loan->free_cnt -= page_cnt;
+				count_free (pool, -(long) page_cnt);
+				pages = (uint8_t *) loan + PGSIZE * page_idx;
+				break;
+			}
+		}
+		intr_set_level (old_level);
+
+		if (pages != NULL || lent || !lend_chunk (lender))
+			return pages;
+		lent = true;
+	}
+}
+
+/* Takes back the chunks that POOL lent out and that are entirely
+   free again.  Unless FORCE is true, takes back only as many as
+   the borrower can spare while staying above its high watermark.
+   Returns true if any chunk came back. */
+static bool
+recall_loans (struct pool *pool, bool force) {
+	struct pool *borrower = other_pool (pool);
+	enum intr_level old_level;
+	struct list_elem *e;
+	size_t recalled = 0;
+
+	if (list_empty (&pool->loans))
+		return false;
+
+	old_level = intr_disable ();
+	e = list_begin (&pool->loans);
+	while (e != list_end (&pool->loans)) {
+		struct loan *loan = list_entry (e, struct loan, elem);
+		size_t page_idx = pg_no (loan) - pg_no (pool->base);
+
+		if (loan->free_cnt < LOAN_USABLE
+				|| (!force && borrower->free_cnt
+					< borrower->wmark_high + LOAN_USABLE)) {
+			e = list_next (e);
+			continue;
+		}
+		e = list_remove (e);
+		count_free (borrower, -(long) LOAN_USABLE);
+		bitmap_set_multiple (pool->used_map, page_idx, LOAN_PGCNT, false);
+		count_free (pool, LOAN_PGCNT);
+		recalled++;
+	}
+	pool->loan_cnt -= recalled;
+	pool->recall_cnt += recalled;
+	intr_set_level (old_level);
+	return recalled > 0;
+}
+
+/* Sets POOL's watermarks from its current number of free pages:
+   "min" at 1/64 of them, "low" and "high" a quarter and a half
+   above it. */
+static void
+init_watermarks (struct pool *pool) {
+	pool->free_cnt = bitmap_count (pool->used_map, 0,
+			bitmap_size (pool->used_map), false);
+	pool->wmark_min = pool->free_cnt / 64;
+	pool->wmark_low = pool->wmark_min + pool->wmark_min / 4;
+	pool->wmark_high = pool->wmark_min + pool->wmark_min / 2;
+	list_init (&pool->loans);
+}
+
+/* Adds DELTA to POOL's count of free pages.  The scheduler frees
+   dying threads' pages with interrupts off, where the pool lock
+   cannot be taken, so this disables interrupts instead. */
+static void
+count_free (struct pool *pool, long delta) {
+	enum intr_level old_level = intr_disable ();
+	pool->free_cnt += delta;
+	intr_set_level (old_level);
+}
+
+/* Allocation profiling.  Each pool remembers the call site of
+   each of its pages, whichever pool the page was allocated to,
+   so that pages freed one by one out of a larger run are still
+   taken off the right site. */
+
+/* Returns the slot in its pool's site array for PAGE. */
+static uint16_t *
+page_site (void *page) {
+	struct pool *pool = page_from_pool (&kernel_pool, page) ?
+		&kernel_pool : &user_pool;
+
+	ASSERT (page_from_pool (pool, page));
+	return &pool->sites[pg_no (page) - pg_no (pool->base)];
+}
+
+/* Records the allocation of the PAGE_CNT PAGES with FLAGS by the
+   call that returns to CALLER. */
+static void
+record_pages (enum palloc_flags flags, void *pages, size_t page_cnt,
+		void *caller) {
+	unsigned site = allocprof_alloc (caller,
+			flags & PAL_USER ? ALLOCPROF_UPAGE : ALLOCPROF_KPAGE,
+			PGSIZE * page_cnt);
+	size_t i;
+
+	for (i = 0; i < page_cnt; i++)
+		*page_site ((uint8_t *) pages + PGSIZE * i) = site;
+}
+
+/* Takes the PAGE_CNT PAGES off the sites that allocated them. */
+static void
+forget_pages (void *pages, size_t page_cnt) {
+	size_t i;
+
+	for (i = 0; i < page_cnt; i++) {
+		uint16_t *site = page_site ((uint8_t *) pages + PGSIZE * i);
+		allocprof_free (*site, PGSIZE);
+		*site = 0;
+	}
+}
+
+/* Prints statistics for POOL, called NAME. */
+static void
+print_pool_stats (const char *name, const struct pool *pool) {
+	printf ("%s pool: %zu of %zu pages free, watermarks %zu/%zu/%zu\n",
+			name, pool->free_cnt, bitmap_size (pool->used_map),
+			pool->wmark_min, pool->wmark_low, pool->wmark_high);
+	printf ("%s pool: %zu chunks on loan (peak %zu), "
+			"%lld lent, %lld taken back\n", name, pool->loan_cnt,
+			pool->loan_peak, pool->lend_cnt, pool->recall_cnt);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	struct list_elem *e;
+
+	print_pool_stats ("Kernel", &kernel_pool);
+	print_pool_stats ("User", &user_pool);
+	printf ("Reclaim: %lld direct, %lld background passes, "
+			"%lld pages shrunk\n", direct_cnt, background_cnt, shrunk_cnt);
+	for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+			e = list_next (e)) {
+		struct shrinker *s = list_entry (e, struct shrinker, elem);
+		printf ("Shrinker %s: %lld pages freed\n", s->name, s->freed);
+	}
+	printf ("Compaction: %lld of %lld runs succeeded, %lld pages migrated\n",
+			compact_ok_cnt, compact_cnt, migrate_cnt);
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
   /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+     Calculate the space needed for the bitmap and its summary,
+     which speeds up scans of a large pool,
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
-	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t bm_size = bitmap_buf_size (pgcnt);
+	size_t summary_size = bitmap_summary_buf_size (pgcnt);
+	size_t sites_size = allocprof_enabled ? pgcnt * sizeof *p->sites : 0;
+	size_t bm_pages = DIV_ROUND_UP (bm_size + summary_size + sites_size,
+			PGSIZE) * PGSIZE;
 
 	lock_init(&p->lock);
-	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_size);
+	bitmap_summarize_in_buf (p->used_map, (uint8_t *) *bm_base + bm_size,
+			summary_size);
+	if (allocprof_enabled) {
+		p->sites = (void *) ((uint8_t *) *bm_base + bm_size + summary_size);
+		memset (p->sites, 0, sites_size);
+	}
 	p->base = (void *) start;
 
 	// Mark all to unusable.
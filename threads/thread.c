@@ -456,6 +456,9 @@ init_thread (struct thread *t, const char *name, int priority) {
 	t->nice = 0;
 	t->recent_cpu = 0;
 	list_init(&t->lock_list);
+#ifdef USERPROG
+	list_init (&t->children);
+#endif
 	list_push_front(&all_list, &t->all_list_elem);
 }
 
@@ -581,6 +584,11 @@ do_schedule(int status) {
 		struct thread *victim =
 			list_entry (list_pop_front (&destruction_req), struct thread, elem);
 		list_remove(&victim->all_list_elem);
+#ifdef VM
+		/* The reaper frees it along with its address space. */
+		if (vm_reap (victim))
+			continue;
+#endif
 		palloc_free_page(victim);
 	}
 	thread_current ()->status = status;
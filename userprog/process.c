@@ -13,6 +13,7 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -22,9 +23,21 @@
 #include "vm/vm.h"
 #endif
 
+/* Most words on a command line. */
+#define ARG_MAX 64
+
+/* What initd() starts from. */
+struct initd_args {
+	char *file_name;            /* Command line, in a page of its own. */
+	struct child *child;        /* Shared with the parent. */
+};
+
 static void process_cleanup (void);
 static bool load (const char *file_name, struct intr_frame *if_);
-static void initd (void *f_name);
+static bool push_arguments (struct intr_frame *if_, int argc, char *argv[]);
+static struct child *child_create (void);
+static void child_release (struct child *);
+static void initd (void *args_);
 static void __do_fork (void *);
 
 /* General process initializer for initd and other process. */
@@ -40,33 +53,57 @@ process_init (void) {
  * Notice that THIS SHOULD BE CALLED ONCE. */
 tid_t
 process_create_initd (const char *file_name) {
-	char *fn_copy;
+	struct initd_args *args;
+	struct child *child;
+	char name[sizeof thread_current ()->name];
 	tid_t tid;
 
+	args = malloc (sizeof *args);
+	if (args == NULL)
+		return TID_ERROR;
+
 	/* Make a copy of FILE_NAME.
 	 * Otherwise there's a race between the caller and load(). */
-	fn_copy = palloc_get_page (0);
-	if (fn_copy == NULL)
-		return TID_ERROR;
-	strlcpy (fn_copy, file_name, PGSIZE);
+	args->file_name = palloc_get_page (0);
+	args->child = child = child_create ();
+	if (args->file_name == NULL || child == NULL)
+		goto error;
+	strlcpy (args->file_name, file_name, PGSIZE);
+
+	/* The thread is named after the program, without its arguments. */
+	strlcpy (name, file_name, sizeof name);
+	name[strcspn (name, " ")] = '\0';
 
 	/* Create a new thread to execute FILE_NAME. */
-	tid = thread_create (file_name, PRI_DEFAULT, initd, fn_copy);
+	tid = thread_create (name, PRI_DEFAULT, initd, args);
 	if (tid == TID_ERROR)
-		palloc_free_page (fn_copy);
+		goto error;
+	child->tid = tid;
+	list_push_back (&thread_current ()->children, &child->elem);
 	return tid;
+
+error:
+	palloc_free_page (args->file_name);
+	free (child);
+	free (args);
+	return TID_ERROR;
 }
 
 /* A thread function that launches first user process. */
 static void
-initd (void *f_name) {
+initd (void *args_) {
+	struct initd_args *args = args_;
+	char *file_name = args->file_name;
+
+	thread_current ()->child = args->child;
+	free (args);
 #ifdef VM
 	supplemental_page_table_init (&thread_current ()->spt);
 #endif
 
 	process_init ();
 
-	if (process_exec (f_name) < 0)
+	if (process_exec (file_name) < 0)
 		PANIC("Fail to launch initd\n");
 	NOT_REACHED ();
 }
@@ -136,6 +173,14 @@ __do_fork (void *aux) {
 	process_activate (current);
 #ifdef VM
 	supplemental_page_table_init (&current->spt);
+	/* The child may share the parent's text pages, so it keeps the
+	 * executable from being written too, and reads the pages that the
+	 * parent has not read yet from its own handle. */
+	if (parent->exec_file != NULL) {
+		current->exec_file = file_duplicate (parent->exec_file);
+		if (current->exec_file == NULL)
+			goto error;
+	}
 	if (!supplemental_page_table_copy (&current->spt, &parent->spt))
 		goto error;
 #else
@@ -158,13 +203,26 @@ error:
 	thread_exit ();
 }
 
-/* Switch the current execution context to the f_name.
- * Returns -1 on fail. */
+/* Switch the current execution context to the f_name, a command
+ * line of words separated by spaces, the first of which names the
+ * program.  Frees F_NAME, a page.  Returns -1 on fail. */
 int
 process_exec (void *f_name) {
 	char *file_name = f_name;
+	char *argv[ARG_MAX], *token, *save_ptr;
+	int argc = 0;
 	bool success;
 
+	/* Split the command line into words, in place. */
+	for (token = strtok_r (file_name, " ", &save_ptr); token != NULL;
+			token = strtok_r (NULL, " ", &save_ptr)) {
+		if (argc == ARG_MAX) {
+			palloc_free_page (file_name);
+			return -1;
+		}
+		argv[argc++] = token;
+	}
+
 	/* We cannot use the intr_frame in the thread structure.
 	 * This is because when current thread rescheduled,
 	 * it stores the execution information to the member. */
@@ -175,9 +233,13 @@ process_exec (void *f_name) {
 
 	/* We first kill the current context */
 	process_cleanup ();
+#ifdef VM
+	supplemental_page_table_init (&thread_current ()->spt);
+#endif
 
 	/* And then load the binary */
-	success = load (file_name, &_if);
+	success = argc > 0 && load (argv[0], &_if)
+		&& push_arguments (&_if, argc, argv);
 
 	/* If load failed, quit. */
 	palloc_free_page (file_name);
@@ -195,15 +257,25 @@ process_exec (void *f_name) {
  * exception), returns -1.  If TID is invalid or if it was not a
  * child of the calling process, or if process_wait() has already
  * been successfully called for the given TID, returns -1
- * immediately, without waiting.
- *
- * This function will be implemented in problem 2-2.  For now, it
- * does nothing. */
+ * immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) {
-	/* XXX: Hint) The pintos exit if process_wait (initd), we recommend you
-	 * XXX:       to add infinite loop here before
-	 * XXX:       implementing the process_wait. */
+process_wait (tid_t child_tid) {
+	struct list *children = &thread_current ()->children;
+	struct list_elem *e;
+
+	for (e = list_begin (children); e != list_end (children);
+			e = list_next (e)) {
+		struct child *c = list_entry (e, struct child, elem);
+		int status;
+
+		if (c->tid != child_tid)
+			continue;
+		list_remove (e);
+		sema_down (&c->exited);
+		status = c->exit_status;
+		child_release (c);
+		return status;
+	}
 	return -1;
 }
 
@@ -211,11 +283,33 @@ process_wait (tid_t child_tid UNUSED) {
 void
 process_exit (void) {
 	struct thread *curr = thread_current ();
-	/* TODO: Your code goes here.
-	 * TODO: Implement process termination message (see
-	 * TODO: project2/process_termination.html).
-	 * TODO: We recommend you to implement process resource cleanup here. */
 
+	/* Only user processes, which have a parent to tell, say they are
+	 * leaving; kernel threads with an address space of their own do
+	 * not. */
+	if (curr->child != NULL)
+		printf ("%s: exit(%d)\n", curr->name, curr->child->exit_status);
+
+	if (curr->fds != NULL) {
+		for (int fd = 0; fd < FD_MAX; fd++)
+			file_close (curr->fds[fd]);
+		free (curr->fds);
+		curr->fds = NULL;
+	}
+	while (!list_empty (&curr->children))
+		child_release (list_entry (list_pop_front (&curr->children),
+					struct child, elem));
+	if (curr->child != NULL) {
+		sema_up (&curr->child->exited);
+		child_release (curr->child);
+		curr->child = NULL;
+	}
+
+#ifdef VM
+	/* The reaper tears the address space down once we are gone. */
+	if (vm_reap_later ())
+		return;
+#endif
 	process_cleanup ();
 }
 
@@ -226,6 +320,8 @@ process_cleanup (void) {
 
 #ifdef VM
 	supplemental_page_table_kill (&curr->spt);
+	file_close (curr->exec_file);
+	curr->exec_file = NULL;
 #endif
 
 	uint64_t *pml4;
@@ -246,6 +342,78 @@ process_cleanup (void) {
 	}
 }
 
+/* Returns a record of a new child process for its parent, who owns
+ * one reference to it, the child owning the other.  Returns a null
+ * pointer if memory runs out. */
+static struct child *
+child_create (void) {
+	struct child *c = malloc (sizeof *c);
+
+	if (c != NULL) {
+		c->tid = TID_ERROR;
+		c->exit_status = -1;
+		sema_init (&c->exited, 0);
+		c->ref_cnt = 2;
+	}
+	return c;
+}
+
+/* Drops the parent's or the child's reference to C, and frees C once
+ * both are gone. */
+static void
+child_release (struct child *c) {
+	enum intr_level old_level;
+	bool last;
+
+	old_level = intr_disable ();
+	last = --c->ref_cnt == 0;
+	intr_set_level (old_level);
+	if (last)
+		free (c);
+}
+
+/* Returns file descriptor FD of the running process, or a null
+ * pointer if it is not open.  The console's descriptors are never
+ * open in this sense. */
+struct file *
+process_get_file (int fd) {
+	struct thread *curr = thread_current ();
+
+	if (fd < 2 || fd >= FD_MAX || curr->fds == NULL)
+		return NULL;
+	return curr->fds[fd];
+}
+
+/* Gives FILE the lowest free descriptor of the running process and
+ * returns it, or returns -1 and closes FILE if there is none. */
+int
+process_add_file (struct file *file) {
+	struct thread *curr = thread_current ();
+
+	if (curr->fds == NULL)
+		curr->fds = calloc (FD_MAX, sizeof *curr->fds);
+	if (curr->fds != NULL)
+		for (int fd = 2; fd < FD_MAX; fd++)
+			if (curr->fds[fd] == NULL) {
+				curr->fds[fd] = file;
+				return fd;
+			}
+	file_close (file);
+	return -1;
+}
+
+/* Closes file descriptor FD of the running process, if it is
+ * open. */
+void
+process_close_file (int fd) {
+	struct file *file = process_get_file (fd);
+
+	if (file != NULL) {
+		file_close (file);
+		thread_current ()->fds[fd] = NULL;
+	}
+}
+
 /* Sets up the CPU for running user code in the nest thread.
  * This function is called on every context switch. */
 void
@@ -341,6 +509,10 @@ load (const char *file_name, struct intr_frame *if_) {
 		printf ("load: %s: open failed\n", file_name);
 		goto done;
 	}
+	/* Keep the executable from changing while it runs, which also
+	 * keeps its shared text pages good.  Closing it allows writes
+	 * again. */
+	file_deny_write (file);
 
 	/* Read and verify executable header. */
 	if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -414,18 +586,65 @@ load (const char *file_name, struct intr_frame *if_) {
 	/* Start address. */
 	if_->rip = ehdr.e_entry;
 
-	/* TODO: Your code goes here.
-	 * TODO: Implement argument passing (see project2/argument_passing.html). */
-
 	success = true;
 
 done:
 	/* We arrive here whether the load is successful or not. */
+#ifdef VM
+	/* Segments are read in lazily, so keep the file open until the
+	 * process exits. */
+	if (success) {
+		t->exec_file = file;
+		file = NULL;
+	}
+#endif
 	file_close (file);
 	return success;
 }
 
 
+/* Pushes the ARGC words in ARGV onto the user stack that IF_ has
+ * just been set up with, and passes them to the program's entry
+ * point: the strings, then argv[] after padding to a word, ending in
+ * a null pointer, then a fake return address, with argc in RDI and
+ * argv in RSI.  Fails if they do not fit in the stack's first page,
+ * the only one there is yet. */
+static bool
+push_arguments (struct intr_frame *if_, int argc, char *argv[]) {
+	uint8_t *rsp = (uint8_t *) if_->rsp;
+	char *uargv[ARG_MAX];
+	size_t size = 0;
+	int i;
+
+	for (i = 0; i < argc; i++)
+		size += strlen (argv[i]) + 1;
+	if (ROUND_UP (size, sizeof (char *)) + (argc + 2) * sizeof (char *)
+			> PGSIZE)
+		return false;
+
+	for (i = argc - 1; i >= 0; i--) {
+		size_t len = strlen (argv[i]) + 1;
+
+		rsp -= len;
+		memcpy (rsp, argv[i], len);
+		uargv[i] = (char *) rsp;
+	}
+	rsp = (uint8_t *) ROUND_DOWN ((uint64_t) rsp, sizeof (char *));
+	rsp -= sizeof (char *);
+	*(char **) rsp = NULL;
+	for (i = argc - 1; i >= 0; i--) {
+		rsp -= sizeof (char *);
+		*(char **) rsp = uargv[i];
+	}
+	if_->R.rdi = argc;
+	if_->R.rsi = (uint64_t) rsp;
+
+	rsp -= sizeof (void *);
+	*(void **) rsp = NULL;
+	if_->rsp = (uint64_t) rsp;
+	return true;
+}
+
 /* Checks whether PHDR describes a valid, loadable segment in
  * FILE and returns true if so, false otherwise. */
 static bool
@@ -574,13 +793,6 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
-static bool
-lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
-}
-
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
  * memory are initialized, as follows:
@@ -609,15 +821,29 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
-			return false;
+		if (page_read_bytes == 0) {
+			/* Nothing to read: a plain zero-filled page, which
+			 * may end up in a huge page. */
+			if (!vm_alloc_page (VM_ANON, upage, writable))
+				return false;
+		} else {
+			struct file_load_aux *aux = malloc (sizeof *aux);
+			if (aux == NULL)
+				return false;
+			aux->file = file;
+			aux->ofs = ofs;
+			aux->read_bytes = page_read_bytes;
+			if (!vm_alloc_page_with_initializer (VM_ANON, upage,
+						writable, file_load_page, aux)) {
+				free (aux);
+				return false;
+			}
+		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
+		ofs += page_read_bytes;
 		upage += PGSIZE;
 	}
 	return true;
@@ -629,11 +855,11 @@ setup_stack (struct intr_frame *if_) {
 	bool success = false;
 	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
-
+	if (vm_alloc_page (VM_ANON | VM_STACK, stack_bottom, true)
+			&& vm_claim_page (stack_bottom)) {
+		if_->rsp = USER_STACK;
+		success = true;
+	}
 	return success;
 }
 #endif /* VM */
@@ -1,15 +1,30 @@
 #include "userprog/syscall.h"
+#include <mman.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "devices/input.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/loader.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/faultstat.h"
+#include "vm/frame.h"
+#endif
 #include "userprog/gdt.h"
+#include "userprog/process.h"
 #include "threads/flags.h"
 #include "intrinsic.h"
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
+static void exit_process (int status) NO_RETURN;
 
 /* System call.
  *
@@ -37,10 +52,259 @@ syscall_init (void) {
 			FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
 }
 
-/* The main system call interface */
-void
-syscall_handler (struct intr_frame *f UNUSED) {
-	// TODO: Your implementation goes here.
-	printf ("system call!\n");
+/* Returns true if the page at VA is part of the running process's
+ * address space, and writable if WRITE is true. */
+static bool
+user_page_ok (const void *va, bool write) {
+	struct thread *t = thread_current ();
+#ifdef VM
+	struct page *page;
+	bool ok;
+
+	lock_acquire (&t->spt.lock);
+	page = spt_find_page (&t->spt, (void *) va);
+	ok = page != NULL && (page->writable || !write);
+	lock_release (&t->spt.lock);
+	return ok;
+#else
+	uint64_t *pte = pml4e_walk (t->pml4, (uint64_t) va, 0);
+
+	return pte != NULL && (*pte & PTE_P) && (*pte & PTE_U)
+		&& ((*pte & PTE_W) || !write);
+#endif
+}
+
+/* Kills the running process unless the SIZE bytes at UADDR lie in
+ * pages of its address space, that it may write to if WRITE is
+ * true. */
+static void
+check_user (const void *uaddr, size_t size, bool write) {
+	const uint8_t *start = uaddr, *last = start + size - 1;
+	const uint8_t *va;
+
+	if (size == 0)
+		return;
+	if (last < start || !is_user_vaddr (last))
+		thread_exit ();
+	for (va = pg_round_down (start); va <= last; va += PGSIZE)
+		if (!user_page_ok (va, write))
+			thread_exit ();
+}
+
+/* Kills the running process unless USTR is a null-terminated string
+ * in its address space. */
+static void
+check_user_string (const char *ustr) {
+	const char *p = ustr;
+
+	do {
+		if (!is_user_vaddr (p) || !user_page_ok (p, false))
+			thread_exit ();
+		while (*p != '\0' && pg_ofs (p + 1) != 0)
+			p++;
+	} while (*p++ != '\0');
+}
+
+/* Reads up to SIZE bytes from FILE into user BUFFER, which
+ * check_user() has been through, and returns how many it read.  The
+ * data goes through a kernel page, since the disk driver must not
+ * fault on BUFFER while it holds the disk, which the fault may need
+ * to read the page in. */
+static int
+read_file (struct file *file, uint8_t *buffer, size_t size) {
+	uint8_t *bounce = palloc_get_page (0);
+	size_t done = 0;
+
+	if (bounce == NULL)
+		return -1;
+	while (done < size) {
+		size_t chunk = size - done < PGSIZE ? size - done : PGSIZE;
+		off_t n = file_read (file, bounce, chunk);
+
+		memcpy (buffer + done, bounce, n);
+		done += n;
+		if ((size_t) n < chunk)
+			break;
+	}
+	palloc_free_page (bounce);
+	return done;
+}
+
+/* Writes SIZE bytes of user BUFFER to FILE, as read_file() reads,
+ * and returns how many it wrote. */
+static int
+write_file (struct file *file, const uint8_t *buffer, size_t size) {
+	uint8_t *bounce = palloc_get_page (0);
+	size_t done = 0;
+
+	if (bounce == NULL)
+		return -1;
+	while (done < size) {
+		size_t chunk = size - done < PGSIZE ? size - done : PGSIZE;
+		off_t n;
+
+		memcpy (bounce, buffer + done, chunk);
+		n = file_write (file, bounce, chunk);
+		done += n;
+		if ((size_t) n < chunk)
+			break;
+	}
+	palloc_free_page (bounce);
+	return done;
+}
+
+/* Ends the running process with STATUS. */
+static void
+exit_process (int status) {
+	struct thread *t = thread_current ();
+
+	if (t->child != NULL)
+		t->child->exit_status = status;
 	thread_exit ();
 }
+
+#ifdef VM
+/* Returns the thread of process PID, as memstat() and faultstat()
+ * take it. */
+static tid_t
+stat_tid (uint64_t pid) {
+	return (int) pid == MEMSTAT_SELF ? thread_current ()->tid : (tid_t) pid;
+}
+
+/* Reports same-page merging in *GET and tunes it as *SET says, as
+ * ksmctl() asks.  Either may be a null pointer. */
+static void
+ksmctl (const struct ksm_info *set, struct ksm_info *get) {
+	struct ksm_info params;
+
+	if (set != NULL) {
+		check_user (set, sizeof *set, false);
+		params = *set;
+	}
+	if (get != NULL)
+		check_user (get, sizeof *get, true);
+	ksm_control (set != NULL ? &params : NULL, get);
+}
+
+/* Maps LENGTH bytes of the file open as FD at ADDR, as mmap() asks.
+ * Returns ADDR, or a null pointer if FD is not an open file or
+ * do_mmap() turns the mapping down. */
+static void *
+mmap_fd (void *addr, size_t length, int writable, int fd, off_t offset) {
+	struct file *file = process_get_file (fd);
+
+	if (file == NULL)
+		return NULL;
+	return do_mmap (addr, length, writable, file, offset);
+}
+#endif
+
+/* The main system call interface
+ *
+ * The number is in %rax, and the arguments in %rdi, %rsi, %rdx, %r10,
+ * %r8 and %r9, in that order; the result goes back in %rax.  Pointers
+ * passed in are checked before they are used, and a process that
+ * passes a bad one is killed. */
+void
+syscall_handler (struct intr_frame *f) {
+	struct file *file;
+
+	switch (f->R.rax) {
+		case SYS_HALT:
+			power_off ();
+		case SYS_EXIT:
+			exit_process (f->R.rdi);
+		case SYS_WAIT:
+			f->R.rax = process_wait (f->R.rdi);
+			return;
+		case SYS_CREATE:
+			check_user_string ((const char *) f->R.rdi);
+			f->R.rax = filesys_create ((const char *) f->R.rdi, f->R.rsi);
+			return;
+		case SYS_REMOVE:
+			check_user_string ((const char *) f->R.rdi);
+			f->R.rax = filesys_remove ((const char *) f->R.rdi);
+			return;
+		case SYS_OPEN:
+			check_user_string ((const char *) f->R.rdi);
+			file = filesys_open ((const char *) f->R.rdi);
+			f->R.rax = file != NULL ? process_add_file (file) : -1;
+			return;
+		case SYS_FILESIZE:
+			file = process_get_file (f->R.rdi);
+			f->R.rax = file != NULL ? file_length (file) : -1;
+			return;
+		case SYS_READ:
+			check_user ((void *) f->R.rsi, (unsigned) f->R.rdx, true);
+			if ((int) f->R.rdi == STDIN_FILENO) {
+				uint8_t *buffer = (uint8_t *) f->R.rsi;
+
+				for (unsigned i = 0; i < (unsigned) f->R.rdx; i++)
+					buffer[i] = input_getc ();
+				f->R.rax = (unsigned) f->R.rdx;
+			} else if ((file = process_get_file (f->R.rdi)) != NULL)
+				f->R.rax = read_file (file, (uint8_t *) f->R.rsi,
+						(unsigned) f->R.rdx);
+			else
+				f->R.rax = -1;
+			return;
+		case SYS_WRITE:
+			check_user ((void *) f->R.rsi, (unsigned) f->R.rdx, false);
+			if ((int) f->R.rdi == STDOUT_FILENO) {
+				putbuf ((const char *) f->R.rsi, (unsigned) f->R.rdx);
+				f->R.rax = (unsigned) f->R.rdx;
+			} else if ((file = process_get_file (f->R.rdi)) != NULL)
+				f->R.rax = write_file (file, (const uint8_t *) f->R.rsi,
+						(unsigned) f->R.rdx);
+			else
+				f->R.rax = -1;
+			return;
+		case SYS_SEEK:
+			file = process_get_file (f->R.rdi);
+			if (file != NULL)
+				file_seek (file, (unsigned) f->R.rsi);
+			return;
+		case SYS_TELL:
+			file = process_get_file (f->R.rdi);
+			f->R.rax = file != NULL ? file_tell (file) : 0;
+			return;
+		case SYS_CLOSE:
+			process_close_file (f->R.rdi);
+			return;
+#ifdef VM
+		case SYS_MMAP:
+			f->R.rax = (uint64_t) mmap_fd ((void *) f->R.rdi, f->R.rsi,
+					f->R.rdx, f->R.r10, f->R.r8);
+			return;
+		case SYS_MADVISE:
+			f->R.rax = vm_madvise ((void *) f->R.rdi, f->R.rsi, f->R.rdx)
+				? 0 : -1;
+			return;
+		case SYS_MUNMAP:
+			do_munmap ((void *) f->R.rdi);
+			return;
+		case SYS_MSYNC:
+			f->R.rax = do_msync ((void *) f->R.rdi, f->R.rsi, f->R.rdx)
+				? 0 : -1;
+			return;
+		case SYS_MEMSTAT:
+			check_user ((void *) f->R.rsi, sizeof (struct memstat), true);
+			f->R.rax = vm_memstat (stat_tid (f->R.rdi),
+					(struct memstat *) f->R.rsi);
+			return;
+		case SYS_FAULTSTAT:
+			check_user ((void *) f->R.rsi, sizeof (struct faultstat), true);
+			f->R.rax = faultstat_get (stat_tid (f->R.rdi),
+					(struct faultstat *) f->R.rsi);
+			return;
+		case SYS_KSMCTL:
+			ksmctl ((const struct ksm_info *) f->R.rdi,
+					(struct ksm_info *) f->R.rsi);
+			return;
+#endif
+		default:
+			// TODO: Your implementation goes here.
+			printf ("system call!\n");
+			thread_exit ();
+	}
+}
@@ -1,7 +1,28 @@
-/* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
+/* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page).
+ *
+ * Anonymous pages are swapped out to slots of the swap disk, see
+ * swap.c.  A page keeps its slot after it is swapped back in, as long
+ * as the copy in it stays good, so that evicting the page again, if
+ * it was not written in the meantime, costs no I/O.
+ *
+ * Pages that go out all zeros are only marked as such.  Others are
+ * offered to the compressed pool in front of the disk first, if
+ * there is one, see zswap.c. */
 
+#include <stdio.h>
+#include <string.h>
 #include "vm/vm.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Statistics. */
+static long long zero_out_cnt;      /* Zero pages swapped out... */
+static long long zero_in_cnt;       /* ...and back in. */
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -20,33 +41,252 @@ static const struct page_operations anon_ops = {
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get (1, 1);
+	swap_init (swap_disk);
+	zswap_init ();
+}
+
+/* Drops PAGE's copy in swap, if it has one. */
+static void
+drop_copy (struct anon_page *anon_page) {
+	if (anon_page->slot != SWAP_SLOT_NONE) {
+		swap_free (anon_page->slot);
+		anon_page->slot = SWAP_SLOT_NONE;
+	}
+}
+
+/* Forgets the copy in swap of PAGE, an anonymous page, for a caller
+ * that is about to lose track of whether the page was written, by
+ * mapping it afresh. */
+void
+anon_forget_copy (struct page *page) {
+	drop_copy (&page->anon);
+}
+
+/* Returns true if the swap disk holds a copy of PAGE, an anonymous
+ * page, that was taken after its last write through the owner's
+ * page table. */
+bool
+anon_has_copy (struct page *page) {
+	return page->anon.slot != SWAP_SLOT_NONE;
+}
+
+/* Makes COPY, an anonymous page that holds the same contents as PAGE
+ * but is not in memory, share whatever PAGE's contents are swapped
+ * out to, in place of any copy in swap of its own.  Used for the
+ * copies of a page after a fork, and for the pages that shared a
+ * frame that was just evicted. */
+void
+anon_share_copy (struct page *page, struct page *copy) {
+	const struct anon_page *from = &page->anon;
+	struct anon_page *to = &copy->anon;
+
+	ASSERT (VM_TYPE (page->operations->type) == VM_ANON);
+	ASSERT (copy->frame == NULL && to->zentry == NULL);
+
+	drop_copy (to);
+	to->slot = from->slot;
+	if (to->slot != SWAP_SLOT_NONE)
+		swap_dup (to->slot);
+	to->zentry = from->zentry;
+	if (to->zentry != NULL)
+		zswap_dup (to->zentry);
+	to->zero = from->zero;
+}
+
+/* Makes PAGE an anonymous page without touching its contents, which
+ * are in place already, as for a page that shares a frame that was
+ * read in for another. */
+void
+anon_adopt (struct page *page) {
+	page->operations = &anon_ops;
+	page->anon.slot = SWAP_SLOT_NONE;
+	page->anon.zentry = NULL;
+	page->anon.zero = false;
+	page->anon.exec = false;
+}
+
+/* Records that PAGE, an anonymous page, was read in from its owner's
+ * executable as LOAD says. */
+void
+anon_note_exec (struct page *page, const struct file_load_aux *load) {
+	page->anon.exec = true;
+	page->anon.exec_ofs = load->ofs;
+	page->anon.exec_bytes = load->read_bytes;
+}
+
+/* Returns new load parameters, for file_load_page(), that read PAGE
+ * in again from its owner's executable, or a null pointer if it was
+ * not read from there or memory runs out. */
+struct file_load_aux *
+anon_exec_load (struct page *page) {
+	struct file_load_aux *load;
+
+	if (!page->anon.exec || page->spt->owner->exec_file == NULL)
+		return NULL;
+	load = malloc (sizeof *load);
+	if (load != NULL)
+		*load = (struct file_load_aux) {
+			.file = page->spt->owner->exec_file,
+			.ofs = page->anon.exec_ofs,
+			.read_bytes = page->anon.exec_bytes,
+		};
+	return load;
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
+anon_initializer (struct page *page, enum vm_type type UNUSED, void *kva) {
 	/* Set up the handler */
-	page->operations = &anon_ops;
+	anon_adopt (page);
 
-	struct anon_page *anon_page = &page->anon;
+	/* Anonymous memory starts out zeroed.  An initializer, if any,
+	 * fills it in afterwards. */
+	memset (kva, 0, PGSIZE);
+	return true;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->zero) {
+		memset (kva, 0, PGSIZE);
+		anon_page->zero = false;
+		zero_in_cnt++;
+		return true;
+	}
+	if (anon_page->zentry != NULL) {
+		/* A page written back from the pool keeps its slot, like any
+		 * other page read from swap. */
+		anon_page->slot = zswap_load (anon_page->zentry, kva);
+		anon_page->zentry = NULL;
+		if (anon_page->slot == SWAP_SLOT_NONE)
+			return true;
+	}
+	if (anon_page->slot == SWAP_SLOT_NONE)
+		return false;
+	swap_read (anon_page->slot, kva);
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	return anon_swap_out_batch (&page, 1);
+}
+
+/* Returns true if all of KPAGE is zero. */
+static bool
+page_is_zero (const void *kpage) {
+	const uint64_t *p = kpage;
+
+	for (size_t i = 0; i < PGSIZE / sizeof *p; i++)
+		if (p[i] != 0)
+			return false;
+	return true;
+}
+
+/* Swaps out the CNT anonymous pages in PAGES, which the caller has
+ * unmapped; their page table entries still hold their dirty bits.
+ * Pages whose copies in swap are still good are not written.  Of the
+ * others, zero pages are only marked, and the rest go to the
+ * compressed pool if it takes them, or else to consecutive slots of
+ * the disk in as few batches as swap space allows.  Returns true if
+ * successful, false if swap space ran out, in which case no page was
+ * swapped out. */
+bool
+anon_swap_out_batch (struct page *pages[], size_t cnt) {
+	struct page *writes[SWAP_BATCH_MAX], *keeps[SWAP_BATCH_MAX];
+	struct page *stores[SWAP_BATCH_MAX], *zeros[SWAP_BATCH_MAX];
+	struct zswap_entry *zentries[SWAP_BATCH_MAX];
+	void *kpages[SWAP_BATCH_MAX];
+	size_t slots[SWAP_BATCH_MAX];
+	size_t write_cnt = 0, keep_cnt = 0, store_cnt = 0, zero_cnt = 0;
+	size_t done, run, i;
+
+	ASSERT (cnt <= SWAP_BATCH_MAX);
+
+	for (i = 0; i < cnt; i++) {
+		struct page *page = pages[i];
+		void *kva = page->frame->kva;
+
+		if (page->anon.slot != SWAP_SLOT_NONE
+				&& !pml4_is_dirty (page->spt->owner->pml4, page->va))
+			keeps[keep_cnt++] = page;
+		else if (page_is_zero (kva))
+			zeros[zero_cnt++] = page;
+		else if ((zentries[store_cnt] = zswap_store (kva)) != NULL)
+			stores[store_cnt++] = page;
+		else {
+			writes[write_cnt] = page;
+			kpages[write_cnt++] = kva;
+		}
+	}
+
+	/* Find room for all of them before writing any.  Ask for one run,
+	 * then for smaller ones if swap is too fragmented for it. */
+	for (done = 0, run = write_cnt; done < write_cnt; ) {
+		size_t slot;
+
+		if (run > write_cnt - done)
+			run = write_cnt - done;
+		slot = swap_alloc (run);
+		if (slot != SWAP_SLOT_NONE) {
+			for (i = 0; i < run; i++)
+				slots[done + i] = slot + i;
+			done += run;
+		} else if (run > 1)
+			run /= 2;
+		else {
+			while (done-- > 0)
+				swap_free (slots[done]);
+			for (i = 0; i < store_cnt; i++)
+				zswap_invalidate (zentries[i]);
+			return false;
+		}
+	}
+
+	for (i = 0; i < write_cnt; i = done) {
+		for (done = i + 1; done < write_cnt
+				&& slots[done] == slots[done - 1] + 1; done++)
+			continue;
+		swap_write (slots[i], kpages + i, done - i);
+	}
+	for (i = 0; i < write_cnt; i++) {
+		drop_copy (&writes[i]->anon);
+		writes[i]->anon.slot = slots[i];
+	}
+	for (i = 0; i < store_cnt; i++) {
+		drop_copy (&stores[i]->anon);
+		stores[i]->anon.zentry = zentries[i];
+	}
+	for (i = 0; i < zero_cnt; i++) {
+		drop_copy (&zeros[i]->anon);
+		zeros[i]->anon.zero = true;
+	}
+	zero_out_cnt += zero_cnt;
+	for (i = 0; i < keep_cnt; i++)
+		swap_evicted (keeps[i]->anon.slot);
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	vm_free_frame (page);
+	drop_copy (&page->anon);
+	if (page->anon.zentry != NULL) {
+		zswap_invalidate (page->anon.zentry);
+		page->anon.zentry = NULL;
+	}
+	page->anon.zero = false;
+}
+
+/* Prints statistics on anonymous pages. */
+void
+anon_print_stats (void) {
+	printf ("Anonymous pages: %lld zero pages swapped out, %lld back in\n",
+			zero_out_cnt, zero_in_cnt);
 }
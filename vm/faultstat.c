@@ -0,0 +1,115 @@
+/* faultstat.c: Page fault statistics.
+ *
+ * vm_try_handle_fault() puts every fault down to one of the causes
+ * in <mman.h> and records it here, along with the CPU cycles that it
+ * took to handle, from the handler's entry to its return.  The
+ * cycles go into a histogram for the cause with one bucket per power
+ * of two, so that the few faults that wait for a disk stand out from
+ * the many that do not.  Each table also counts its own faults by
+ * cause.  faultstat() hands both out to user programs. */
+
+#include "vm/faultstat.h"
+#include <mman.h>
+#include <stdio.h>
+#include <string.h>
+#include "vm/vm.h"
+
+/* Names of the causes, for printing. */
+static const char *cause_names[FAULT_CAUSE_CNT] = {
+	[FAULT_LAZY] = "lazy load",
+	[FAULT_ZERO] = "zero-fill",
+	[FAULT_SWAP] = "swap-in",
+	[FAULT_COW] = "copy-on-write",
+	[FAULT_STACK] = "stack growth",
+	[FAULT_FILE] = "file-backed",
+	[FAULT_MINOR] = "remap",
+	[FAULT_BAD] = "unhandled",
+};
+
+/* Everyone's faults by cause. */
+static long long fault_cnt[FAULT_CAUSE_CNT];
+static unsigned long long fault_cycles[FAULT_CAUSE_CNT];
+static uint64_t fault_max[FAULT_CAUSE_CNT];
+static long long fault_hist[FAULT_CAUSE_CNT][FAULT_HIST_BUCKETS];
+
+/* Returns the histogram bucket for a fault that took CYCLES. */
+static size_t
+hist_bucket (uint64_t cycles) {
+	size_t bucket = 63 - __builtin_clzll (cycles | 1);
+
+	return bucket < FAULT_HIST_BUCKETS ? bucket : FAULT_HIST_BUCKETS - 1;
+}
+
+/* Records a fault of CAUSE in SPT that took CYCLES to handle.  SPT
+ * may belong to no process, for a fault in a kernel thread. */
+void
+faultstat_record (struct supplemental_page_table *spt, int cause,
+		uint64_t cycles) {
+	ASSERT (cause >= 0 && cause < FAULT_CAUSE_CNT);
+
+	if (spt->owner != NULL)
+		spt->fault_causes[cause]++;
+	fault_cnt[cause]++;
+	fault_cycles[cause] += cycles;
+	if (cycles > fault_max[cause])
+		fault_max[cause] = cycles;
+	fault_hist[cause][hist_bucket (cycles)]++;
+}
+
+/* What faultstat_get() looks for and fills in. */
+struct proc_query {
+	tid_t tid;                          /* Thread to look for. */
+	long long cnt[FAULT_CAUSE_CNT];     /* Its faults by cause. */
+	bool found;                         /* Was it found? */
+};
+
+/* Fills in QUERY_, a struct proc_query, from SPT if SPT belongs to
+ * the thread that QUERY_ asks about. */
+static void
+query_spt (struct supplemental_page_table *spt, void *query_) {
+	struct proc_query *query = query_;
+
+	if (spt->owner->tid != query->tid || spt->dying)
+		return;
+	memcpy (query->cnt, spt->fault_causes, sizeof query->cnt);
+	query->found = true;
+}
+
+/* Fills in *ST with the faults of the process whose thread is TID
+ * and of everyone, for faultstat().  Returns false if there is no
+ * such process.  ST may be in user memory: it is written to with no
+ * table locked. */
+bool
+faultstat_get (tid_t tid, struct faultstat *st) {
+	struct proc_query query = { .tid = tid, .found = false };
+
+	spt_for_each (query_spt, &query);
+	if (!query.found)
+		return false;
+	memcpy (st->proc_cnt, query.cnt, sizeof st->proc_cnt);
+	memcpy (st->cnt, fault_cnt, sizeof st->cnt);
+	memcpy (st->cycles, fault_cycles, sizeof st->cycles);
+	memcpy (st->hist, fault_hist, sizeof st->hist);
+	return true;
+}
+
+/* Prints page fault statistics: for each cause, the count, the
+ * average and worst cycles, and the nonempty buckets of the
+ * histogram. */
+void
+faultstat_print_stats (void) {
+	for (int cause = 0; cause < FAULT_CAUSE_CNT; cause++) {
+		long long cnt = fault_cnt[cause];
+
+		if (cnt == 0)
+			continue;
+		printf ("Faults (%s): %lld, %llu cycles on average, at most %llu\n",
+				cause_names[cause], cnt, fault_cycles[cause] / cnt,
+				(unsigned long long) fault_max[cause]);
+		printf ("Faults (%s): cycles", cause_names[cause]);
+		for (size_t b = 0; b < FAULT_HIST_BUCKETS; b++)
+			if (fault_hist[cause][b] != 0)
+				printf (" 2^%zu:%lld", b, fault_hist[cause][b]);
+		printf ("\n");
+	}
+}
@@ -1,7 +1,75 @@
-/* file.c: Implementation of memory backed file object (mmaped object). */
+/* file.c: Implementation of memory backed file object (mmaped object).
+ *
+ * do_mmap() maps a file page by page, lazily: each page is read in
+ * on its first fault, like a page of an executable, and may be read
+ * in around another one's fault.  A mapping holds a file of its own,
+ * reopened, so that closing the original does not unmap it.
+ *
+ * Only the pages that were written to go back to the file, as the
+ * dirty bits of their page table entries tell: a clean page is just
+ * dropped when it is evicted or unmapped.  munmap(), msync() and
+ * kflushd, which goes over every mapping when msync() or kswapd asks
+ * it to and every flush_interval_ms, write back whole mappings or
+ * ranges of them, and write each run of consecutive dirty pages
+ * with a single file_write_at(), by way of a bounce buffer of up to
+ * WRITEBACK_MAX pages.  A dirty bit is cleared before its page is
+ * copied out, so that a write racing with the copy leaves the page
+ * dirty for the next pass. */
 
+#include <mman.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 
+/* Most pages written back with one file_write_at(). */
+#define WRITEBACK_MAX 16
+
+/* A file mapping made by do_mmap(). */
+struct mmap_region {
+	struct list_elem elem;      /* Element in spt->mmaps. */
+	uint8_t *start;             /* First page. */
+	uint8_t *end;               /* Page past the last. */
+	struct file *file;          /* Reopened for the mapping. */
+};
+
+/* A run of dirty pages gathered for writeback: pages at consecutive
+ * addresses and consecutive offsets of one file. */
+struct writeback_run {
+	uint64_t *pml4;             /* Page table of the pages' owner. */
+	struct page *pages[WRITEBACK_MAX];
+	size_t cnt;
+};
+
+/* Bounce buffer for runs of more than one page, and its lock.  Taken
+ * with an SPT lock held, never the other way around. */
+static uint8_t *writeback_buf;
+static struct lock writeback_lock;
+
+unsigned flush_interval_ms = 5000;
+
+/* kflushd, upped to have it go over every mapping.  FLUSH_PENDING
+ * keeps it from being upped again before it starts the pass, and is
+ * guarded by disabling interrupts. */
+static struct semaphore flush_sema;
+static bool flush_pending;
+
+/* Statistics. */
+static long long map_cnt;           /* Mappings made. */
+static long long written_cnt;       /* Pages written back... */
+static long long write_cnt;         /* ...in this many writes. */
+static long long clean_cnt;         /* Clean pages dropped unwritten. */
+static long long flush_pass_cnt;    /* Passes of kflushd. */
+
+static thread_func kflushd;
+static thread_func flush_timer;
+
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
 static void file_backed_destroy (struct page *page);
@@ -17,42 +85,391 @@ static const struct page_operations file_ops = {
 /* The initializer of file vm */
 void
 vm_file_init (void) {
+	writeback_buf = palloc_get_multiple (PAL_ASSERT, WRITEBACK_MAX);
+	lock_init (&writeback_lock);
+	sema_init (&flush_sema, 0);
+	thread_create ("kflushd", PRI_DEFAULT, kflushd, NULL);
+	if (flush_interval_ms > 0)
+		thread_create ("kflush-timer", PRI_DEFAULT, flush_timer, NULL);
 }
 
-/* Initialize the file backed page */
+/* Initialize the file backed page.  Its initializer, file_load_page(),
+ * tells it where in the file it is. */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
+	page->file = (struct file_page) { .file = NULL };
+	return true;
+}
+
+/* Initializer of a page that is read in lazily from a file, with a
+ * struct file_load_aux as AUX, which it frees.  The pages of an
+ * executable's segments and of file mappings are loaded this way, and
+ * vm_try_handle_fault() recognizes them by it for fault-around.  A
+ * page keeps where it came from, to go back there: a page of a file
+ * mapping to be written back, a page of an executable to be read in
+ * again after MADV_DONTNEED. */
+bool
+file_load_page (struct page *page, void *aux) {
+	struct file_load_aux *load = aux;
+	void *kva = page->frame->kva;
+	bool success;
+
+	success = file_read_at (load->file, kva, load->read_bytes, load->ofs)
+		== (off_t) load->read_bytes;
+	memset (kva + load->read_bytes, 0, PGSIZE - load->read_bytes);
+	if (VM_TYPE (page->operations->type) == VM_FILE)
+		page->file = (struct file_page) {
+			.file = load->file,
+			.ofs = load->ofs,
+			.read_bytes = load->read_bytes,
+		};
+	else
+		anon_note_exec (page, load);
+	free (load);
+	return success;
+}
+
+/* Returns true if PAGE, a page of a file mapping that is in memory,
+ * was written to since it was last read in or written back. */
+static bool
+is_dirty (struct page *page) {
+	return pml4_is_dirty (page->spt->owner->pml4, page->va);
+}
+
+/* Writes PAGE, a page of a file mapping, back from KVA.  Returns
+ * true if successful. */
+static bool
+write_page (struct page *page, const void *kva) {
 	struct file_page *file_page = &page->file;
+
+	written_cnt++;
+	write_cnt++;
+	return file_write_at (file_page->file, kva, file_page->read_bytes,
+			file_page->ofs) == (off_t) file_page->read_bytes;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+	bool success;
+
+	success = file_read_at (file_page->file, kva, file_page->read_bytes,
+			file_page->ofs) == (off_t) file_page->read_bytes;
+	memset (kva + file_page->read_bytes, 0, PGSIZE - file_page->read_bytes);
+	return success;
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Swap out the page by writeback contents to the file, if it was
+ * written to.  The page is unmapped already. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	if (!is_dirty (page)) {
+		clean_cnt++;
+		return true;
+	}
+	pml4_set_dirty (page->spt->owner->pml4, page->va, false);
+	if (!write_page (page, page->frame->kva)) {
+		pml4_set_dirty (page->spt->owner->pml4, page->va, true);
+		return false;
+	}
+	return true;
 }
 
-/* Destory the file backed page. PAGE will be freed by the caller. */
+/* Destory the file backed page. PAGE will be freed by the caller.
+ * Writes it back first if it was written to. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	if (page->frame != NULL) {
+		if (is_dirty (page))
+			write_page (page, page->frame->kva);
+		else
+			clean_cnt++;
+	}
+	vm_free_frame (page);
+}
+
+/* Writes the pages gathered in RUN back to their file, with one
+ * write, and empties RUN.  The caller holds the pages' SPT lock. */
+static void
+flush_run (struct writeback_run *run) {
+	struct page *first = run->pages[0];
+	size_t bytes = 0, i;
+	bool success;
+
+	if (run->cnt == 0)
+		return;
+
+	/* A write from now on dirties the page again. */
+	for (i = 0; i < run->cnt; i++)
+		pml4_set_dirty (run->pml4, run->pages[i]->va, false);
+
+	if (run->cnt == 1)
+		success = write_page (first, first->frame->kva);
+	else {
+		lock_acquire (&writeback_lock);
+		for (i = 0; i < run->cnt; i++) {
+			struct page *p = run->pages[i];
+
+			memcpy (writeback_buf + bytes, p->frame->kva, p->file.read_bytes);
+			bytes += p->file.read_bytes;
+		}
+		success = file_write_at (first->file.file, writeback_buf, bytes,
+				first->file.ofs) == (off_t) bytes;
+		lock_release (&writeback_lock);
+		written_cnt += run->cnt;
+		write_cnt++;
+	}
+
+	if (!success)
+		for (i = 0; i < run->cnt; i++)
+			pml4_set_dirty (run->pml4, run->pages[i]->va, true);
+	run->cnt = 0;
+}
+
+/* Adds PAGE to RUN_, a struct writeback_run, if it is a dirty page of
+ * a file mapping, after writing back what RUN_ holds if PAGE does not
+ * continue it. */
+static void
+gather_dirty (struct page *page, void *run_) {
+	struct writeback_run *run = run_;
+	struct page *last;
+
+	if (VM_TYPE (page->operations->type) != VM_FILE || page->frame == NULL
+			|| page->file.read_bytes == 0 || !is_dirty (page))
+		return;
+
+	last = run->cnt > 0 ? run->pages[run->cnt - 1] : NULL;
+	if (last != NULL && (last->va + PGSIZE != page->va
+				|| last->file.file != page->file.file
+				|| last->file.ofs + PGSIZE != page->file.ofs
+				|| last->file.read_bytes != PGSIZE))
+		flush_run (run);
+	run->pages[run->cnt++] = page;
+	if (run->cnt == WRITEBACK_MAX)
+		flush_run (run);
+}
+
+/* Writes back the dirty pages of file mappings in SPT from START up
+ * to END.  The caller holds the SPT lock. */
+static void
+writeback (struct supplemental_page_table *spt, uint8_t *start,
+		uint8_t *end) {
+	struct writeback_run run = { .pml4 = spt->owner->pml4, .cnt = 0 };
+
+	spt_for_each_page (spt, start, end, gather_dirty, &run);
+	flush_run (&run);
 }
 
-/* Do the mmap */
+/* Do the mmap
+ *
+ * Maps LENGTH bytes of FILE from OFFSET on at ADDR, lazily, writable
+ * if WRITABLE is nonzero, and brings the pages in at once if MAP_POPULATE
+ * is or'd into WRITABLE.  Bytes past the end of the file read as
+ * zeros and are not written back.  Returns ADDR, or a null pointer if
+ * ADDR or OFFSET is not page-aligned, if the range is empty, leaves
+ * user space or overlaps existing pages, if FILE is empty, or if
+ * memory runs out. */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	bool populate = (writable & MAP_POPULATE) != 0;
+	struct mmap_region *region;
+	uint8_t *start, *end, *va;
+	off_t file_len;
+	bool free_range = true;
+
+	writable &= ~MAP_POPULATE;
+	if (addr == NULL || file == NULL || offset < 0 || offset % PGSIZE != 0
+			|| !vm_user_range (addr, length, &start, &end)
+			|| (file_len = file_length (file)) == 0)
+		return NULL;
+	lock_acquire (&spt->lock);
+	for (va = start; va < end && free_range; va += PGSIZE)
+		free_range = spt_find_page (spt, va) == NULL;
+	lock_release (&spt->lock);
+	if (!free_range)
+		return NULL;
+
+	region = malloc (sizeof *region);
+	if (region == NULL)
+		return NULL;
+	region->file = file_reopen (file);
+	if (region->file == NULL) {
+		free (region);
+		return NULL;
+	}
+	region->start = start;
+	region->end = end;
+
+	for (va = start; va < end; va += PGSIZE) {
+		off_t ofs = offset + (va - start);
+		struct file_load_aux *aux = malloc (sizeof *aux);
+
+		if (aux == NULL)
+			goto fail;
+		*aux = (struct file_load_aux) {
+			.file = region->file,
+			.ofs = ofs,
+			.read_bytes = ofs >= file_len ? 0
+				: file_len - ofs < PGSIZE ? (size_t) (file_len - ofs) : PGSIZE,
+		};
+		if (!vm_alloc_page_with_initializer (VM_FILE, va, writable,
+					file_load_page, aux)) {
+			free (aux);
+			goto fail;
+		}
+	}
+
+	lock_acquire (&spt->lock);
+	list_push_back (&spt->mmaps, &region->elem);
+	lock_release (&spt->lock);
+	map_cnt++;
+	if (populate)
+		vm_populate (start, end - start);
+	return addr;
+
+fail:
+	lock_acquire (&spt->lock);
+	spt_remove_range (spt, start, va);
+	lock_release (&spt->lock);
+	file_close (region->file);
+	free (region);
+	return NULL;
+}
+
+/* Writes back REGION, a mapping of SPT, and removes it.  The caller
+ * holds the SPT lock. */
+static void
+unmap_region (struct supplemental_page_table *spt,
+		struct mmap_region *region) {
+	writeback (spt, region->start, region->end);
+	list_remove (&region->elem);
+	spt_remove_range (spt, region->start, region->end);
+	file_close (region->file);
+	free (region);
 }
 
-/* Do the munmap */
+/* Do the munmap
+ *
+ * Removes the mapping that starts at ADDR, writing back the pages of
+ * it that were written to.  Does nothing if there is no such
+ * mapping. */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct list_elem *e;
+
+	lock_acquire (&spt->lock);
+	for (e = list_begin (&spt->mmaps); e != list_end (&spt->mmaps);
+			e = list_next (e)) {
+		struct mmap_region *region = list_entry (e, struct mmap_region, elem);
+
+		if (region->start == addr) {
+			unmap_region (spt, region);
+			break;
+		}
+	}
+	lock_release (&spt->lock);
+}
+
+/* Writes back the pages of file mappings among the LENGTH bytes from
+ * ADDR on that were written to, for msync().  With MS_SYNC in FLAGS,
+ * does so before returning; with MS_ASYNC, has kflushd do it for every
+ * mapping right away.  Returns false if ADDR is not page-aligned, the
+ * range leaves user space, or FLAGS are not one of the two. */
+bool
+do_msync (void *addr, size_t length, int flags) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *start, *end;
+
+	if (!vm_user_range (addr, length, &start, &end)
+			|| (flags != MS_SYNC && flags != MS_ASYNC))
+		return false;
+	if (flags == MS_ASYNC)
+		file_flush_async ();
+	else {
+		lock_acquire (&spt->lock);
+		writeback (spt, start, end);
+		lock_release (&spt->lock);
+	}
+	return true;
+}
+
+/* Removes every mapping of SPT, as it is destroyed.  The caller holds
+ * the SPT lock. */
+void
+file_unmap_all (struct supplemental_page_table *spt) {
+	while (!list_empty (&spt->mmaps))
+		unmap_region (spt, list_entry (list_front (&spt->mmaps),
+					struct mmap_region, elem));
+}
+
+/* Writes back the dirty pages of every mapping of SPT. */
+static void
+flush_spt (struct supplemental_page_table *spt, void *aux UNUSED) {
+	struct list_elem *e;
+
+	if (spt->owner->pml4 == NULL)
+		return;
+	for (e = list_begin (&spt->mmaps); e != list_end (&spt->mmaps);
+			e = list_next (e)) {
+		struct mmap_region *region = list_entry (e, struct mmap_region, elem);
+
+		writeback (spt, region->start, region->end);
+	}
+}
+
+/* Has kflushd write back the dirty pages of every file mapping, and
+ * returns without waiting for it. */
+void
+file_flush_async (void) {
+	enum intr_level old_level = intr_disable ();
+
+	if (!flush_pending) {
+		flush_pending = true;
+		sema_up (&flush_sema);
+	}
+	intr_set_level (old_level);
+}
+
+/* Background thread that writes back dirty pages of file mappings
+ * whenever it is asked to.  A request made during a pass gets a pass
+ * of its own. */
+static void
+kflushd (void *aux UNUSED) {
+	for (;;) {
+		enum intr_level old_level;
+
+		sema_down (&flush_sema);
+		old_level = intr_disable ();
+		flush_pending = false;
+		intr_set_level (old_level);
+
+		spt_for_each (flush_spt, NULL);
+		flush_pass_cnt++;
+	}
+}
+
+/* Background thread that asks kflushd for a pass every
+ * flush_interval_ms, for periodic writeback. */
+static void
+flush_timer (void *aux UNUSED) {
+	for (;;) {
+		timer_msleep (flush_interval_ms);
+		file_flush_async ();
+	}
+}
+
+/* Prints file mapping statistics. */
+void
+file_print_stats (void) {
+	printf ("Mmap: %lld mappings; %lld pages written back in %lld writes, "
+			"%lld clean pages dropped; %lld kflushd passes\n",
+			map_cnt, written_cnt, write_cnt, clean_cnt, flush_pass_cnt);
 }
@@ -0,0 +1,842 @@
+/* frame.c: The frame table.
+ *
+ * Maps the physical page number of every page that palloc can hand
+ * out to the struct frame that holds it, if any.  Code that works on
+ * physical memory uses it to find the page, and through the page the
+ * address space, that a frame belongs to.
+ *
+ * Compaction is the first such user.  palloc calls frame_migrate() to
+ * move a user frame out of a window it wants to free up: the contents
+ * go to a new frame, the owner's page table entry is repointed, and
+ * the old entry is shot down from the TLB.  kcompactd runs the same
+ * pass in the background, so that huge page faults find a free 2 MB
+ * run more often than not.
+ *
+ * The frames are also kept on a circular list, the clock, for
+ * eviction.  When the user pool is out of pages, the hand sweeps the
+ * clock and gives each frame whose page was accessed since the last
+ * sweep a second chance, by clearing its accessed bit.  Among the
+ * frames that were not accessed, a clean one, which can be dropped
+ * without writing it anywhere, is taken over a dirty one, but no
+ * sweep goes further than twice around the clock.  The hand takes any
+ * frame of an address space that is over its resident-set limit right
+ * away, and while some address space holds many more pages than its
+ * working set, passes over the frames of those that do not during its
+ * first turn, see vm.c.
+ *
+ * After a fork, a frame may back a page in each of several address
+ * spaces, mapped read-only in all of them until one writes to it, see
+ * vm_handle_wp().  The pages that share a frame are linked in a ring
+ * through their NEXT_SHARER members, and FRAME->page is any one of
+ * them.  A shared frame is evicted like any other, once the clock
+ * finds that none of its pages was accessed, by unmapping all of them,
+ * which then share the copy in swap, see vm_evict_frame().  Shared
+ * frames are not migrated, which would have to update every page
+ * table that maps them.
+ *
+ * ksmd shares frames too, while ksmctl() or -ksm has it on.  It walks
+ * the frame table a few frames at a time and hashes each anonymous
+ * frame, pinned, without frame_lock.  A frame whose hash did not
+ * change since ksmd's last visit is probably not written to often, so
+ * ksmd looks it up in a table of such frames by hash.  If the table
+ * holds a frame with the same contents, the two pages end up sharing
+ * one of them, read-only, just like after a fork, and the other frame
+ * is freed.  Otherwise the frame goes into the table itself.  Frames
+ * that are shared already are kept in the table for good, since their
+ * contents cannot change.
+ *
+ * Frames that hold read-only pages of executables are listed in a
+ * second table, by inode and offset, so that other processes running
+ * the same executable map them instead of reading their own copies,
+ * see text_share() in vm.c.  A frame leaves the table when it is freed
+ * or picked for eviction.  The executable cannot change under the
+ * table, since every process running it denies writes to it. */
+
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/hugepage.h"
+#include "vm/vm.h"
+
+/* How often kcompactd makes sure a 2 MB run is free. */
+#define COMPACT_INTERVAL (4 * TIMER_FREQ)
+
+unsigned ksm_pages_to_scan;
+unsigned ksm_sleep_ms = 20;
+
+static struct frame **frame_table;  /* Indexed by physical page number. */
+static size_t frame_cnt;            /* Number of entries in frame_table. */
+
+static struct list clock;           /* Every frame, in no particular order. */
+static struct list_elem *clock_hand; /* Next frame in CLOCK to look at. */
+static size_t clock_cnt;            /* Number of frames in CLOCK. */
+
+/* Eviction statistics. */
+static long long victim_cnt;        /* Victims picked. */
+static long long dirty_victim_cnt;  /* ...of which were dirty. */
+static long long scan_cnt;          /* Frames looked at to pick them. */
+static long long chance_cnt;        /* Second chances given. */
+static long long limit_victim_cnt;  /* Victims over their table's limit. */
+static long long ws_skip_cnt;       /* Frames passed over in working sets. */
+static long long shared_victim_cnt; /* Victims that pages shared. */
+static size_t scan_max;             /* Most frames looked at for one. */
+
+/* Pages that share another page's frame, and thus save one. */
+static size_t shared_cnt;
+
+/* ksmd's table of frames by contents, the next frame it looks at, and
+ * its statistics. */
+static struct hash ksm_table;
+static struct list_elem *ksm_cursor;
+static long long ksm_scan_cnt;      /* Frames looked at. */
+static long long ksm_merge_cnt;     /* Pages merged into another's frame. */
+
+/* ksmd, upped when merging is turned on. */
+static struct semaphore ksm_wake;
+
+/* Frames of executables by what they hold. */
+static struct hash text_table;
+
+/* Guards frame_table.  May be held while trying, but not waiting,
+ * for an SPT lock; the owner of an SPT lock may wait for it. */
+static struct lock frame_lock;
+
+static palloc_migrate_func frame_migrate;
+static thread_func kcompactd;
+static thread_func ksmd;
+static hash_hash_func ksm_hash;
+static hash_less_func ksm_less;
+static void ksm_unlist (struct frame *);
+static hash_hash_func text_hash;
+static hash_less_func text_less;
+static void text_unlist (struct frame *);
+
+/* Returns the frame table slot for the frame at kernel virtual
+ * address KVA. */
+static struct frame **
+frame_slot (void *kva) {
+	size_t pfn = pg_no (vtop (kva));
+
+	ASSERT (pfn < frame_cnt);
+	return &frame_table[pfn];
+}
+
+/* Sets up the frame table and starts kcompactd. */
+void
+frame_table_init (void) {
+	frame_cnt = palloc_phys_page_cnt ();
+	frame_table = calloc (frame_cnt, sizeof *frame_table);
+	if (frame_table == NULL)
+		PANIC ("frame_table_init: out of memory");
+	lock_init (&frame_lock);
+	list_init (&clock);
+	clock_hand = list_end (&clock);
+	ksm_cursor = list_end (&clock);
+	sema_init (&ksm_wake, 0);
+	if (!hash_init (&ksm_table, ksm_hash, ksm_less, NULL)
+			|| !hash_init (&text_table, text_hash, text_less, NULL))
+		PANIC ("frame_table_init: out of memory");
+
+	palloc_set_migrator (frame_migrate);
+	thread_create ("kcompactd", PRI_DEFAULT, kcompactd, NULL);
+	thread_create ("ksmd", PRI_DEFAULT, ksmd, NULL);
+}
+
+/* Records that FRAME holds the physical page at FRAME->kva. */
+void
+frame_table_insert (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	*frame_slot (frame->kva) = frame;
+	list_push_back (&clock, &frame->clock_elem);
+	clock_cnt++;
+	lock_release (&frame_lock);
+}
+
+/* Forgets FRAME.  The caller holds frame_lock. */
+static void
+remove_locked (struct frame *frame) {
+	ASSERT (*frame_slot (frame->kva) == frame);
+	*frame_slot (frame->kva) = NULL;
+	if (clock_hand == &frame->clock_elem)
+		clock_hand = list_next (clock_hand);
+	if (ksm_cursor == &frame->clock_elem)
+		ksm_cursor = list_next (ksm_cursor);
+	list_remove (&frame->clock_elem);
+	clock_cnt--;
+	ksm_unlist (frame);
+	text_unlist (frame);
+}
+
+/* Forgets FRAME, before its physical page is freed or reused. */
+void
+frame_table_remove (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	remove_locked (frame);
+	lock_release (&frame_lock);
+}
+
+/* Takes the lock of the SPT that holds PAGE without waiting, unless
+ * the current thread holds it already.  Returns false if the lock is
+ * busy.  Otherwise sets *LOCKED to whether it was taken here. */
+static bool
+lock_page_spt (struct page *page, bool *locked) {
+	struct lock *spt_lock = &page->spt->lock;
+
+	*locked = false;
+	if (lock_held_by_current_thread (spt_lock))
+		return true;
+	if (!lock_try_acquire (spt_lock))
+		return false;
+	*locked = true;
+	return true;
+}
+
+/* Releases the lock that lock_page_spt() took on PAGE's SPT, if
+ * LOCKED says it did. */
+static void
+unlock_page_spt (struct page *page, bool locked) {
+	if (locked)
+		lock_release (&page->spt->lock);
+}
+
+/* Takes the SPT locks of the pages that share FRAME, besides
+ * FRAME->page, as lock_page_spt() does, and notes in each page whether
+ * its lock was taken here.  Returns false, with none of them taken,
+ * if one is busy.  The caller holds frame_lock. */
+static bool
+lock_sharers (struct frame *frame) {
+	struct page *head = frame->page, *p, *q;
+
+	for (p = head->next_sharer; p != NULL && p != head; p = p->next_sharer)
+		if (!lock_page_spt (p, &p->evict_locked)) {
+			for (q = head->next_sharer; q != p; q = q->next_sharer)
+				unlock_page_spt (q, q->evict_locked);
+			return false;
+		}
+	return true;
+}
+
+/* Releases the locks that lock_sharers() took for FRAME, and that of
+ * FRAME->page's SPT if LOCKED says it was taken too. */
+static void
+unlock_candidate (struct frame *frame, bool locked) {
+	struct page *head = frame->page, *p;
+
+	for (p = head->next_sharer; p != NULL && p != head; p = p->next_sharer)
+		unlock_page_spt (p, p->evict_locked);
+	unlock_page_spt (head, locked);
+}
+
+/* Releases LOCK, which was taken for a frame that lost out to VICTIM,
+ * unless VICTIM needs it: then VICTIM's page, whose lock *LOCKED says
+ * was taken or not, or the page that shares VICTIM that found LOCK
+ * held, takes it over. */
+static void
+hand_over (struct lock *lock, struct frame *victim, bool *locked) {
+	struct page *head = victim->page, *p;
+
+	if (&head->spt->lock == lock) {
+		*locked = true;
+		return;
+	}
+	for (p = head->next_sharer; p != NULL && p != head; p = p->next_sharer)
+		if (&p->spt->lock == lock) {
+			p->evict_locked = true;
+			return;
+		}
+	lock_release (lock);
+}
+
+/* Releases the locks taken for FRAME, a candidate that lost out to
+ * VICTIM, as unlock_candidate() does, but hands the ones that VICTIM
+ * needs over to it. */
+static void
+drop_candidate (struct frame *frame, bool locked, struct frame *victim,
+		bool *victim_locked) {
+	struct page *head = frame->page, *p;
+
+	for (p = head->next_sharer; p != NULL && p != head; p = p->next_sharer)
+		if (p->evict_locked)
+			hand_over (&p->spt->lock, victim, victim_locked);
+	if (locked)
+		hand_over (&head->spt->lock, victim, victim_locked);
+}
+
+/* Returns true if FRAME's page, or any page that shares it, was used
+ * since the last call, as vm_page_referenced() tells, and clears what
+ * says so.  The caller holds the SPT locks of all of them. */
+static bool
+frame_referenced (struct frame *frame) {
+	struct page *head = frame->page, *p = head;
+	bool referenced = false;
+
+	do {
+		if (vm_page_referenced (p)) {
+			vm_page_unreference (p);
+			referenced = true;
+		}
+		p = p->next_sharer;
+	} while (p != NULL && p != head);
+	return referenced;
+}
+
+/* Returns the frame under the clock hand and moves the hand on. */
+static struct frame *
+clock_advance (void) {
+	struct frame *frame;
+
+	if (clock_hand == list_end (&clock))
+		clock_hand = list_begin (&clock);
+	frame = list_entry (clock_hand, struct frame, clock_elem);
+	clock_hand = list_next (clock_hand);
+	return frame;
+}
+
+/* Picks a frame to evict by the clock algorithm, among the pages of
+ * ONLY if ONLY is not a null pointer, or returns a null pointer if
+ * every such frame is pinned, busy, or free.  The returned
+ * frame's page stays mapped; the caller evicts it with the page's
+ * SPT lock held, which this function takes unless the caller held it
+ * already, and sets *LOCKED to whether it did.  The same goes for the
+ * pages that share the frame, if any, whose locks the caller releases
+ * with frame_put_sharers().  The frame comes back pinned, so that the
+ * caller may pick more victims before evicting any, and must unpin
+ * it.
+ *
+ * A dirty frame is taken only after one full turn of the clock found
+ * no clean one, and the search gives up after two turns, so the cost
+ * of an eviction is bounded by the number of frames. */
+struct frame *
+frame_pick_victim (struct supplemental_page_table *only, bool *locked) {
+	struct frame *victim = NULL, *dirty = NULL;
+	bool dirty_locked = false;
+	size_t scanned, limit;
+
+	lock_acquire (&frame_lock);
+	limit = 2 * clock_cnt;
+	for (scanned = 0; scanned < limit && clock_cnt > 0; scanned++) {
+		struct frame *frame = clock_advance ();
+		struct page *page = frame->page;
+		struct supplemental_page_table *spt;
+		bool frame_locked;
+
+		if (frame == dirty || frame->pinned || page == NULL
+				|| (only != NULL && page->spt != only)
+				|| !lock_page_spt (page, &frame_locked))
+			continue;
+		if (!lock_sharers (frame)) {
+			unlock_page_spt (page, frame_locked);
+			continue;
+		}
+		spt = page->spt;
+		if (only == NULL && vm_over_rss_limit (spt)) {
+			victim = frame;
+			*locked = frame_locked;
+			limit_victim_cnt++;
+			break;
+		} else if (only == NULL && ws_excess && scanned < clock_cnt
+				&& !vm_above_working_set (spt)) {
+			ws_skip_cnt++;
+		} else if (spt->dying && scanned < clock_cnt) {
+			/* The reaper frees it without writing it out. */
+		} else if (frame_referenced (frame)) {
+			chance_cnt++;
+		} else if (vm_page_is_clean (page)) {
+			victim = frame;
+			*locked = frame_locked;
+			break;
+		} else if (dirty == NULL) {
+			dirty = frame;
+			dirty_locked = frame_locked;
+			continue;
+		} else if (scanned >= clock_cnt) {
+			/* A whole turn found nothing clean. */
+			unlock_candidate (frame, frame_locked);
+			break;
+		}
+		unlock_candidate (frame, frame_locked);
+	}
+
+	if (victim == NULL && dirty != NULL) {
+		victim = dirty;
+		*locked = dirty_locked;
+		dirty_victim_cnt++;
+	} else if (dirty != NULL)
+		drop_candidate (dirty, dirty_locked, victim, locked);
+
+	if (victim != NULL) {
+		/* Its contents are about to go. */
+		text_unlist (victim);
+		victim->pinned = true;
+		victim_cnt++;
+		if (victim->sharer_cnt > 0)
+			shared_victim_cnt++;
+		scan_cnt += scanned + 1;
+		if (scanned + 1 > scan_max)
+			scan_max = scanned + 1;
+	}
+	lock_release (&frame_lock);
+	return victim;
+}
+
+/* Makes PAGE share FRAME.  The caller holds frame_lock. */
+static void
+share_locked (struct frame *frame, struct page *page) {
+	struct page *head = frame->page;
+
+	if (head->next_sharer == NULL)
+		head->next_sharer = head;
+	page->next_sharer = head->next_sharer;
+	head->next_sharer = page;
+	page->frame = frame;
+	frame->sharer_cnt++;
+	shared_cnt++;
+}
+
+/* Makes PAGE, a copy of FRAME's page in another address space, share
+ * FRAME.  The caller maps FRAME read-only for all of its pages. */
+void
+frame_share (struct frame *frame, struct page *page) {
+	lock_acquire (&frame_lock);
+	share_locked (frame, page);
+	lock_release (&frame_lock);
+}
+
+/* Takes PAGE off the pages that share FRAME.  The caller holds
+ * frame_lock. */
+static void
+unshare_locked (struct frame *frame, struct page *page) {
+	struct page *prev;
+
+	ASSERT (frame->sharer_cnt > 0 && page->next_sharer != NULL);
+	for (prev = page; prev->next_sharer != page; prev = prev->next_sharer)
+		continue;
+	prev->next_sharer = page->next_sharer;
+	page->next_sharer = NULL;
+	if (frame->page == page)
+		frame->page = prev;
+	if (--frame->sharer_cnt == 0)
+		prev->next_sharer = NULL;
+	shared_cnt--;
+}
+
+/* Takes PAGE off the pages that share FRAME.  The caller has unmapped
+ * PAGE and owns FRAME's page from now on if no other page is left.
+ * The pages that remain keep their read-only mappings; the next
+ * write to the last of them makes it writable again. */
+void
+frame_unshare (struct frame *frame, struct page *page) {
+	lock_acquire (&frame_lock);
+	unshare_locked (frame, page);
+	lock_release (&frame_lock);
+}
+
+/* Releases the SPT locks that frame_pick_victim() took for the pages
+ * that share FRAME, once the caller is done evicting it.  If EVICTED,
+ * none of the pages maps FRAME anymore, and they are taken off it
+ * first, leaving FRAME to FRAME->page alone. */
+void
+frame_put_sharers (struct frame *frame, bool evicted) {
+	struct page *head = frame->page, *p, *next;
+
+	lock_acquire (&frame_lock);
+	for (p = head->next_sharer; p != NULL && p != head; p = next) {
+		next = p->next_sharer;
+		if (evicted) {
+			p->next_sharer = NULL;
+			frame->sharer_cnt--;
+			shared_cnt--;
+		}
+		unlock_page_spt (p, p->evict_locked);
+	}
+	if (evicted)
+		head->next_sharer = NULL;
+	lock_release (&frame_lock);
+}
+
+/* Returns true if more than one page shares FRAME.  The caller holds
+ * the SPT lock of one of them, so a true answer may go stale, as
+ * other pages stop sharing, but a false one stays right. */
+bool
+frame_is_shared (struct frame *frame) {
+	return frame->sharer_cnt > 0;
+}
+
+/* Shared text. */
+
+/* Hashes a frame in text_table by what it holds. */
+static uint64_t
+text_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct text_key *key = &hash_entry (e, struct frame, text_elem)->text;
+
+	return hash_bytes (&key->inode, sizeof key->inode)
+		^ hash_int (key->ofs) ^ key->read_bytes;
+}
+
+/* Orders frames in text_table by what they hold. */
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct text_key *a = &hash_entry (a_, struct frame, text_elem)->text;
+	const struct text_key *b = &hash_entry (b_, struct frame, text_elem)->text;
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return a->read_bytes < b->read_bytes;
+}
+
+/* Takes FRAME out of text_table, if it is there.  The caller holds
+ * frame_lock. */
+static void
+text_unlist (struct frame *frame) {
+	if (frame->text_listed) {
+		hash_delete (&text_table, &frame->text_elem);
+		frame->text_listed = false;
+	}
+}
+
+/* Lists FRAME, which was just read in from an executable, as holding
+ * KEY, so that other pages with the same contents may share it.  Keeps
+ * any frame that is listed as holding KEY already. */
+void
+frame_text_insert (struct frame *frame, const struct text_key *key) {
+	lock_acquire (&frame_lock);
+	ASSERT (!frame->text_listed);
+	frame->text = *key;
+	frame->text_listed = hash_insert (&text_table, &frame->text_elem) == NULL;
+	lock_release (&frame_lock);
+}
+
+/* Makes PAGE share the frame that holds KEY, if there is one, and
+ * returns it.  Returns a null pointer if there is none, or if its
+ * owner is busy with its address space.  The caller maps the frame
+ * read-only. */
+struct frame *
+frame_text_share (const struct text_key *key, struct page *page) {
+	struct frame probe, *frame = NULL;
+	struct hash_elem *e;
+	bool locked;
+
+	probe.text = *key;
+	lock_acquire (&frame_lock);
+	e = hash_find (&text_table, &probe.text_elem);
+	if (e != NULL) {
+		frame = hash_entry (e, struct frame, text_elem);
+		/* Holding the owner's SPT lock keeps frame_is_shared()'s
+		 * false answers right, as for a fork. */
+		if (frame->pinned || frame->huge || frame->page == NULL
+				|| !lock_page_spt (frame->page, &locked))
+			frame = NULL;
+		else {
+			share_locked (frame, page);
+			unlock_page_spt (frame->page, locked);
+		}
+	}
+	lock_release (&frame_lock);
+	return frame;
+}
+
+/* Returns the number of pages that share another page's frame. */
+size_t
+frame_shared_cnt (void) {
+	return shared_cnt;
+}
+
+/* Moves the user page in the frame at KVA to a new frame, for
+ * palloc's compaction, and leaves the page at KVA allocated to the
+ * caller.  Fails if KVA holds no frame, if the frame is pinned for
+ * I/O or part of a huge page, or if its owner is busy with its
+ * address space. */
+static bool
+frame_migrate (void *kva) {
+	struct frame *frame;
+	struct page *page;
+	struct lock *spt_lock;
+	void *new_kva;
+	bool locked = false, success = false;
+
+	lock_acquire (&frame_lock);
+	frame = *frame_slot (kva);
+	if (frame == NULL || frame->pinned || frame->huge || frame->page == NULL
+			|| frame->sharer_cnt > 0)
+		goto done;
+
+	/* The owner waits for frame_lock with its SPT lock held, so we
+	 * must not wait here; it is fine if the owner is us. */
+	page = frame->page;
+	spt_lock = &page->spt->lock;
+	if (!lock_held_by_current_thread (spt_lock)) {
+		if (!lock_try_acquire (spt_lock))
+			goto done;
+		locked = true;
+	}
+
+	new_kva = palloc_get_page (PAL_USER);
+	if (new_kva != NULL) {
+		uint64_t *pml4 = page->spt->owner->pml4;
+		bool mapped = pml4_get_page (pml4, page->va) != NULL;
+		bool dirty = pml4_is_dirty (pml4, page->va);
+
+		/* Unmap first, so that the TLB entry is gone before the
+		 * copy is taken. */
+		if (mapped)
+			pml4_clear_page (pml4, page->va);
+		memcpy (new_kva, kva, PGSIZE);
+		*frame_slot (kva) = NULL;
+		frame->kva = new_kva;
+		*frame_slot (new_kva) = frame;
+		if (mapped && pml4_set_page (pml4, page->va, new_kva, page->writable)
+				&& dirty)
+			pml4_set_dirty (pml4, page->va, true);
+		success = true;
+	}
+	if (locked)
+		lock_release (spt_lock);
+
+done:
+	lock_release (&frame_lock);
+	return success;
+}
+
+/* Same-page merging. */
+
+/* Hashes a frame in ksm_table by its contents. */
+static uint64_t
+ksm_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct frame, ksm_elem)->ksm_checksum;
+}
+
+/* Orders frames in ksm_table by their contents' hashes. */
+static bool
+ksm_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct frame, ksm_elem)->ksm_checksum
+		< hash_entry (b, struct frame, ksm_elem)->ksm_checksum;
+}
+
+/* Puts FRAME in ksm_table, in place of any frame with the same hash.
+ * The caller holds frame_lock. */
+static void
+ksm_list (struct frame *frame) {
+	struct hash_elem *old;
+
+	if (frame->ksm_listed)
+		return;
+	old = hash_replace (&ksm_table, &frame->ksm_elem);
+	if (old != NULL)
+		hash_entry (old, struct frame, ksm_elem)->ksm_listed = false;
+	frame->ksm_listed = true;
+}
+
+/* Takes FRAME out of ksm_table, if it is there.  The caller holds
+ * frame_lock. */
+static void
+ksm_unlist (struct frame *frame) {
+	if (frame->ksm_listed) {
+		hash_delete (&ksm_table, &frame->ksm_elem);
+		frame->ksm_listed = false;
+	}
+}
+
+/* Write-protects PAGE's mapping, so that its contents hold still. */
+static void
+write_protect (struct page *page) {
+	pml4_harvest_range (page->spt->owner->pml4, page->va, 1, PTE_W, NULL);
+}
+
+/* Makes PAGE, which is in FRAME, share TARGET instead, if the two have
+ * the same contents, and frees FRAME.  Returns true if successful.
+ * The caller holds frame_lock, which is released while the two are
+ * compared, and PAGE's SPT lock, and has pinned FRAME. */
+static bool
+ksm_merge (struct frame *frame, struct page *page, struct frame *target) {
+	struct page *target_page = target->page;
+	uint64_t *pml4 = page->spt->owner->pml4;
+	bool locked, same;
+
+	if (target->pinned || target->huge || target_page == NULL
+			|| !lock_page_spt (target_page, &locked))
+		return false;
+
+	/* Neither side may change while we compare them, nor after.
+	 * Holding the target owner's SPT lock until PAGE shares TARGET
+	 * keeps frame_is_shared()'s false answers right, so that the
+	 * owner cannot make TARGET writable again in between, and keeps
+	 * TARGET in memory along with the pin. */
+	write_protect (page);
+	if (target->sharer_cnt == 0)
+		write_protect (target_page);
+	target->pinned = true;
+	lock_release (&frame_lock);
+	same = !memcmp (frame->kva, target->kva, PGSIZE);
+	lock_acquire (&frame_lock);
+	target->pinned = false;
+	if (!same) {
+		/* TARGET changed since it was listed. */
+		unlock_page_spt (target_page, locked);
+		ksm_unlist (target);
+		return false;
+	}
+
+	/* The page keeps its copy in swap only if it is clean. */
+	if (pml4_is_dirty (pml4, page->va))
+		anon_forget_copy (page);
+	pml4_clear_page (pml4, page->va);
+	share_locked (target, page);
+	if (!pml4_set_page (pml4, page->va, target->kva, false)) {
+		/* Go back to FRAME, which still holds the contents. */
+		unshare_locked (target, page);
+		page->frame = frame;
+		pml4_set_page (pml4, page->va, frame->kva, false);
+		unlock_page_spt (target_page, locked);
+		return false;
+	}
+	unlock_page_spt (target_page, locked);
+
+	frame->page = NULL;
+	remove_locked (frame);
+	palloc_free_page (frame->kva);
+	free (frame);
+	ksm_merge_cnt++;
+	return true;
+}
+
+/* Looks at FRAME for ksmd: merges it into a frame with the same
+ * contents if it is stable, or else lists it as a candidate for
+ * later frames.  The caller holds frame_lock, which is released
+ * while FRAME is read. */
+static void
+ksm_scan_frame (struct frame *frame) {
+	struct page *page = frame->page;
+	struct frame key, *match;
+	struct hash_elem *e;
+	uint64_t checksum;
+	bool locked, merged = false;
+
+	ksm_scan_cnt++;
+	if (page == NULL || frame->pinned || frame->huge
+			|| VM_TYPE (page->operations->type) != VM_ANON
+			|| !lock_page_spt (page, &locked))
+		return;
+
+	/* Faults and eviction need frame_lock more than we do.  Holding
+	 * PAGE's SPT lock keeps FRAME in memory, and the pin keeps
+	 * others from sharing or moving it. */
+	frame->pinned = true;
+	lock_release (&frame_lock);
+	checksum = hash_bytes (frame->kva, PGSIZE);
+	lock_acquire (&frame_lock);
+
+	if (frame->sharer_cnt > 0) {
+		/* Read-only, so it stays as it is. */
+		frame->ksm_checksum = checksum;
+		ksm_list (frame);
+		goto done;
+	}
+
+	if (checksum != frame->ksm_checksum) {
+		/* Changed since last time, or never seen: not yet. */
+		ksm_unlist (frame);
+		frame->ksm_checksum = checksum;
+		goto done;
+	}
+
+	key.ksm_checksum = checksum;
+	e = hash_find (&ksm_table, &key.ksm_elem);
+	match = e != NULL ? hash_entry (e, struct frame, ksm_elem) : NULL;
+	if (match == NULL)
+		ksm_list (frame);
+	else if (match != frame)
+		merged = ksm_merge (frame, page, match);
+
+done:
+	/* A merged frame is gone. */
+	if (!merged)
+		frame->pinned = false;
+	unlock_page_spt (page, locked);
+}
+
+/* Stores ksmd's tunables and statistics in *GET, unless GET is a null
+ * pointer, then sets the tunables as *SET says, unless SET is one. */
+void
+ksm_control (const struct ksm_info *set, struct ksm_info *get) {
+	if (get != NULL)
+		*get = (struct ksm_info) {
+			.pages_to_scan = ksm_pages_to_scan,
+			.sleep_ms = ksm_sleep_ms,
+			.pages_shared = shared_cnt,
+			.merge_cnt = ksm_merge_cnt,
+		};
+	if (set != NULL) {
+		ksm_sleep_ms = set->sleep_ms;
+		ksm_pages_to_scan = set->pages_to_scan;
+		if (ksm_pages_to_scan > 0)
+			sema_up (&ksm_wake);
+	}
+}
+
+/* Background thread that merges frames with the same contents.  It
+ * sleeps until ksm_control() wakes it while merging is off. */
+static void
+ksmd (void *aux UNUSED) {
+	for (;;) {
+		while (ksm_pages_to_scan == 0)
+			sema_down (&ksm_wake);
+		timer_msleep (ksm_sleep_ms > 0 ? ksm_sleep_ms : 1);
+		for (unsigned i = 0; i < ksm_pages_to_scan; i++) {
+			struct frame *frame;
+
+			/* Let faults in between frames. */
+			lock_acquire (&frame_lock);
+			if (clock_cnt > 0) {
+				if (ksm_cursor == list_end (&clock))
+					ksm_cursor = list_begin (&clock);
+				frame = list_entry (ksm_cursor, struct frame, clock_elem);
+				ksm_cursor = list_next (ksm_cursor);
+				ksm_scan_frame (frame);
+			}
+			lock_release (&frame_lock);
+		}
+	}
+}
+
+/* Prints eviction statistics. */
+void
+frame_print_stats (void) {
+	printf ("Eviction: %lld victims (%lld dirty), %lld second chances, "
+			"%lld.%02lld frames scanned per victim, at most %zu\n",
+			victim_cnt, dirty_victim_cnt, chance_cnt,
+			victim_cnt ? scan_cnt / victim_cnt : 0,
+			victim_cnt ? scan_cnt * 100 / victim_cnt % 100 : 0, scan_max);
+	printf ("Eviction: %lld victims over their limit, %lld frames "
+			"passed over in working sets\n", limit_victim_cnt, ws_skip_cnt);
+	printf ("Sharing: %zu pages saved now, %lld shared frames evicted; "
+			"ksmd looked at %lld frames, merged %lld pages\n", shared_cnt,
+			shared_victim_cnt, ksm_scan_cnt, ksm_merge_cnt);
+}
+
+/* Background thread that keeps a free 2 MB run in the user pool for
+ * huge pages.  Asking palloc for one compacts the pool if need be. */
+static void
+kcompactd (void *aux UNUSED) {
+	for (;;) {
+		void *run;
+
+		timer_sleep (COMPACT_INTERVAL);
+		if (!thp_enabled)
+			continue;
+		run = palloc_get_multiple_aligned (PAL_USER, HPAGE_PGCNT, PDE_PGSIZE);
+		if (run != NULL)
+			palloc_free_multiple (run, HPAGE_PGCNT);
+	}
+}
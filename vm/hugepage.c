@@ -0,0 +1,333 @@
+/* hugepage.c: Transparent huge pages for anonymous memory.
+ *
+ * The first fault on a zero-filled anonymous page tries to back the
+ * whole 2 MB block around it with one physically contiguous, 2 MB
+ * aligned run of user frames, mapped by a single PDE.  That costs one
+ * fault instead of 512 and takes one TLB entry instead of 512.  A block
+ * qualifies only if all 512 of its pages are in the SPT, anonymous,
+ * zero-filled, never touched, not even mapped to the shared zero
+ * page, and equally writable.
+ *
+ * Each 4 kB page of a huge page keeps its own struct page and struct
+ * frame, the latter with HUGE set, so the rest of the VM deals with
+ * ordinary pages.  Whatever needs to unmap or evict a single page
+ * calls thp_split() first, which turns the PDE into a page table over
+ * the same frames.
+ *
+ * Blocks that were split, or whose first fault found no free 2 MB run,
+ * are queued on their SPT.  khugepaged wakes up every SCAN_INTERVAL,
+ * copies each queued block whose pages are all present into a fresh
+ * 2 MB run, and maps it with one PDE again. */
+
+#include "vm/hugepage.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "vm/vm.h"
+#include "vm/frame.h"
+
+/* How often khugepaged looks at the queued blocks. */
+#define SCAN_INTERVAL TIMER_FREQ
+
+/* A 2 MB block to be collapsed into a huge page. */
+struct thp_block {
+	struct list_elem elem;      /* Element in spt->thp_blocks. */
+	void *base;                 /* First user page of the block. */
+};
+
+bool thp_enabled = true;
+
+/* Statistics. */
+static long long fault_cnt;     /* Faults served with a huge page. */
+static long long fallback_cnt;  /* Faults that found no free 2 MB run. */
+static long long split_cnt;     /* Huge pages split. */
+static long long collapse_cnt;  /* Blocks collapsed by khugepaged. */
+
+static thread_func khugepaged;
+static spt_action_func collapse_queued;
+static spt_page_func unmap_huge;
+
+/* Starts khugepaged. */
+void
+thp_init (void) {
+	thread_create ("khugepaged", PRI_DEFAULT, khugepaged, NULL);
+}
+
+/* Returns true if the block of pages at BASE in SPT is all fresh
+ * anonymous memory that a huge page may back: never touched,
+ * zero-filled, and writable iff WRITABLE. */
+static bool
+block_is_fresh (struct supplemental_page_table *spt, uint8_t *base,
+		bool writable) {
+	for (size_t i = 0; i < HPAGE_PGCNT; i++) {
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+
+		if (p == NULL || p->frame != NULL || p->zero_mapped
+				|| VM_TYPE (p->operations->type) != VM_UNINIT
+				|| VM_TYPE (p->uninit.type) != VM_ANON
+				|| p->uninit.init != NULL || p->writable != writable)
+			return false;
+	}
+	return true;
+}
+
+/* Queues the block at BASE in SPT for khugepaged, unless it already
+ * is queued. */
+static void
+queue_block (struct supplemental_page_table *spt, void *base) {
+	struct thp_block *b;
+	struct list_elem *e;
+
+	for (e = list_begin (&spt->thp_blocks); e != list_end (&spt->thp_blocks);
+			e = list_next (e))
+		if (list_entry (e, struct thp_block, elem)->base == base)
+			return;
+
+	b = malloc (sizeof *b);
+	if (b != NULL) {
+		b->base = base;
+		list_push_back (&spt->thp_blocks, &b->elem);
+	}
+}
+
+/* Detaches and frees the frames of the pages in the block at BASE
+ * in SPT, along with the 2 MB run at KVA behind them. */
+static void
+release_block (struct supplemental_page_table *spt, uint8_t *base,
+		void *kva) {
+	for (size_t i = 0; i < HPAGE_PGCNT; i++) {
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+
+		if (p->frame != NULL) {
+			frame_table_remove (p->frame);
+			free (p->frame);
+			p->frame = NULL;
+		}
+	}
+	palloc_free_multiple (kva, HPAGE_PGCNT);
+}
+
+/* Undoes thp_claim() of the block at BASE in SPT, mapped by the
+ * 2 MB run at KVA, after some of its pages failed to come in.  The
+ * pages that did are anonymous pages now, with nothing in swap, so
+ * they are marked to come back as zeros, as they were. */
+static void
+unclaim_block (struct supplemental_page_table *spt, uint8_t *base,
+		void *kva) {
+	pml4_clear_huge_page (spt->owner->pml4, base);
+	for (size_t i = 0; i < HPAGE_PGCNT; i++) {
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+
+		if (VM_TYPE (p->operations->type) == VM_ANON)
+			p->anon.zero = true;
+	}
+	release_block (spt, base, kva);
+	spt->rss -= HPAGE_PGCNT;
+}
+
+/* Tries to bring PAGE in, together with the rest of its 2 MB
+ * block, as one huge page.  Returns false if the block does not
+ * qualify, no 2 MB run is free, or its pages cannot be brought in,
+ * in which case the caller claims PAGE alone.  The caller holds the SPT lock. */
+bool
+thp_claim (struct page *page) {
+	struct supplemental_page_table *spt = page->spt;
+	uint8_t *base = hpage_round_down (page->va);
+	uint8_t *kva;
+	size_t i;
+
+	if (!thp_enabled || !vm_rss_room (spt, HPAGE_PGCNT)
+			|| !block_is_fresh (spt, base, page->writable))
+		return false;
+
+	kva = palloc_get_multiple_aligned (PAL_USER, HPAGE_PGCNT, PDE_PGSIZE);
+	if (kva == NULL) {
+		fallback_cnt++;
+		queue_block (spt, base);
+		return false;
+	}
+
+	/* The pages stay untouched until they are all mapped, so any
+	 * failure up to then can be undone. */
+	for (i = 0; i < HPAGE_PGCNT; i++) {
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+		struct frame *f = malloc (sizeof *f);
+
+		if (f == NULL) {
+			release_block (spt, base, kva);
+			return false;
+		}
+		*f = (struct frame) {
+			.kva = kva + i * PGSIZE,
+			.page = p,
+			.huge = true,
+		};
+		p->frame = f;
+		frame_table_insert (f);
+	}
+	if (!pml4_set_huge_page (spt->owner->pml4, base, kva, page->writable)) {
+		release_block (spt, base, kva);
+		return false;
+	}
+
+	spt->rss += HPAGE_PGCNT;
+	for (i = 0; i < HPAGE_PGCNT; i++) {
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+
+		if (!swap_in (p, p->frame->kva)) {
+			unclaim_block (spt, base, kva);
+			return false;
+		}
+	}
+	fault_cnt++;
+	return true;
+}
+
+/* Splits the huge page that backs PAGE into 4 kB mappings of the
+ * same frames, so that PAGE can be unmapped or evicted on its own,
+ * and queues the block to be collapsed again later.  The caller
+ * holds the SPT lock. */
+void
+thp_split (struct page *page) {
+	struct supplemental_page_table *spt = page->spt;
+	uint64_t *pml4 = spt->owner->pml4;
+	uint8_t *base = hpage_round_down (page->va);
+	bool split;
+
+	ASSERT (page->frame != NULL && page->frame->huge);
+
+	/* Without memory for a page table, unmap the block instead; its
+	 * pages are mapped again one by one as they fault, clean, so
+	 * their copies in swap are no good any more. */
+	split = pml4_split_huge_page (pml4, base);
+	if (!split)
+		pml4_clear_huge_page (pml4, base);
+
+	for (size_t i = 0; i < HPAGE_PGCNT; i++) {
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+		if (p != NULL && p->frame != NULL) {
+			p->frame->huge = false;
+			if (!split && VM_TYPE (p->operations->type) == VM_ANON)
+				anon_forget_copy (p);
+		}
+	}
+	split_cnt++;
+	queue_block (spt, base);
+}
+
+/* Unmaps PAGE's huge page as a whole, if it has one. */
+static void
+unmap_huge (struct page *page, void *aux UNUSED) {
+	if (page->frame != NULL && page->frame->huge) {
+		pml4_clear_huge_page (page->spt->owner->pml4,
+				hpage_round_down (page->va));
+		page->frame->huge = false;
+	}
+}
+
+/* Readies SPT for being torn down page by page: unmaps its huge
+ * pages whole, so that freeing their pages does not split them,
+ * and forgets its queued blocks. */
+void
+thp_kill (struct supplemental_page_table *spt) {
+	spt_for_each_page (spt, NULL, (void *) KERN_BASE, unmap_huge, NULL);
+	while (!list_empty (&spt->thp_blocks))
+		free (list_entry (list_pop_front (&spt->thp_blocks),
+					struct thp_block, elem));
+}
+
+/* Maps the block at BASE in SPT with a huge page again, copying its
+ * pages into a fresh 2 MB run.  Returns true if the block is done
+ * with, either collapsed or beyond collapsing, false to try again
+ * later. */
+static bool
+collapse_block (struct supplemental_page_table *spt, uint8_t *base) {
+	uint64_t *pml4 = spt->owner->pml4;
+	struct page *first = spt_find_page (spt, base);
+	uint8_t *kva;
+	size_t i;
+
+	for (i = 0; i < HPAGE_PGCNT; i++) {
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+
+		if (p == NULL || page_get_type (p) != VM_ANON
+				|| p->writable != first->writable)
+			return true;
+		if (p->frame == NULL || VM_TYPE (p->operations->type) != VM_ANON
+				|| p->frame->pinned || frame_is_shared (p->frame))
+			return false;
+		if (p->frame->huge)
+			return true;
+	}
+
+	kva = palloc_get_multiple_aligned (PAL_USER, HPAGE_PGCNT, PDE_PGSIZE);
+	if (kva == NULL)
+		return false;
+
+	/* The owner faults on the pages we unmap and then waits for the
+	 * SPT lock, which we hold, so it never sees a page mid-copy. */
+	pml4_clear_range (pml4, base, HPAGE_PGCNT);
+	for (i = 0; i < HPAGE_PGCNT; i++) {
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+
+		memcpy (kva + i * PGSIZE, p->frame->kva, PGSIZE);
+		anon_forget_copy (p);
+		frame_table_remove (p->frame);
+		palloc_free_page (p->frame->kva);
+		p->frame->kva = kva + i * PGSIZE;
+		p->frame->huge = true;
+		frame_table_insert (p->frame);
+	}
+
+	if (!pml4_set_huge_page (pml4, base, kva, first->writable)) {
+		/* The frames are in place; the pages get 4 kB mappings as
+		 * they fault. */
+		for (i = 0; i < HPAGE_PGCNT; i++)
+			spt_find_page (spt, base + i * PGSIZE)->frame->huge = false;
+		return true;
+	}
+	collapse_cnt++;
+	return true;
+}
+
+/* Collapses what it can of SPT's queued blocks. */
+static void
+collapse_queued (struct supplemental_page_table *spt, void *aux UNUSED) {
+	struct list_elem *e = list_begin (&spt->thp_blocks);
+
+	if (spt->owner->pml4 == NULL)
+		return;
+	while (e != list_end (&spt->thp_blocks)) {
+		struct thp_block *b = list_entry (e, struct thp_block, elem);
+
+		if (collapse_block (spt, b->base)) {
+			e = list_remove (e);
+			free (b);
+		} else
+			e = list_next (e);
+	}
+}
+
+/* Background thread that collapses queued blocks. */
+static void
+khugepaged (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (SCAN_INTERVAL);
+		if (thp_enabled)
+			spt_for_each (collapse_queued, NULL);
+	}
+}
+
+/* Prints huge page statistics. */
+void
+thp_print_stats (void) {
+	printf ("Huge pages: %lld faults served (%lld 4 kB faults avoided), "
+			"%lld fallbacks, %lld splits, %lld collapses\n",
+			fault_cnt, fault_cnt * (HPAGE_PGCNT - 1), fallback_cnt,
+			split_cnt, collapse_cnt);
+}
@@ -0,0 +1,312 @@
+/* swap.c: Swap space for anonymous pages.
+ *
+ * The swap disk is divided into slots of one page each.  Slots are
+ * handed out in runs, each starting where the last one ended, so
+ * that pages evicted together, and usually pages evicted one after
+ * another, land next to each other on the disk.  A run of pages is
+ * written with a single multi-sector command.
+ *
+ * Pages evicted together tend to be needed together.  When a page
+ * is read back in, the other swapped-out pages in the same
+ * SWAP_CLUSTER-slot cluster are read along with it into the swap
+ * cache, a small FIFO of pages from the user pool, so that faults
+ * on them find them in memory.  The cache gives its pages back when
+ * the user pool runs low.
+ *
+ * A slot may hold the copy of several pages with the same contents,
+ * the copies of a page in the address spaces forked off its own, or
+ * the pages that shared one frame until it was evicted.  Each of them
+ * holds a reference to the slot, and the last swap_free() frees it. */
+
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* Sectors per swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Slots per readahead cluster, and most pages in the swap cache. */
+#define SWAP_CLUSTER 16
+#define SWAP_CACHE_MAX 64
+
+static struct disk *swap_disk;
+static size_t slot_cnt;             /* Number of slots. */
+static struct bitmap *used_slots;   /* Slots that hold a copy. */
+static struct bitmap *out_slots;    /* ...of a page not in memory. */
+static unsigned *slot_refs;         /* References to each used slot. */
+static size_t cursor;               /* Where the next run starts. */
+
+/* Swap cache.  CACHE maps a slot to the page that holds its contents,
+ * if any; FIFO lists cached slots, oldest first, and may list slots
+ * that were dropped from the cache since. */
+static void **cache;
+static size_t cache_cnt;
+static size_t fifo[SWAP_CACHE_MAX];
+static size_t fifo_head, fifo_len;
+
+/* Guards all of the above.  Held across swap I/O, which goes to a
+ * single disk anyway. */
+static struct lock swap_lock;
+
+/* Statistics. */
+static long long out_cnt;           /* Pages written. */
+static long long batch_cnt;         /* Batches they were written in. */
+static uint64_t out_cycles;         /* Time spent writing them. */
+static long long in_cnt;            /* Pages read back in. */
+static uint64_t in_cycles;          /* Time spent on it... */
+static uint64_t in_max;             /* ...and most for one page. */
+static long long ahead_cnt;         /* Pages read ahead. */
+static long long hit_cnt;           /* ...found in the cache later. */
+
+static size_t cache_count (struct shrinker *);
+static size_t cache_scan (struct shrinker *, size_t page_cnt);
+
+static struct shrinker cache_shrinker = {
+	.name = "swap cache",
+	.pool = PAL_USER,
+	.count = cache_count,
+	.scan = cache_scan,
+};
+
+/* Sets up swap space on DISK, which may be a null pointer if there is
+ * no swap disk. */
+void
+swap_init (struct disk *disk) {
+	swap_disk = disk;
+	slot_cnt = disk != NULL ? disk_size (disk) / SECTORS_PER_SLOT : 0;
+	used_slots = bitmap_create (slot_cnt);
+	out_slots = bitmap_create (slot_cnt);
+	cache = calloc (slot_cnt + 1, sizeof *cache);
+	slot_refs = calloc (slot_cnt + 1, sizeof *slot_refs);
+	if (used_slots == NULL || out_slots == NULL || cache == NULL
+			|| slot_refs == NULL)
+		PANIC ("swap_init: out of memory");
+	lock_init (&swap_lock);
+	palloc_register_shrinker (&cache_shrinker);
+}
+
+/* Returns the first of CNT consecutive free slots, now in use with
+ * one reference each, or SWAP_SLOT_NONE if there is no such run.
+ * Runs are taken in ascending order from where the last one ended. */
+size_t
+swap_alloc (size_t cnt) {
+	size_t slot;
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (used_slots, cursor, cnt, false);
+	if (slot == BITMAP_ERROR)
+		slot = bitmap_scan_and_flip (used_slots, 0, cnt, false);
+	if (slot != BITMAP_ERROR) {
+		cursor = slot + cnt < slot_cnt ? slot + cnt : 0;
+		for (size_t i = 0; i < cnt; i++)
+			slot_refs[slot + i] = 1;
+	}
+	lock_release (&swap_lock);
+	return slot == BITMAP_ERROR ? SWAP_SLOT_NONE : slot;
+}
+
+/* Drops SLOT from the swap cache, if it is there.  The caller holds
+ * swap_lock. */
+static void
+cache_drop (size_t slot) {
+	if (cache[slot] != NULL) {
+		palloc_free_page (cache[slot]);
+		cache[slot] = NULL;
+		cache_cnt--;
+	}
+}
+
+/* Drops the oldest page from the swap cache.  The caller holds
+ * swap_lock. */
+static void
+cache_pop (void) {
+	ASSERT (fifo_len > 0);
+	cache_drop (fifo[fifo_head]);
+	fifo_head = (fifo_head + 1) % SWAP_CACHE_MAX;
+	fifo_len--;
+}
+
+/* Puts KPAGE, which holds the contents of SLOT, in the swap cache.
+ * The caller holds swap_lock. */
+static void
+cache_insert (size_t slot, void *kpage) {
+	while (fifo_len == SWAP_CACHE_MAX || cache_cnt == SWAP_CACHE_MAX)
+		cache_pop ();
+	cache[slot] = kpage;
+	cache_cnt++;
+	fifo[(fifo_head + fifo_len++) % SWAP_CACHE_MAX] = slot;
+}
+
+/* Adds a reference to SLOT, for another page whose copy it holds. */
+void
+swap_dup (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (used_slots, slot));
+	slot_refs[slot]++;
+	lock_release (&swap_lock);
+}
+
+/* Drops a reference to SLOT, and frees SLOT if it was the last. */
+void
+swap_free (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (used_slots, slot) && slot_refs[slot] > 0);
+	if (--slot_refs[slot] == 0) {
+		cache_drop (slot);
+		bitmap_reset (used_slots, slot);
+		bitmap_reset (out_slots, slot);
+	}
+	lock_release (&swap_lock);
+}
+
+/* Writes the CNT pages at KPAGES[] to the consecutive slots from
+ * SLOT on, which the caller got from swap_alloc(), in one batch, and
+ * notes that the pages are out of memory. */
+void
+swap_write (size_t slot, void *const kpages[], size_t cnt) {
+	uint64_t start;
+
+	ASSERT (cnt <= DISK_MULTIPLE_MAX / SECTORS_PER_SLOT);
+
+	lock_acquire (&swap_lock);
+	start = rdtsc ();
+	for (size_t i = 0; i < cnt; i++) {
+		ASSERT (bitmap_test (used_slots, slot + i));
+		cache_drop (slot + i);
+	}
+	disk_write_gather (swap_disk, slot * SECTORS_PER_SLOT,
+			(const void *const *) kpages, cnt, SECTORS_PER_SLOT);
+	bitmap_set_multiple (out_slots, slot, cnt, true);
+	out_cycles += rdtsc () - start;
+	out_cnt += cnt;
+	batch_cnt++;
+	lock_release (&swap_lock);
+}
+
+/* Notes that the page whose copy is in SLOT left memory without
+ * being written, because the copy was still good. */
+void
+swap_evicted (size_t slot) {
+	lock_acquire (&swap_lock);
+	bitmap_mark (out_slots, slot);
+	lock_release (&swap_lock);
+}
+
+/* Returns true if slot S of SLOT's cluster should be read ahead.
+ * The caller holds swap_lock. */
+static bool
+wants_read_ahead (size_t slot, size_t s) {
+	return s != slot && bitmap_test (out_slots, s) && cache[s] == NULL;
+}
+
+/* Reads ahead the swapped-out pages in SLOT's cluster that are not
+ * cached yet, as many as there are free pages for.  The pages are
+ * allocated without swap_lock, since allocating may run shrinkers
+ * and compaction, which come back to swap. */
+static void
+read_ahead (size_t slot) {
+	size_t first = slot / SWAP_CLUSTER * SWAP_CLUSTER;
+	size_t end = first + SWAP_CLUSTER < slot_cnt ?
+		first + SWAP_CLUSTER : slot_cnt;
+	void *kpages[SWAP_CLUSTER];
+	size_t want = 0, cnt = 0, s;
+
+	lock_acquire (&swap_lock);
+	for (s = first; s < end; s++)
+		if (wants_read_ahead (slot, s))
+			want++;
+	lock_release (&swap_lock);
+
+	while (cnt < want && (kpages[cnt] = palloc_get_page (PAL_USER)) != NULL)
+		cnt++;
+
+	/* The cluster may have changed while the lock was released. */
+	lock_acquire (&swap_lock);
+	for (s = first; s < end && cnt > 0; s++)
+		if (wants_read_ahead (slot, s)) {
+			void *kpage = kpages[--cnt];
+
+			disk_read_multiple (swap_disk, s * SECTORS_PER_SLOT, kpage,
+					SECTORS_PER_SLOT);
+			cache_insert (s, kpage);
+			ahead_cnt++;
+		}
+	lock_release (&swap_lock);
+	while (cnt > 0)
+		palloc_free_page (kpages[--cnt]);
+}
+
+/* Reads the page in SLOT into KPAGE and notes that it is in memory
+ * again.  The slot stays allocated. */
+void
+swap_read (size_t slot, void *kpage) {
+	uint64_t start, elapsed;
+	bool hit;
+
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (used_slots, slot));
+	start = rdtsc ();
+	hit = cache[slot] != NULL;
+	if (hit) {
+		memcpy (kpage, cache[slot], PGSIZE);
+		/* Other pages that share the slot may want it too. */
+		if (slot_refs[slot] == 1)
+			cache_drop (slot);
+		hit_cnt++;
+	} else
+		disk_read_multiple (swap_disk, slot * SECTORS_PER_SLOT, kpage,
+				SECTORS_PER_SLOT);
+	bitmap_reset (out_slots, slot);
+	elapsed = rdtsc () - start;
+	in_cycles += elapsed;
+	if (elapsed > in_max)
+		in_max = elapsed;
+	in_cnt++;
+	lock_release (&swap_lock);
+
+	if (!hit)
+		read_ahead (slot);
+}
+
+/* Returns the number of pages in the swap cache. */
+static size_t
+cache_count (struct shrinker *s UNUSED) {
+	return cache_cnt;
+}
+
+/* Frees up to PAGE_CNT pages of the swap cache, oldest first.  Does
+ * nothing if swap_lock is busy. */
+static size_t
+cache_scan (struct shrinker *s UNUSED, size_t page_cnt) {
+	size_t freed = 0;
+
+	if (lock_held_by_current_thread (&swap_lock)
+			|| !lock_try_acquire (&swap_lock))
+		return 0;
+	while (freed < page_cnt && fifo_len > 0) {
+		size_t before = cache_cnt;
+		cache_pop ();
+		freed += before - cache_cnt;
+	}
+	lock_release (&swap_lock);
+	return freed;
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void) {
+	printf ("Swap: %lld pages out in %lld batches, %llu cycles per page; "
+			"%lld pages in, %llu cycles per page, at most %llu\n",
+			out_cnt, batch_cnt, out_cnt ? out_cycles / out_cnt : 0,
+			in_cnt, in_cnt ? in_cycles / in_cnt : 0, in_max);
+	printf ("Swap readahead: %lld pages read, %lld used\n",
+			ahead_cnt, hit_cnt);
+}
@@ -2,4 +2,9 @@ vm_SRC = vm/vm.c          # Main api proxy
 vm_SRC += vm/uninit.c     # Uninitialized page
 vm_SRC += vm/anon.c       # Anonymous page
 vm_SRC += vm/file.c       # File mapped page
+vm_SRC += vm/frame.c      # Frame table
+vm_SRC += vm/swap.c       # Swap space
+vm_SRC += vm/zswap.c      # Compressed swap pool
+vm_SRC += vm/hugepage.c   # Transparent huge pages
+vm_SRC += vm/faultstat.c  # Page fault statistics
 vm_SRC += vm/inspect.c    # Testing utility
@@ -1,8 +1,139 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <mman.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
+#include "vm/hugepage.h"
+#include "vm/faultstat.h"
 #include "vm/inspect.h"
+#include "intrinsic.h"
+
+/* How far below USER_STACK the stack may grow. */
+#define STACK_LIMIT (1 << 20)
+
+/* Most pages to fault around at once, fewest in an adaptive window. */
+#define FAULT_AROUND_MAX 64
+#define FAULT_AROUND_MIN 2
+
+/* How often kwsd samples working sets. */
+#define WS_INTERVAL TIMER_FREQ
+
+/* How long kswapd waits after a pass that evicted nothing. */
+#define KSWAPD_BACKOFF (TIMER_FREQ / 10)
+
+/* Makes read-only pages read-only for the kernel too. */
+#define CR0_WP (1 << 16)
+
+/* Every initialized supplemental page table, for the kernel threads
+ * that work on other processes' address spaces. */
+static struct list spt_list;
+static struct lock spt_list_lock;
+
+/* A supplemental page table is a radix tree shaped like the x86-64
+ * page tables: four levels of 512-entry nodes, one page each,
+ * indexed by the same nine-bit fields of the virtual address as the
+ * PML4, the page directory pointer table, the page directory and
+ * the page table.  The slots of the last level point to struct
+ * pages.  A lookup is four array indexings whatever the size of the
+ * address space, an insertion allocates at most three nodes, and
+ * nothing is ever rehashed.  A node is freed once its last page is
+ * removed. */
+#define SPT_LEVELS 4
+#define SPT_FANOUT (PGSIZE / sizeof (void *))
+
+/* Bit position of the index of each level in a virtual address. */
+static const unsigned spt_shift[SPT_LEVELS] = {
+	PML4SHIFT, PDPESHIFT, PDXSHIFT, PTXSHIFT,
+};
+
+#define spt_index(va, level) \
+	(((uint64_t) (va) >> spt_shift[level]) & (SPT_FANOUT - 1))
+
+unsigned fault_around_pages = 16;
+
+/* Fault-around statistics. */
+static long long around_fault_cnt;  /* Faults that mapped around. */
+static long long around_map_cnt;    /* Pages they mapped. */
+static long long around_hit_cnt;    /* ...that were used after all. */
+static long long around_exec_cnt;   /* Tables that faulted around. */
+
+/* The shared zero page, and how many pages are mapped to it. */
+static void *zero_page;
+static size_t zero_map_cnt;         /* Mappings live now. */
+static long long zero_map_total;    /* Mappings made. */
+
+/* Copy-on-write statistics. */
+static long long cow_share_cnt;     /* Pages shared by fork. */
+static long long cow_copy_cnt;      /* ...copied on a write. */
+static long long cow_reuse_cnt;     /* ...found no longer shared. */
+static long long cow_out_cnt;       /* Pages copied while not in memory. */
+
+/* Shared text statistics. */
+static long long text_read_cnt;     /* Executable pages read in. */
+static long long text_share_cnt;    /* ...mapped from another's frame. */
+
+size_t rss_limit_pages;
+bool ws_excess;
+
+bool kswapd_enabled = true;
+
+/* kswapd, upped when the user pool drops below its low watermark.
+ * KSWAPD_PENDING keeps it from being upped again before it runs. */
+static struct thread *kswapd_thread;
+static struct semaphore kswapd_sema;
+static bool kswapd_pending;
+
+/* Page-out statistics. */
+static long long kswapd_wake_cnt;   /* Times kswapd was woken. */
+static long long kswapd_evict_cnt;  /* Pages it evicted. */
+static long long direct_evict_cnt;  /* Pages faulting threads evicted. */
+
+bool reaper_enabled = true;
+
+/* Dead threads whose address spaces are left to tear down, and the
+ * reaper, which is blocked, with REAPER_IDLE set, while there are
+ * none.  REAP_BACKLOG also counts the exiting threads that have yet
+ * to die.  All are guarded by disabling interrupts, since vm_reap()
+ * runs in the scheduler. */
+static struct list reap_list;
+static size_t reap_backlog;
+static struct thread *reaper_thread;
+static bool reaper_idle;
+
+/* Reaper statistics. */
+static long long reap_cnt;          /* Address spaces torn down... */
+static long long reap_kswapd_cnt;   /* ...of which by kswapd. */
+static long long reap_page_cnt;     /* Pages they had. */
+
+/* Working set statistics. */
+static long long ws_sample_cnt;     /* Tables sampled. */
+static long long limit_evict_cnt;   /* Pages evicted to keep a limit. */
+
+/* Upped whenever a range is queued for kprefetchd, see below. */
+static struct semaphore prefetch_sema;
+
+/* Advice statistics. */
+static long long seq_ahead_cnt;     /* Pages read ahead sequentially. */
+static long long prefetch_cnt;      /* Pages read in for MADV_WILLNEED. */
+static long long discard_cnt;       /* Pages discarded by MADV_DONTNEED. */
+static long long populate_cnt;      /* Pages brought in by MAP_POPULATE. */
+
+static spt_page_func destroy_page;
+static thread_func prefetchd;
+static thread_func kwsd;
+static thread_func kswapd;
+static thread_func reaper;
+static bool reap_one (void);
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -15,7 +146,69 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	list_init (&spt_list);
+	lock_init (&spt_list_lock);
+	frame_table_init ();
+	thp_init ();
+	zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	sema_init (&prefetch_sema, 0);
+	thread_create ("kprefetchd", PRI_DEFAULT, prefetchd, NULL);
+	thread_create ("kwsd", PRI_DEFAULT, kwsd, NULL);
+	sema_init (&kswapd_sema, 0);
+	if (kswapd_enabled)
+		thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL);
+	list_init (&reap_list);
+	thread_create ("kreaperd", PRI_MIN, reaper, NULL);
+
+	/* Fault-around windows are aligned powers of two. */
+	if (fault_around_pages > FAULT_AROUND_MAX)
+		fault_around_pages = FAULT_AROUND_MAX;
+	while (fault_around_pages & (fault_around_pages - 1))
+		fault_around_pages &= fault_around_pages - 1;
+
+	/* The kernel's writes to user pages must fault on pages shared
+	 * copy-on-write, just like the user's. */
+	lcr0 (rcr0 () | CR0_WP);
+}
+
+/* Prints virtual memory statistics. */
+void
+vm_print_stats (void) {
+	thp_print_stats ();
+	frame_print_stats ();
+	swap_print_stats ();
+	zswap_print_stats ();
+	anon_print_stats ();
+	file_print_stats ();
+	faultstat_print_stats ();
+	printf ("Copy-on-write: %lld pages shared, %lld copied, %lld reused; "
+			"%lld pages copied while out of memory\n",
+			cow_share_cnt, cow_copy_cnt, cow_reuse_cnt, cow_out_cnt);
+	printf ("Zero page: %zu mappings live, %lld made\n",
+			zero_map_cnt, zero_map_total);
+	printf ("Fault-around: %lld faults mapped %lld pages, %lld used; "
+			"%lld faults avoided per exec over %lld execs\n",
+			around_fault_cnt, around_map_cnt, around_hit_cnt,
+			around_exec_cnt ? around_hit_cnt / around_exec_cnt : 0,
+			around_exec_cnt);
+	printf ("Shared text: %lld pages read in, %lld shared instead\n",
+			text_read_cnt, text_share_cnt);
+	printf ("Advice: %lld pages read ahead, %lld prefetched, "
+			"%lld discarded, %lld populated\n",
+			seq_ahead_cnt, prefetch_cnt, discard_cnt, populate_cnt);
+	vm_print_pageout_stats ();
+	printf ("Working sets: %lld samples, %lld pages evicted to keep "
+			"a limit\n", ws_sample_cnt, limit_evict_cnt);
+}
+
+/* Prints who evicted how many pages. */
+void
+vm_print_pageout_stats (void) {
+	printf ("Page-out: kswapd woke %lld times and evicted %lld pages; "
+			"faulting threads evicted %lld\n",
+			kswapd_wake_cnt, kswapd_evict_cnt, direct_evict_cnt);
+	printf ("Reaper: %lld address spaces torn down, %lld by kswapd, "
+			"with %lld pages\n", reap_cnt, reap_kswapd_cnt, reap_page_cnt);
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -33,9 +226,14 @@ page_get_type (struct page *page) {
 }
 
 /* Helpers */
-static struct frame *vm_get_victim (void);
+static struct frame *vm_get_victim (struct supplemental_page_table *only,
+		bool *locked);
 static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+static bool vm_claim_frame (struct page *page, struct frame *frame);
+static struct frame *vm_evict_frame (struct supplemental_page_table *only);
+static void release_frame (struct frame *frame);
+static bool text_share (struct page *page);
+static bool map_page (struct page *page);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -47,97 +245,1159 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 	ASSERT (VM_TYPE(type) != VM_UNINIT)
 
 	struct supplemental_page_table *spt = &thread_current ()->spt;
+	bool (*initializer) (struct page *, enum vm_type, void *);
+	struct page *page;
+	bool success = false;
 
+	switch (VM_TYPE (type)) {
+		case VM_ANON:
+			initializer = anon_initializer;
+			break;
+		case VM_FILE:
+			initializer = file_backed_initializer;
+			break;
+		default:
+			goto err;
+	}
+
+	lock_acquire (&spt->lock);
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
-
-		/* TODO: Insert the page into the spt. */
+		page = malloc (sizeof *page);
+		if (page != NULL) {
+			uninit_new (page, upage, init, type, aux, initializer);
+			page->writable = writable;
+			success = spt_insert_page (spt, page);
+			if (!success)
+				free (page);
+		}
 	}
+	lock_release (&spt->lock);
+	return success;
 err:
 	return false;
 }
 
+/* Returns true if no slot of NODE is in use. */
+static bool
+node_is_empty (void **node) {
+	for (size_t i = 0; i < SPT_FANOUT; i++)
+		if (node[i] != NULL)
+			return false;
+	return true;
+}
+
+/* Walks SPT down to the leaf slot for VA and returns it.  If a node
+ * on the way is missing, creates it if CREATE is true, or returns a
+ * null pointer otherwise or if memory runs out.  Unless PATH is a
+ * null pointer, stores in PATH[i] the node of level i on the way. */
+static void **
+spt_walk (struct supplemental_page_table *spt, void *va, bool create,
+		void **path[SPT_LEVELS]) {
+	void **node = spt->root;
+
+	for (int level = 0; ; level++) {
+		void **slot = &node[spt_index (va, level)];
+
+		if (path != NULL)
+			path[level] = node;
+		if (level == SPT_LEVELS - 1)
+			return slot;
+		if (*slot == NULL) {
+			if (!create || (*slot = palloc_get_page (PAL_ZERO)) == NULL)
+				return NULL;
+		}
+		node = *slot;
+	}
+}
+
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
-
-	return page;
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	void **slot = spt_walk (spt, va, false, NULL);
+	return slot != NULL ? *slot : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt,
+		struct page *page) {
+	void **slot;
+
+	ASSERT (pg_ofs (page->va) == 0);
 
-	return succ;
+	slot = spt_walk (spt, page->va, true, NULL);
+	if (slot == NULL || *slot != NULL)
+		return false;
+	*slot = page;
+	page->spt = spt;
+	spt->page_cnt++;
+	return true;
 }
 
+/* Removes PAGE from SPT, frees the nodes that it leaves empty, and
+ * deallocates PAGE. */
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	void **path[SPT_LEVELS];
+	void **slot = spt_walk (spt, page->va, false, path);
+	int level;
+
+	ASSERT (slot != NULL && *slot == page);
+
+	*slot = NULL;
+	spt->page_cnt--;
+	for (level = SPT_LEVELS - 1; level > 0; level--) {
+		if (!node_is_empty (path[level]))
+			break;
+		palloc_free_page (path[level]);
+		path[level - 1][spt_index (page->va, level - 1)] = NULL;
+	}
 	vm_dealloc_page (page);
-	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Calls ACTION on each page in NODE, a node of SPT at LEVEL whose
+ * first slot maps virtual address BASE, that lies between START and
+ * END, in order of address.  If REMOVE is true, also takes each page
+ * out of SPT after ACTION is done with it and frees the nodes below
+ * NODE that end up empty. */
+static void
+walk_range (struct supplemental_page_table *spt, void **node, int level,
+		uint64_t base, uint64_t start, uint64_t end,
+		spt_page_func *action, void *aux, bool remove) {
+	uint64_t span = 1ULL << spt_shift[level];
+	size_t i = start > base ? (start - base) >> spt_shift[level] : 0;
+
+	for (; i < SPT_FANOUT && base + i * span < end; i++) {
+		if (node[i] == NULL)
+			continue;
+		if (level == SPT_LEVELS - 1) {
+			action (node[i], aux);
+			if (remove) {
+				node[i] = NULL;
+				spt->page_cnt--;
+			}
+		} else {
+			walk_range (spt, node[i], level + 1, base + i * span, start, end,
+					action, aux, remove);
+			if (remove && node_is_empty (node[i])) {
+				palloc_free_page (node[i]);
+				node[i] = NULL;
+			}
+		}
+	}
+}
+
+/* Calls ACTION on each page of SPT from START up to END, in order
+ * of address, skipping unpopulated parts of the range a whole node
+ * at a time.  ACTION must not add pages to SPT or remove them. */
+void
+spt_for_each_page (struct supplemental_page_table *spt, void *start,
+		void *end, spt_page_func *action, void *aux) {
+	walk_range (spt, spt->root, 0, 0, (uint64_t) start, (uint64_t) end,
+			action, aux, false);
+}
+
+/* Removes and deallocates each page of SPT from START up to END. */
+void
+spt_remove_range (struct supplemental_page_table *spt, void *start,
+		void *end) {
+	walk_range (spt, spt->root, 0, 0, (uint64_t) start, (uint64_t) end,
+			destroy_page, NULL, true);
+}
+
+/* Calls ACTION on every live supplemental page table with the
+ * table's lock held.  A table cannot be killed while ACTION runs
+ * on it, so kernel threads use this to reach into the address
+ * spaces of processes. */
+void
+spt_for_each (spt_action_func *action, void *aux) {
+	struct list_elem *e;
+
+	lock_acquire (&spt_list_lock);
+	for (e = list_begin (&spt_list); e != list_end (&spt_list);
+			e = list_next (e)) {
+		struct supplemental_page_table *spt =
+			list_entry (e, struct supplemental_page_table, elem);
+
+		lock_acquire (&spt->lock);
+		action (spt, aux);
+		lock_release (&spt->lock);
+	}
+	lock_release (&spt_list_lock);
+}
+
+/* Returns true if PAGE, which is in memory, can be evicted without
+ * writing it anywhere.  The caller holds PAGE's SPT lock. */
+bool
+vm_page_is_clean (struct page *page) {
+	if (pml4_is_dirty (page->spt->owner->pml4, page->va))
+		return false;
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_ANON:
+			return anon_has_copy (page);
+		case VM_FILE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Returns true if PAGE, which is in memory, was used since
+ * vm_page_unreference() last cleared it: its accessed bit is set, or
+ * kwsd moved it into PAGE's referenced bit.  The caller holds PAGE's
+ * SPT lock. */
+bool
+vm_page_referenced (struct page *page) {
+	return page->referenced
+		|| pml4_is_accessed (page->spt->owner->pml4, page->va);
+}
+
+/* Clears both bits that vm_page_referenced() looks at. */
+void
+vm_page_unreference (struct page *page) {
+	page->referenced = false;
+	pml4_set_accessed (page->spt->owner->pml4, page->va, false);
+}
+
+/* Get the struct frame, that will be evicted, from ONLY's pages if
+ * ONLY is not a null pointer.  The victim's SPT lock is held on
+ * return; *LOCKED tells whether it was taken for us. */
 static struct frame *
-vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+vm_get_victim (struct supplemental_page_table *only, bool *locked) {
+	return frame_pick_victim (only, locked);
+}
 
-	return victim;
+/* Unmaps the page in VICTIM, a frame that vm_get_victim() returned,
+ * and the pages that share it, if any, and makes sure that the page
+ * table entries keep their dirty bits. */
+static void
+unmap_victim (struct frame *victim) {
+	struct page *head = victim->page, *page = head;
+
+	if (victim->huge)
+		thp_split (head);
+	do {
+		pml4_clear_page (page->spt->owner->pml4, page->va);
+		page = page->next_sharer;
+	} while (page != NULL && page != head);
+}
+
+/* Maps the pages in VICTIM back in after its eviction failed. */
+static void
+remap_victim (struct frame *victim) {
+	struct page *head = victim->page, *page = head;
+
+	do {
+		uint64_t *pml4 = page->spt->owner->pml4;
+		bool dirty = pml4_is_dirty (pml4, page->va);
+
+		if (map_page (page) && dirty)
+			pml4_set_dirty (pml4, page->va, true);
+		page = page->next_sharer;
+	} while (page != NULL && page != head);
+}
+
+/* Gives the pages that shared the frame of PAGE, which was just
+ * swapped out, PAGE's copy in swap, and takes them out of memory. */
+static void
+evict_sharers (struct page *page) {
+	struct page *p;
+
+	for (p = page->next_sharer; p != NULL && p != page; p = p->next_sharer) {
+		anon_share_copy (page, p);
+		p->frame = NULL;
+		p->spt->rss--;
+	}
 }
 
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * Return NULL on error.
+ *
+ * Evicts up to SWAP_BATCH_MAX pages at once, so that the anonymous
+ * ones among them go to swap in one batch, and gives all frames but
+ * the returned one back to the user pool for the faults to come.
+ * Evicts only ONLY's pages, if ONLY is not a null pointer.  A frame
+ * that several pages share is written out once, and all of them end
+ * up with the same copy. */
+static struct frame *
+vm_evict_frame (struct supplemental_page_table *only) {
+	struct frame *victims[SWAP_BATCH_MAX], *result = NULL;
+	struct page *pages[SWAP_BATCH_MAX], *anon[SWAP_BATCH_MAX];
+	bool locked[SWAP_BATCH_MAX], evicted[SWAP_BATCH_MAX];
+	size_t cnt, anon_cnt = 0, i;
+
+	for (cnt = 0; cnt < SWAP_BATCH_MAX; cnt++) {
+		victims[cnt] = vm_get_victim (only, &locked[cnt]);
+		if (victims[cnt] == NULL)
+			break;
+		pages[cnt] = victims[cnt]->page;
+	}
+
+	/* Unmap the pages before writing them out, so that their owners
+	 * cannot change them behind the copies' back. */
+	for (i = 0; i < cnt; i++) {
+		unmap_victim (victims[i]);
+		if (VM_TYPE (pages[i]->operations->type) == VM_ANON)
+			anon[anon_cnt++] = pages[i];
+		evicted[i] = true;
+	}
+	if (anon_cnt > 0 && !anon_swap_out_batch (anon, anon_cnt)) {
+		/* Swap is too full for all of them; save what we can. */
+		for (i = 0; i < cnt; i++)
+			if (VM_TYPE (pages[i]->operations->type) == VM_ANON)
+				evicted[i] = swap_out (pages[i]);
+	}
+	for (i = 0; i < cnt; i++)
+		if (VM_TYPE (pages[i]->operations->type) != VM_ANON)
+			evicted[i] = swap_out (pages[i]);
+
+	for (i = 0; i < cnt; i++) {
+		if (!evicted[i]) {
+			remap_victim (victims[i]);
+			continue;
+		}
+		if (thread_current () == kswapd_thread)
+			kswapd_evict_cnt++;
+		else
+			direct_evict_cnt++;
+		evict_sharers (pages[i]);
+		pages[i]->frame = NULL;
+		pages[i]->spt->rss--;
+	}
+
+	/* Backwards, since a victim may count on the SPT locks taken for
+	 * the ones picked before it. */
+	for (i = cnt; i-- > 0; ) {
+		struct frame *victim = victims[i];
+
+		frame_put_sharers (victim, evicted[i]);
+		if (evicted[i])
+			victim->page = NULL;
+		victim->pinned = false;
+		if (locked[i])
+			lock_release (&pages[i]->spt->lock);
+		if (!evicted[i])
+			continue;
+		if (result == NULL)
+			result = victim;
+		else
+			release_frame (victim);
+	}
+	return result;
+}
+
+/* Returns a frame for a free page of the user pool, or a null pointer
+ * if there is none.  Wakes kswapd if the pool runs low. */
 static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+alloc_frame (void) {
+	struct frame *frame = NULL;
+	void *kva = palloc_get_page (PAL_USER);
+
+	if (kswapd_thread != NULL && !kswapd_pending
+			&& palloc_below_wmark (PAL_USER, WMARK_LOW)) {
+		kswapd_pending = true;
+		sema_up (&kswapd_sema);
+	}
 
-	return NULL;
+	if (kva != NULL) {
+		frame = malloc (sizeof *frame);
+		if (frame != NULL) {
+			*frame = (struct frame) { .kva = kva };
+			frame_table_insert (frame);
+		} else
+			palloc_free_page (kva);
+	}
+	return frame;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it.  That is, if the user pool memory is full, this function
+ * evicts the frame to get the available memory space.  Returns a null
+ * pointer if nothing can be evicted, for example because swap is full.
+ * kswapd keeps the pool from running out, so that evicting here, on
+ * the faulting thread, is the exception.
+ *
+ * The frame is for a new page of SPT, unless SPT is a null pointer.
+ * If SPT is at its limit, one of its own pages makes room, if any can
+ * be evicted.  The caller holds SPT's lock. */
 static struct frame *
-vm_get_frame (void) {
+vm_get_frame (struct supplemental_page_table *spt) {
 	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+	if (spt != NULL && !vm_rss_room (spt, 1)) {
+		frame = vm_evict_frame (spt);
+		if (frame != NULL)
+			limit_evict_cnt++;
+	}
+	if (frame == NULL)
+		frame = alloc_frame ();
+	if (frame == NULL)
+		frame = vm_evict_frame (NULL);
+
+	ASSERT (frame == NULL || frame->page == NULL);
 	return frame;
 }
 
-/* Growing the stack. */
+/* Gives FRAME, which holds no page, back to the user pool. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+release_frame (struct frame *frame) {
+	frame_table_remove (frame);
+	palloc_free_page (frame->kva);
+	free (frame);
+}
+
+/* Page-out thread.  Woken when the user pool drops below its low
+ * watermark, it evicts pages, SWAP_BATCH_MAX at a time, writing the
+ * dirty ones out as it goes, until the pool is back at its high
+ * watermark.  Faults thus find free frames, and do not wait for
+ * their victims' writes, unless kswapd falls behind.  Address spaces
+ * that the reaper has yet to get to are torn down first, since that
+ * frees pages without writing any. */
+static void
+kswapd (void *aux UNUSED) {
+	kswapd_thread = thread_current ();
+	for (;;) {
+		bool stuck = false;
+
+		sema_down (&kswapd_sema);
+		kswapd_wake_cnt++;
+
+		/* Clean file pages are cheap to evict. */
+		file_flush_async ();
+		while (palloc_below_wmark (PAL_USER, WMARK_HIGH)) {
+			struct frame *frame;
+
+			if (reap_one ()) {
+				reap_kswapd_cnt++;
+				continue;
+			}
+			frame = vm_evict_frame (NULL);
+
+			if (frame == NULL) {
+				stuck = true;
+				break;
+			}
+			release_frame (frame);
+		}
+		if (stuck)
+			timer_sleep (KSWAPD_BACKOFF);
+		kswapd_pending = false;
+	}
+}
+
+/* Unmaps PAGE from its owner's address space, if it is in memory,
+ * and gives its frame back to the user pool, unless other pages still
+ * share it.  A huge page is split first, so that the rest of it stays
+ * mapped. */
+void
+vm_free_frame (struct page *page) {
+	struct frame *frame = page->frame;
+
+	if (frame == NULL)
+		return;
+	if (frame->huge)
+		thp_split (page);
+	pml4_clear_page (page->spt->owner->pml4, page->va);
+	page->frame = NULL;
+	page->spt->rss--;
+	if (frame_is_shared (frame))
+		frame_unshare (frame, page);
+	else
+		release_frame (frame);
 }
 
-/* Handle the fault on write_protected page */
+/* Maps PAGE, which is in memory, into its owner's address space,
+ * read-only if it shares its frame. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+map_page (struct page *page) {
+	return pml4_set_page (page->spt->owner->pml4, page->va, page->frame->kva,
+			page->writable && !frame_is_shared (page->frame));
 }
 
-/* Return true on success */
+/* Growing the stack.  Returns true if a page was added for ADDR. */
+static bool
+vm_stack_growth (void *addr) {
+	return vm_alloc_page (VM_ANON | VM_STACK, pg_round_down (addr), true);
+}
+
+/* Returns true if PAGE is a fresh anonymous page that would be
+ * filled with zeros when it is brought in. */
+static bool
+is_zero_fill (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& VM_TYPE (page->uninit.type) == VM_ANON
+		&& page->uninit.init == NULL;
+}
+
+/* Maps PAGE, a fresh anonymous page that is only being read, to the
+ * shared zero page, read-only, so that it takes no memory until it is
+ * written to.  The write faults, and vm_try_handle_fault() brings
+ * the page in for real then.  The caller holds the SPT lock. */
+static bool
+map_zero_page (struct page *page) {
+	if (!pml4_set_page (page->spt->owner->pml4, page->va, zero_page, false))
+		return false;
+	if (!page->zero_mapped) {
+		page->zero_mapped = true;
+		zero_map_cnt++;
+		zero_map_total++;
+	}
+	return true;
+}
+
+/* Unmaps PAGE from the shared zero page, if it is mapped there.  The
+ * caller holds the SPT lock. */
+void
+vm_unmap_zero_page (struct page *page) {
+	if (page->zero_mapped) {
+		pml4_clear_page (page->spt->owner->pml4, page->va);
+		page->zero_mapped = false;
+		zero_map_cnt--;
+	}
+}
+
+/* Handle the fault on write_protected page
+ *
+ * PAGE is writable and in memory, but shares its frame with copies
+ * of it in other address spaces since a fork, and is mapped read-only
+ * for that.  Gives PAGE a private copy of the frame, or, if the other
+ * pages have stopped sharing it in the meantime, just makes the
+ * mapping writable.  The caller holds the SPT lock. */
+static bool
+vm_handle_wp (struct page *page) {
+	uint64_t *pml4 = page->spt->owner->pml4;
+	struct frame *shared, *frame;
+
+	if (!frame_is_shared (page->frame)) {
+		cow_reuse_cnt++;
+		return map_page (page);
+	}
+
+	/* Finding a frame may evict PAGE's frame, since we hold the SPT
+	 * lock, or may see it stop being shared.  PAGE is in memory
+	 * already, so the frame does not count against the limit. */
+	frame = vm_get_frame (NULL);
+	if (frame == NULL)
+		return false;
+	shared = page->frame;
+	if (shared == NULL)
+		return vm_claim_frame (page, frame);
+	if (!frame_is_shared (shared)) {
+		release_frame (frame);
+		cow_reuse_cnt++;
+		return map_page (page);
+	}
+
+	memcpy (frame->kva, shared->kva, PGSIZE);
+	pml4_clear_page (pml4, page->va);
+	frame_unshare (shared, page);
+	frame->page = page;
+	page->frame = frame;
+	if (!pml4_set_page (pml4, page->va, frame->kva, true))
+		return false;
+	/* Whatever copy of the page swap holds predates the write. */
+	if (VM_TYPE (page->operations->type) == VM_ANON)
+		anon_forget_copy (page);
+	cow_copy_cnt++;
+	return true;
+}
+
+/* Fault-around.
+ *
+ * A read fault on a page that is read in from a file, such as a page
+ * of an executable, also reads in the pages around it in the same
+ * file, so that the accesses that usually follow do not fault one by
+ * one.  The pages come from an aligned window of AROUND_WINDOW pages
+ * that contains the fault, and only from the free user pool: reading
+ * around is not worth evicting for.
+ *
+ * Each table adapts its window to how many of the pages mapped
+ * around last time were accessed since, as their accessed bits tell:
+ * it halves the window when fewer than a quarter of them were, and
+ * doubles it, up to -faultaround, when at least three quarters
+ * were. */
+
+/* Returns PAGE's load parameters if it is read in from a file when it
+ * is first brought in, or a null pointer otherwise. */
+static struct file_load_aux *
+file_load_aux (struct page *page) {
+	if (page == NULL || page->frame != NULL
+			|| VM_TYPE (page->operations->type) != VM_UNINIT
+			|| page->uninit.init != file_load_page)
+		return NULL;
+	return page->uninit.aux;
+}
+
+/* Counts the pages that SPT's last fault-around mapped and that were
+ * accessed since, and adapts SPT's window to the ratio. */
+static void
+fault_around_account (struct supplemental_page_table *spt) {
+	size_t mapped = 0, hits = 0;
+
+	for (size_t i = 0; i < FAULT_AROUND_MAX; i++)
+		if (spt->around_mask & (1ULL << i)) {
+			struct page *p = spt_find_page (spt,
+					(uint8_t *) spt->around_start + i * PGSIZE);
+
+			mapped++;
+			if (p != NULL && p->frame != NULL && vm_page_referenced (p))
+				hits++;
+		}
+	spt->around_mask = 0;
+	around_hit_cnt += hits;
+
+	if (mapped == 0)
+		return;
+	if (hits * 4 < mapped && spt->around_window > FAULT_AROUND_MIN)
+		spt->around_window /= 2;
+	else if (hits * 4 >= mapped * 3 && spt->around_window < fault_around_pages)
+		spt->around_window *= 2;
+}
+
+/* Reads in and maps those of the WINDOW pages of SPT from START on
+ * that are read in from the same place in the same file as VA, which
+ * just faulted in from LOAD->file at LOAD->ofs.  Sets the bits of
+ * *MASK for the pages mapped, and returns their number.  The caller
+ * holds the SPT lock. */
+static size_t
+map_around (struct supplemental_page_table *spt, uint8_t *start,
+		size_t window, uint8_t *va, const struct file_load_aux *load,
+		uint64_t *mask) {
+	size_t mapped = 0;
+
+	*mask = 0;
+	for (size_t i = 0; i < window; i++) {
+		uint8_t *n = start + i * PGSIZE;
+		struct page *p = n != va ? spt_find_page (spt, n) : NULL;
+		struct file_load_aux *aux = file_load_aux (p);
+		struct frame *frame;
+
+		if (aux == NULL || aux->file != load->file
+				|| aux->ofs - load->ofs != n - va)
+			continue;
+		if (!vm_rss_room (spt, 1))
+			break;
+		if (!text_share (p)) {
+			frame = alloc_frame ();
+			if (frame == NULL)
+				break;
+			if (!vm_claim_frame (p, frame))
+				continue;
+		}
+		*mask |= 1ULL << i;
+		mapped++;
+	}
+	return mapped;
+}
+
+/* Reads in and maps the pages of SPT around VA, which just faulted
+ * in from LOAD->file at LOAD->ofs, that are read in from the same
+ * place in the same file.  The caller holds the SPT lock. */
+static void
+fault_around (struct supplemental_page_table *spt, uint8_t *va,
+		const struct file_load_aux *load) {
+	size_t window;
+	uint8_t *start;
+
+	fault_around_account (spt);
+	window = spt->around_window;
+	start = (uint8_t *) ((uint64_t) va & ~(window * PGSIZE - 1));
+	around_map_cnt += map_around (spt, start, window, va, load,
+			&spt->around_mask);
+	spt->around_start = start;
+	spt->around_used = true;
+	around_fault_cnt++;
+}
+
+/* Shared text.
+ *
+ * The read-only pages of an executable are the same in every process
+ * that runs it.  Once one of them is read in, its frame is listed by
+ * the executable's inode and the page's offset, see frame.c, and the
+ * same page of another process maps that frame read-only instead of
+ * reading a copy of its own.  The frame is shared like a frame after
+ * a fork, so it is freed when the last page that maps it goes, or
+ * when it is evicted from under all of them. */
+
+/* Sets *KEY to what PAGE holds, if it is a read-only page of an
+ * executable that is not in memory yet.  Returns false otherwise. */
+static bool
+text_key (struct page *page, struct text_key *key) {
+	struct file_load_aux *aux = file_load_aux (page);
+
+	if (aux == NULL || page->writable
+			|| VM_TYPE (page->uninit.type) != VM_ANON)
+		return false;
+	*key = (struct text_key) {
+		.inode = file_get_inode (aux->file),
+		.ofs = aux->ofs,
+		.read_bytes = aux->read_bytes,
+	};
+	return true;
+}
+
+/* Brings PAGE in by mapping the frame of another process's copy of
+ * it, if PAGE is a page of shared text and such a frame is in memory.
+ * Returns true if successful.  The caller holds the SPT lock. */
+static bool
+text_share (struct page *page) {
+	uint64_t *pml4 = page->spt->owner->pml4;
+	struct text_key key;
+	struct frame *frame;
+	void *aux;
+
+	if (!text_key (page, &key))
+		return false;
+	frame = frame_text_share (&key, page);
+	if (frame == NULL)
+		return false;
+	if (!pml4_set_page (pml4, page->va, frame->kva, false)) {
+		page->frame = NULL;
+		frame_unshare (frame, page);
+		return false;
+	}
+	page->spt->rss++;
+
+	/* The contents are in place, so skip the initializer. */
+	aux = page->uninit.aux;
+	anon_adopt (page);
+	free (aux);
+	text_share_cnt++;
+	return true;
+}
+
+/* Advice.
+ *
+ * madvise() tells the VM how a range of pages will be used.  Each
+ * page keeps MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL as its ADVICE
+ * until it is given other advice.  A fault on a MADV_RANDOM page reads
+ * in just that page.  A fault on a MADV_SEQUENTIAL page that is read
+ * in from a file reads FAULT_AROUND_MAX pages ahead of it, whatever
+ * the adaptive window says, and takes the accessed bits of the
+ * sequential pages behind it, so that the clock evicts them first.
+ *
+ * MADV_WILLNEED and MADV_DONTNEED act at once instead.  The first
+ * queues the range on its table for kprefetchd, which reads in what
+ * it can of it from free memory, without evicting anything.  The
+ * second throws away the contents of the writable anonymous pages in
+ * the range, which read back as zeros, as fresh pages.  That includes
+ * the pages of an executable's data segment, which no longer know
+ * where in the file they came from. */
+
+/* A range of pages queued for kprefetchd. */
+struct prefetch_range {
+	struct list_elem elem;      /* Element in spt->prefetch. */
+	uint8_t *start;             /* First page. */
+	uint8_t *end;               /* Page past the last. */
+};
+
+/* Sets *START and *END to the pages that the LENGTH bytes from ADDR
+ * span, if ADDR is page-aligned and the range is non-empty and lies
+ * in user space.  Returns false otherwise. */
+bool
+vm_user_range (void *addr, size_t length, uint8_t **start, uint8_t **end) {
+	uint64_t last = (uint64_t) addr + length - 1;
+
+	if (pg_ofs (addr) != 0 || length == 0 || last < (uint64_t) addr
+			|| !is_user_vaddr (last))
+		return false;
+	*start = addr;
+	*end = pg_round_up (last + 1);
+	return true;
+}
+
+/* Sets PAGE's advice to *ADVICE_. */
+static void
+set_advice (struct page *page, void *advice_) {
+	const int *advice = advice_;
+
+	page->advice = *advice;
+}
+
+/* Throws away the contents of PAGE, if it is a writable anonymous
+ * page that has been brought in, so that it reads back as it was
+ * first brought in: from the executable if it was read from there,
+ * as zeros otherwise. */
+static void
+discard_page (struct page *page, void *aux UNUSED) {
+	struct supplemental_page_table *spt = page->spt;
+	bool writable = page->writable;
+	unsigned char advice = page->advice;
+	struct file_load_aux *load;
+
+	if (VM_TYPE (page->operations->type) != VM_ANON || !writable)
+		return;
+	load = anon_exec_load (page);
+	if (page->anon.exec && load == NULL)
+		return;
+	destroy (page);
+	uninit_new (page, page->va, load != NULL ? file_load_page : NULL,
+			VM_ANON, load, anon_initializer);
+	page->spt = spt;
+	page->writable = writable;
+	page->advice = advice;
+	discard_cnt++;
+}
+
+/* Queues the pages from START to END of SPT for kprefetchd.  Returns
+ * false if memory runs out.  The caller holds the SPT lock. */
+static bool
+queue_prefetch (struct supplemental_page_table *spt, uint8_t *start,
+		uint8_t *end) {
+	struct prefetch_range *r = malloc (sizeof *r);
+
+	if (r == NULL)
+		return false;
+	r->start = start;
+	r->end = end;
+	list_push_back (&spt->prefetch, &r->elem);
+	sema_up (&prefetch_sema);
+	return true;
+}
+
+/* Reads PAGE in for kprefetchd, if it is not in memory and there is a
+ * free frame for it. */
+static void
+prefetch_page (struct page *page, void *aux UNUSED) {
+	struct frame *frame;
+
+	if (page->frame != NULL || is_zero_fill (page)
+			|| !vm_rss_room (page->spt, 1))
+		return;
+	if (!text_share (page)) {
+		frame = alloc_frame ();
+		if (frame == NULL || !vm_claim_frame (page, frame))
+			return;
+	}
+	prefetch_cnt++;
+}
+
+/* Reads in SPT's queued ranges. */
+static void
+prefetch_queued (struct supplemental_page_table *spt, void *aux UNUSED) {
+	if (spt->owner->pml4 == NULL)
+		return;
+	while (!list_empty (&spt->prefetch)) {
+		struct prefetch_range *r = list_entry (list_pop_front (&spt->prefetch),
+				struct prefetch_range, elem);
+
+		spt_for_each_page (spt, r->start, r->end, prefetch_page, NULL);
+		free (r);
+	}
+}
+
+/* Background thread that reads in the ranges queued by
+ * MADV_WILLNEED. */
+static void
+prefetchd (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&prefetch_sema);
+		spt_for_each (prefetch_queued, NULL);
+	}
+}
+
+/* Reads ahead of VA, a MADV_SEQUENTIAL page that just faulted in from
+ * LOAD->file at LOAD->ofs, and drops the pages behind it.  The caller
+ * holds the SPT lock. */
+static void
+read_sequential (struct supplemental_page_table *spt, uint8_t *va,
+		const struct file_load_aux *load) {
+	uint64_t mask;
+
+	seq_ahead_cnt += map_around (spt, va + PGSIZE, FAULT_AROUND_MAX, va,
+			load, &mask);
+	for (size_t i = 1; i <= 2 * FAULT_AROUND_MAX; i++) {
+		struct page *p;
+
+		if ((uint64_t) va < i * PGSIZE)
+			break;
+		p = spt_find_page (spt, va - i * PGSIZE);
+		if (p != NULL && p->frame != NULL && p->advice == MADV_SEQUENTIAL)
+			vm_page_unreference (p);
+	}
+}
+
+/* Applies ADVICE, one of the MADV_* values in <mman.h>, to the LENGTH
+ * bytes of the running process's memory from ADDR on, for madvise().
+ * Returns false, without applying anything, if ADDR is not
+ * page-aligned, if a page of the range does not exist, or if ADVICE
+ * is unknown. */
+bool
+vm_madvise (void *addr, size_t length, int advice) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *start, *end, *va;
+	bool success = true;
+
+	if (!vm_user_range (addr, length, &start, &end)
+			|| advice < MADV_NORMAL || advice > MADV_DONTNEED)
+		return false;
+
+	lock_acquire (&spt->lock);
+	for (va = start; va < end && success; va += PGSIZE)
+		success = spt_find_page (spt, va) != NULL;
+	if (success)
+		switch (advice) {
+			case MADV_WILLNEED:
+				success = queue_prefetch (spt, start, end);
+				break;
+			case MADV_DONTNEED:
+				spt_for_each_page (spt, start, end, discard_page, NULL);
+				break;
+			default:
+				spt_for_each_page (spt, start, end, set_advice, &advice);
+				break;
+		}
+	lock_release (&spt->lock);
+	return success;
+}
+
+/* Brings in every page of the LENGTH bytes of the running process's
+ * memory from ADDR on, in one pass, for mmap() with MAP_POPULATE, so
+ * that accessing them does not fault.  Zero-filled blocks come in as
+ * huge pages where they can.  Returns false if ADDR is not
+ * page-aligned, if a page of the range does not exist, or if memory
+ * runs out. */
+bool
+vm_populate (void *addr, size_t length) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *start, *end, *va;
+	bool success;
+
+	if (!vm_user_range (addr, length, &start, &end))
+		return false;
+
+	lock_acquire (&spt->lock);
+	success = true;
+	for (va = start; va < end && success; va += PGSIZE) {
+		struct page *page = spt_find_page (spt, va);
+
+		if (page == NULL)
+			success = false;
+		else if (page->frame == NULL) {
+			vm_unmap_zero_page (page);
+			success = thp_claim (page) || vm_do_claim_page (page);
+			if (success)
+				populate_cnt++;
+		}
+	}
+	lock_release (&spt->lock);
+	return success;
+}
+
+/* Working sets.
+ *
+ * Each table counts its pages that are in memory, its resident set,
+ * in RSS, including the pages that share a frame with other tables.
+ * A table may be held to RSS_LIMIT pages, -rsslimit for every table
+ * by default.  A fault of a table at its limit evicts one of the
+ * table's own pages to make room, and fault-around, read-ahead,
+ * prefetching and huge pages stop short of the limit.  The limit is
+ * soft: when none of the table's pages can be evicted, because they
+ * are shared or busy, the table grows past it, and then loses its
+ * pages first whenever anyone evicts, see frame_pick_victim().
+ *
+ * Once every WS_INTERVAL, kwsd takes the accessed bits of every
+ * table's mappings.  The pages accessed in the interval are the
+ * working set of the moment, and WSS averages it over the last few
+ * intervals.  A table with many more pages in memory than in its
+ * working set holds pages that it does not use, and the clock takes
+ * those before the pages of tables that use all of theirs.  kwsd
+ * also turns each table's fault count into a rate. */
+
+/* Returns true if SPT has more pages in memory than its limit. */
+bool
+vm_over_rss_limit (const struct supplemental_page_table *spt) {
+	return spt->rss_limit != 0 && spt->rss > spt->rss_limit;
+}
+
+/* Returns true if CNT more pages of SPT fit in memory under its
+ * limit. */
+bool
+vm_rss_room (const struct supplemental_page_table *spt, size_t cnt) {
+	return spt->rss_limit == 0 || spt->rss + cnt <= spt->rss_limit;
+}
+
+/* Returns true if SPT has more than a quarter more pages in memory
+ * than in its working set, as last sampled. */
+bool
+vm_above_working_set (const struct supplemental_page_table *spt) {
+	return spt->wss_sampled && spt->rss > spt->wss + spt->wss / 4;
+}
+
+/* Moves the accessed bit of PAGE, if it is in memory, into its
+ * referenced bit, and counts it in *ACCESSED_, a size_t, if set. */
+static void
+sample_page (struct page *page, void *accessed_) {
+	size_t *accessed = accessed_;
+
+	if (page->frame != NULL
+			&& pml4_is_accessed (page->spt->owner->pml4, page->va)) {
+		page->referenced = true;
+		(*accessed)++;
+	}
+}
+
+/* Samples SPT's working set and fault rate, and sets *EXCESS_, a
+ * bool, if SPT is above its working set.  The accessed bits are
+ * cleared, so that the next sample counts the pages used since, but
+ * what they said lives on in the pages' referenced bits for the
+ * clock and for fault-around. */
+static void
+sample_working_set (struct supplemental_page_table *spt, void *excess_) {
+	bool *excess = excess_;
+	size_t accessed = 0;
+
+	if (spt->owner->pml4 == NULL)
+		return;
+	spt_for_each_page (spt, NULL, (void *) KERN_BASE, sample_page, &accessed);
+	pml4_harvest_range (spt->owner->pml4, NULL, KERN_BASE / PGSIZE, PTE_A,
+			NULL);
+	spt->wss = spt->wss_sampled ? (spt->wss + accessed + 1) / 2 : accessed;
+	spt->wss_sampled = true;
+	spt->fault_rate = (spt->fault_cnt - spt->sampled_fault_cnt)
+		* TIMER_FREQ / WS_INTERVAL;
+	spt->sampled_fault_cnt = spt->fault_cnt;
+	if (vm_above_working_set (spt))
+		*excess = true;
+	ws_sample_cnt++;
+}
+
+/* Background thread that samples working sets. */
+static void
+kwsd (void *aux UNUSED) {
+	for (;;) {
+		bool excess = false;
+
+		timer_sleep (WS_INTERVAL);
+		spt_for_each (sample_working_set, &excess);
+		ws_excess = excess;
+	}
+}
+
+/* What vm_memstat() looks for and fills in. */
+struct memstat_query {
+	tid_t tid;                  /* Owner of the table to report on. */
+	struct memstat st;          /* What was found. */
+	bool found;                 /* Was the table found? */
+};
+
+/* Fills in QUERY_, a struct memstat_query, from SPT if SPT belongs
+ * to the thread that QUERY_ asks about. */
+static void
+memstat_spt (struct supplemental_page_table *spt, void *query_) {
+	struct memstat_query *query = query_;
+
+	if (spt->owner->tid != query->tid || spt->dying)
+		return;
+	query->st = (struct memstat) {
+		.rss = spt->rss,
+		.rss_limit = spt->rss_limit,
+		.wss = spt->wss,
+		.fault_cnt = spt->fault_cnt,
+		.fault_rate = spt->fault_rate,
+	};
+	query->found = true;
+}
+
+/* Fills in *ST with the use of memory of the process whose thread is
+ * TID, for memstat().  Returns false if there is no such process.  ST
+ * may be in user memory: it is written to with no table locked. */
+bool
+vm_memstat (tid_t tid, struct memstat *st) {
+	struct memstat_query query = { .tid = tid, .found = false };
+
+	spt_for_each (memstat_spt, &query);
+	if (query.found)
+		*st = query.st;
+	return query.found;
+}
+
+/* Returns the cause, as in <mman.h>, of a fault on PAGE, which is
+ * being handled.  NOT_PRESENT is as for vm_try_handle_fault(). */
+static int
+fault_cause (struct page *page, bool not_present) {
+	if (!not_present && page->frame != NULL)
+		return FAULT_COW;
+	if (page->zero_mapped || is_zero_fill (page))
+		return FAULT_ZERO;
+	if (page->frame != NULL)
+		return FAULT_MINOR;
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_UNINIT:
+			return VM_TYPE (page->uninit.type) == VM_FILE ?
+				FAULT_FILE : FAULT_LAZY;
+		case VM_ANON:
+			return FAULT_SWAP;
+		default:
+			return FAULT_FILE;
+	}
+}
+
+/* Return true on success
+ *
+ * Every fault of a process is recorded by cause, with the time it
+ * took to handle, see faultstat.c. */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint64_t start = rdtsc ();
 	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+	bool success = false, grew = false;
+	int cause = FAULT_BAD;
+
+	if (spt->owner == NULL)
+		return false;
+	if (addr == NULL || is_kernel_vaddr (addr) || (!not_present && !write))
+		goto done;
 
-	return vm_do_claim_page (page);
+	/* A push may fault a little below the stack pointer. */
+	if (user && (uint64_t) addr >= f->rsp - 8
+			&& (uint64_t) addr >= USER_STACK - STACK_LIMIT
+			&& (uint64_t) addr < USER_STACK)
+		grew = vm_stack_growth (addr);
+
+	lock_acquire (&spt->lock);
+	spt->fault_cnt++;
+	page = spt_find_page (spt, addr);
+	if (page != NULL && (page->writable || !write)) {
+		cause = grew ? FAULT_STACK : fault_cause (page, not_present);
+		if (!not_present && page->frame != NULL)
+			/* A write to a page shared copy-on-write. */
+			success = vm_handle_wp (page);
+		else if (!not_present && !page->zero_mapped)
+			success = false;
+		else if (!write && page->frame == NULL && is_zero_fill (page))
+			success = map_zero_page (page);
+		else if (page->frame != NULL)
+			/* In memory, but its huge page went away under it, or a
+			 * kernel thread just remapped it. */
+			success = pml4_get_page (spt->owner->pml4, page->va) != NULL
+				|| map_page (page);
+		else {
+			struct file_load_aux *aux = file_load_aux (page);
+			struct file_load_aux load;
+			bool ahead = aux != NULL && page->advice == MADV_SEQUENTIAL;
+			bool around = !write && aux != NULL
+				&& page->advice == MADV_NORMAL && spt->around_window > 1;
+
+			/* Claiming the page frees its aux. */
+			if (ahead || around)
+				load = *aux;
+			vm_unmap_zero_page (page);
+			success = thp_claim (page) || vm_do_claim_page (page);
+			if (success && ahead)
+				read_sequential (spt, page->va, &load);
+			else if (success && around)
+				fault_around (spt, page->va, &load);
+		}
+	}
+	lock_release (&spt->lock);
+
+done:
+	faultstat_record (spt, success ? cause : FAULT_BAD, rdtsc () - start);
+	return success;
 }
 
 /* Free the page.
@@ -150,41 +1410,350 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page;
+	bool success = false;
 
-	return vm_do_claim_page (page);
+	lock_acquire (&spt->lock);
+	page = spt_find_page (spt, va);
+	if (page != NULL) {
+		vm_unmap_zero_page (page);
+		success = page->frame != NULL || vm_do_claim_page (page);
+	}
+	lock_release (&spt->lock);
+	return success;
 }
 
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	struct frame *frame;
+
+	if (text_share (page))
+		return true;
+	frame = vm_get_frame (page->spt);
+	return frame != NULL && vm_claim_frame (page, frame);
+}
+
+/* Brings PAGE into FRAME, a free frame, and maps it.  Gives FRAME
+ * back on failure. */
+static bool
+vm_claim_frame (struct page *page, struct frame *frame) {
+	uint64_t *pml4 = page->spt->owner->pml4;
+	struct text_key key;
+	bool text, mapped, success;
+
+	/* Reading it in frees what tells shared text apart. */
+	text = text_key (page, &key);
 
 	/* Set links */
 	frame->page = page;
 	page->frame = frame;
+	page->referenced = false;
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	/* Keep the frame from being evicted while it is read in. */
+	frame->pinned = true;
+	mapped = pml4_set_page (pml4, page->va, frame->kva, page->writable);
+	success = mapped && swap_in (page, frame->kva);
+	frame->pinned = false;
+	if (!success) {
+		if (mapped)
+			pml4_clear_page (pml4, page->va);
+		page->frame = NULL;
+		frame->page = NULL;
+		release_frame (frame);
+		return false;
+	}
+	page->spt->rss++;
+	if (text) {
+		frame_text_insert (frame, &key);
+		text_read_cnt++;
+	}
+	return true;
+}
 
-	return swap_in (page, frame->kva);
+/* Frees a page while its table is destroyed. */
+static void
+destroy_page (struct page *page, void *aux UNUSED) {
+	vm_dealloc_page (page);
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	spt->root = palloc_get_page (PAL_ZERO);
+	if (spt->root == NULL)
+		PANIC ("supplemental_page_table_init: out of memory");
+	spt->page_cnt = 0;
+	lock_init (&spt->lock);
+	list_init (&spt->thp_blocks);
+	list_init (&spt->prefetch);
+	list_init (&spt->mmaps);
+	spt->around_window = fault_around_pages;
+	spt->around_mask = 0;
+	spt->around_used = false;
+	spt->rss = 0;
+	spt->rss_limit = rss_limit_pages;
+	spt->wss = 0;
+	spt->wss_sampled = false;
+	spt->fault_cnt = 0;
+	memset (spt->fault_causes, 0, sizeof spt->fault_causes);
+	spt->sampled_fault_cnt = 0;
+	spt->fault_rate = 0;
+	spt->dying = false;
+	spt->owner = thread_current ();
+
+	lock_acquire (&spt_list_lock);
+	list_push_back (&spt_list, &spt->elem);
+	lock_release (&spt_list_lock);
 }
 
-/* Copy supplemental page table from src to dst */
+/* A supplemental page table being copied. */
+struct spt_copy {
+	struct supplemental_page_table *src;  /* Table to copy from. */
+	struct supplemental_page_table *dst;  /* Table to copy into. */
+	uint8_t *wp_start;          /* Run of source pages that share their */
+	size_t wp_cnt;              /* frames now, to write-protect. */
+	bool success;               /* False once memory ran out. */
+};
+
+/* Write-protects the source pages of COPY's run, with one TLB flush
+ * for all of them, and starts a new run. */
+static void
+write_protect_run (struct spt_copy *copy) {
+	if (copy->wp_cnt > 0)
+		pml4_harvest_range (copy->src->owner->pml4, copy->wp_start,
+				copy->wp_cnt, PTE_W, NULL);
+	copy->wp_cnt = 0;
+}
+
+/* Makes CHILD a copy of PAGE, which has not been brought in yet, to
+ * be brought in by itself in an address space that runs EXEC_FILE.
+ * Returns false if memory runs out. */
+static bool
+copy_uninit (struct page *page, struct page *child, struct file *exec_file) {
+	struct file_load_aux *aux = NULL;
+
+	if (page->uninit.init != NULL) {
+		/* Only executables are read in like this, see load_segment(). */
+		ASSERT (page->uninit.init == file_load_page);
+		if (exec_file == NULL || (aux = malloc (sizeof *aux)) == NULL)
+			return false;
+		*aux = *(struct file_load_aux *) page->uninit.aux;
+		aux->file = exec_file;
+	}
+	uninit_new (child, page->va, page->uninit.init, page->uninit.type, aux,
+			page->uninit.page_initializer);
+	child->writable = page->writable;
+	child->advice = page->advice;
+	return true;
+}
+
+/* Copies PAGE into the table that COPY_, a struct spt_copy, is
+ * filling in.  A page in memory shares its frame with its copy; any
+ * other page is copied as it is, without bringing it in. */
+static void
+copy_page (struct page *page, void *copy_) {
+	struct spt_copy *copy = copy_;
+	struct page *child;
+
+	/* File mappings are not inherited. */
+	if (!copy->success || page_get_type (page) == VM_FILE)
+		return;
+	child = malloc (sizeof *child);
+	if (child == NULL)
+		goto fail;
+
+	if (VM_TYPE (page->operations->type) == VM_UNINIT) {
+		if (!copy_uninit (page, child, copy->dst->owner->exec_file))
+			goto fail_free;
+		if (!spt_insert_page (copy->dst, child)) {
+			vm_dealloc_page (child);
+			goto fail;
+		}
+		cow_out_cnt++;
+		return;
+	}
+
+	/* The shared frame is mapped by 4 kB pages only. */
+	if (page->frame != NULL && page->frame->huge)
+		thp_split (page);
+
+	*child = *page;
+	child->frame = NULL;
+	child->next_sharer = NULL;
+	child->referenced = false;
+	child->anon.slot = SWAP_SLOT_NONE;
+	child->anon.zentry = NULL;
+	child->anon.zero = false;
+	if (!spt_insert_page (copy->dst, child))
+		goto fail_free;
+	if (page->frame == NULL) {
+		/* Swapped out: both share the copy in swap. */
+		anon_share_copy (page, child);
+		cow_out_cnt++;
+		return;
+	}
+
+	frame_share (page->frame, child);
+	copy->dst->rss++;
+	cow_share_cnt++;
+	if (!pml4_set_page (copy->dst->owner->pml4, child->va,
+				child->frame->kva, false))
+		copy->success = false;
+	if (copy->wp_cnt > 0
+			&& copy->wp_start + copy->wp_cnt * PGSIZE != (uint8_t *) page->va)
+		write_protect_run (copy);
+	if (copy->wp_cnt++ == 0)
+		copy->wp_start = page->va;
+	return;
+
+fail_free:
+	free (child);
+fail:
+	copy->success = false;
+}
+
+/* Copy supplemental page table from src to dst
+ *
+ * Copies the pages of SRC into DST, which must belong to the current
+ * thread and run the same executable, copy-on-write: the pages that
+ * are in memory share their frames read-only with their copies until
+ * either side writes, see vm_handle_wp(), and the pages that are
+ * swapped out share their copies in swap.  Pages that were never
+ * brought in stay that way in both.  Returns false if memory runs
+ * out, in which case the caller kills DST. */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct spt_copy copy = { .src = src, .dst = dst, .success = true };
+
+	lock_acquire (&src->lock);
+	lock_acquire (&dst->lock);
+	spt_for_each_page (src, NULL, (void *) KERN_BASE, copy_page, &copy);
+	write_protect_run (&copy);
+	lock_release (&dst->lock);
+	lock_release (&src->lock);
+	return copy.success;
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	/* Kernel threads never set up a table. */
+	if (spt->owner == NULL)
+		return;
+
+	lock_acquire (&spt_list_lock);
+	list_remove (&spt->elem);
+	lock_release (&spt_list_lock);
+
+	lock_acquire (&spt->lock);
+	if (spt->around_used) {
+		fault_around_account (spt);
+		around_exec_cnt++;
+	}
+	thp_kill (spt);
+	while (!list_empty (&spt->prefetch))
+		free (list_entry (list_pop_front (&spt->prefetch),
+					struct prefetch_range, elem));
+	file_unmap_all (spt);
+	spt_remove_range (spt, NULL, (void *) KERN_BASE);
+	palloc_free_page (spt->root);
+	spt->root = NULL;
+	spt->owner = NULL;
+	lock_release (&spt->lock);
+}
+
+/* Called by process_exit() for the current thread, which is about
+ * to die.  Returns true if its address space is left to the reaper,
+ * in which case the caller is done; false if the caller must tear it
+ * down itself.  The process is gone for memstat() and faultstat()
+ * either way. */
+bool
+vm_reap_later (void) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	enum intr_level old_level;
+
+	if (!reaper_enabled || spt->owner == NULL)
+		return false;
+	old_level = intr_disable ();
+	spt->dying = true;
+	reap_backlog++;
+	intr_set_level (old_level);
+	return true;
+}
+
+/* Called by the scheduler, with interrupts off, for T, which has
+ * died.  Queues T for the reaper and returns true if vm_reap_later()
+ * left its address space behind.  The reaper then frees T's page
+ * too, since the address space is reached through it. */
+bool
+vm_reap (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!t->spt.dying)
+		return false;
+	list_push_back (&reap_list, &t->elem);
+	/* sema_up() may yield, which the scheduler must not. */
+	if (reaper_idle) {
+		reaper_idle = false;
+		thread_unblock (reaper_thread);
+	}
+	return true;
+}
+
+/* Returns the number of address spaces left to tear down. */
+size_t
+vm_reap_backlog (void) {
+	return reap_backlog;
+}
+
+/* Tears down the address space of one dead thread, if any is
+ * queued, and frees the thread.  Returns true if there was one. */
+static bool
+reap_one (void) {
+	enum intr_level old_level;
+	struct thread *t = NULL;
+
+	old_level = intr_disable ();
+	if (!list_empty (&reap_list))
+		t = list_entry (list_pop_front (&reap_list), struct thread, elem);
+	intr_set_level (old_level);
+	if (t == NULL)
+		return false;
+
+	/* Nothing runs in it anymore, so it needs no switching to. */
+	reap_page_cnt += t->spt.page_cnt;
+	supplemental_page_table_kill (&t->spt);
+	file_close (t->exec_file);
+	pml4_destroy (t->pml4);
+	palloc_free_page (t);
+	reap_cnt++;
+
+	old_level = intr_disable ();
+	reap_backlog--;
+	intr_set_level (old_level);
+	return true;
+}
+
+/* Reaper thread.  Frees the frames, swap slots and page tables of
+ * processes that have exited, and writes back their dirty file
+ * mappings, so that exiting, and waiting for the exit, costs the
+ * same whatever the size of the address space.  It runs at the
+ * lowest priority, and kswapd takes over when memory runs low. */
+static void
+reaper (void *aux UNUSED) {
+	reaper_thread = thread_current ();
+	for (;;) {
+		enum intr_level old_level = intr_disable ();
+
+		while (list_empty (&reap_list)) {
+			reaper_idle = true;
+			thread_block ();
+		}
+		intr_set_level (old_level);
+		reap_one ();
+	}
 }
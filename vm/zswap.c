@@ -0,0 +1,338 @@
+/* zswap.c: Compressed swap pool in front of the swap disk.
+ *
+ * With -zswap=PCT, anonymous pages on their way out are compressed
+ * into a pool of kernel pages that may take up PCT% of physical
+ * memory, and most faults on them decompress them from there instead
+ * of waiting for the disk.  Pages that do not shrink to
+ * ZSWAP_MAX_SIZE bytes go to the disk directly.
+ *
+ * The pool is laid out as in Linux's zbud: every pool page holds up
+ * to two compressed pages, one at each end, so finding room takes a
+ * look at one list and freeing never moves anything.  Pool pages with
+ * one free end are bucketed by how much room they have left, in
+ * chunks of ZCHUNK bytes.
+ *
+ * Once the pool is full, the pages that went into it first are
+ * decompressed and written to the swap disk, a batch at a time, to
+ * make room.  Their entries then hold the swap slot instead.
+ *
+ * Like a swap slot, an entry may hold the copy of several pages, each
+ * with a reference to it, see swap.c. */
+
+#include "vm/zswap.h"
+#include <debug.h>
+#include <list.h>
+#include <lz.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/swap.h"
+#include "intrinsic.h"
+
+/* Pool pages are divided into ZCHUNK_CNT chunks of ZCHUNK bytes. */
+#define ZCHUNK 64
+#define ZCHUNK_CNT (PGSIZE / ZCHUNK)
+#define size_to_chunks(size) (((size) + ZCHUNK - 1) / ZCHUNK)
+
+/* Largest compressed page worth keeping. */
+#define ZSWAP_MAX_SIZE (PGSIZE * 3 / 4)
+
+/* A page of the pool. */
+struct zpage {
+	struct list_elem elem;      /* Element in unbuddied[], if listed. */
+	uint8_t *kva;               /* The page. */
+	size_t first_chunks;        /* Chunks used at the start... */
+	size_t last_chunks;         /* ...and at the end, 0 if free. */
+};
+
+/* A compressed page, in the pool or on the swap disk. */
+struct zswap_entry {
+	struct list_elem lru;       /* Element in lru, while in the pool. */
+	struct zpage *zpage;        /* Pool page, or NULL if written back. */
+	bool last;                  /* At the end of ZPAGE, not the start? */
+	size_t size;                /* Compressed size in bytes. */
+	size_t slot;                /* Swap slot, once written back. */
+	unsigned ref_cnt;           /* Pages whose copy it holds. */
+};
+
+unsigned zswap_pct;
+
+static size_t pool_max;             /* Most pages in the pool. */
+static size_t pool_cnt;             /* Pages in the pool. */
+static struct list unbuddied[ZCHUNK_CNT];  /* By free chunks. */
+static struct list lru;             /* Pool entries, oldest first. */
+
+/* Scratch space: for the compressor, for its output, and for pages
+ * on their way to the disk. */
+static void *work;
+static uint8_t *zbuf;
+static void *bounce[SWAP_BATCH_MAX];
+
+/* Guards all of the above.  Held across writeback. */
+static struct lock zswap_lock;
+
+/* Statistics. */
+static long long stored_cnt;        /* Pages stored. */
+static long long stored_bytes;      /* ...and their compressed size. */
+static long long reject_cnt;        /* Pages that did not compress. */
+static long long hit_cnt;           /* Pages loaded from the pool. */
+static long long miss_cnt;          /* ...from the disk after writeback. */
+static long long writeback_cnt;     /* Pages written back. */
+static size_t entry_cnt;            /* Entries in the pool now. */
+static size_t pool_peak;            /* Most pages the pool ever had. */
+static uint64_t load_cycles;        /* Time spent decompressing. */
+
+/* Sets up the compressed swap pool, unless -zswap=0. */
+void
+zswap_init (void) {
+	if (zswap_pct == 0)
+		return;
+
+	pool_max = palloc_phys_page_cnt () * (zswap_pct > 100 ? 100 : zswap_pct)
+		/ 100;
+	for (size_t i = 0; i < ZCHUNK_CNT; i++)
+		list_init (&unbuddied[i]);
+	list_init (&lru);
+	lock_init (&zswap_lock);
+
+	work = palloc_get_page (0);
+	zbuf = palloc_get_page (0);
+	if (work == NULL || zbuf == NULL)
+		PANIC ("zswap_init: out of memory");
+	for (size_t i = 0; i < SWAP_BATCH_MAX; i++)
+		if ((bounce[i] = palloc_get_page (0)) == NULL)
+			PANIC ("zswap_init: out of memory");
+}
+
+/* Returns the number of free chunks of Z. */
+static size_t
+free_chunks (const struct zpage *z) {
+	return ZCHUNK_CNT - z->first_chunks - z->last_chunks;
+}
+
+/* Returns the address of E's data. */
+static uint8_t *
+entry_data (const struct zswap_entry *e) {
+	const struct zpage *z = e->zpage;
+	return e->last ? z->kva + PGSIZE - z->last_chunks * ZCHUNK : z->kva;
+}
+
+/* Finds room for E's SIZE bytes in the pool and sets E->zpage and
+ * E->last to it.  Returns false if the pool is full. */
+static bool
+zbud_alloc (struct zswap_entry *e) {
+	size_t chunks = size_to_chunks (e->size);
+	struct zpage *z = NULL;
+
+	for (size_t i = chunks; i < ZCHUNK_CNT; i++)
+		if (!list_empty (&unbuddied[i])) {
+			z = list_entry (list_pop_front (&unbuddied[i]), struct zpage, elem);
+			break;
+		}
+
+	if (z == NULL) {
+		if (pool_cnt >= pool_max || (z = malloc (sizeof *z)) == NULL)
+			return false;
+		z->kva = palloc_get_page (0);
+		if (z->kva == NULL) {
+			free (z);
+			return false;
+		}
+		z->first_chunks = z->last_chunks = 0;
+		if (++pool_cnt > pool_peak)
+			pool_peak = pool_cnt;
+	}
+
+	e->zpage = z;
+	e->last = z->first_chunks != 0;
+	if (e->last)
+		z->last_chunks = chunks;
+	else
+		z->first_chunks = chunks;
+	if (z->first_chunks == 0 || z->last_chunks == 0)
+		list_push_back (&unbuddied[free_chunks (z)], &z->elem);
+	return true;
+}
+
+/* Gives E's room in the pool back. */
+static void
+zbud_free (struct zswap_entry *e) {
+	struct zpage *z = e->zpage;
+	bool listed = z->first_chunks == 0 || z->last_chunks == 0;
+
+	if (listed)
+		list_remove (&z->elem);
+	if (e->last)
+		z->last_chunks = 0;
+	else
+		z->first_chunks = 0;
+	e->zpage = NULL;
+
+	if (z->first_chunks == 0 && z->last_chunks == 0) {
+		palloc_free_page (z->kva);
+		free (z);
+		pool_cnt--;
+	} else
+		list_push_back (&unbuddied[free_chunks (z)], &z->elem);
+}
+
+/* Decompresses E's data into KPAGE. */
+static void
+decompress (const struct zswap_entry *e, void *kpage) {
+	if (!lz_decompress (entry_data (e), e->size, kpage, PGSIZE))
+		PANIC ("zswap: compressed page is corrupt");
+}
+
+/* Writes the oldest entries in the pool to the swap disk, a batch of
+ * up to SWAP_BATCH_MAX of them in consecutive slots.  Returns false
+ * if there is nothing to write back or no room on the disk. */
+static bool
+write_back (void) {
+	struct zswap_entry *batch[SWAP_BATCH_MAX];
+	struct list_elem *e;
+	size_t cnt = 0, slot = SWAP_SLOT_NONE;
+
+	for (e = list_begin (&lru); cnt < SWAP_BATCH_MAX && e != list_end (&lru);
+			e = list_next (e))
+		batch[cnt++] = list_entry (e, struct zswap_entry, lru);
+	for (; cnt > 0; cnt /= 2)
+		if ((slot = swap_alloc (cnt)) != SWAP_SLOT_NONE)
+			break;
+	if (cnt == 0)
+		return false;
+
+	for (size_t i = 0; i < cnt; i++)
+		decompress (batch[i], bounce[i]);
+	swap_write (slot, bounce, cnt);
+	for (size_t i = 0; i < cnt; i++) {
+		list_remove (&batch[i]->lru);
+		zbud_free (batch[i]);
+		batch[i]->slot = slot + i;
+		entry_cnt--;
+	}
+	writeback_cnt += cnt;
+	return true;
+}
+
+/* Compresses KPAGE into the pool, writing older pages back to the
+ * swap disk to make room if the pool is full.  Returns the new entry,
+ * or a null pointer if there is no pool or the page did not compress
+ * well, in which case the caller writes it to the disk itself. */
+struct zswap_entry *
+zswap_store (const void *kpage) {
+	struct zswap_entry *e;
+	size_t size;
+
+	if (zswap_pct == 0 || (e = malloc (sizeof *e)) == NULL)
+		return NULL;
+
+	lock_acquire (&zswap_lock);
+	size = lz_compress (kpage, PGSIZE, zbuf, ZSWAP_MAX_SIZE, work);
+	if (size == 0) {
+		reject_cnt++;
+		goto fail;
+	}
+
+	e->size = size;
+	e->slot = SWAP_SLOT_NONE;
+	e->ref_cnt = 1;
+	while (!zbud_alloc (e))
+		if (!write_back ())
+			goto fail;
+	memcpy (entry_data (e), zbuf, size);
+	list_push_back (&lru, &e->lru);
+	entry_cnt++;
+	stored_cnt++;
+	stored_bytes += size;
+	lock_release (&zswap_lock);
+	return e;
+
+fail:
+	lock_release (&zswap_lock);
+	free (e);
+	return NULL;
+}
+
+/* Adds a reference to E, for another page whose copy it holds. */
+void
+zswap_dup (struct zswap_entry *e) {
+	lock_acquire (&zswap_lock);
+	e->ref_cnt++;
+	lock_release (&zswap_lock);
+}
+
+/* Puts the page that E holds back into KPAGE, if E is still in the
+ * pool, and returns SWAP_SLOT_NONE.  If E was written back, returns
+ * its swap slot instead, from which the caller reads the page itself
+ * and to which it holds a reference from now on.  Either way, drops
+ * the caller's reference to E, and frees E if it was the last. */
+size_t
+zswap_load (struct zswap_entry *e, void *kpage) {
+	size_t slot;
+	bool last;
+
+	lock_acquire (&zswap_lock);
+	slot = e->slot;
+	last = --e->ref_cnt == 0;
+	if (e->zpage != NULL) {
+		uint64_t start = rdtsc ();
+
+		decompress (e, kpage);
+		load_cycles += rdtsc () - start;
+		if (last) {
+			list_remove (&e->lru);
+			zbud_free (e);
+			entry_cnt--;
+		}
+		hit_cnt++;
+	} else {
+		if (!last)
+			swap_dup (slot);
+		miss_cnt++;
+	}
+	lock_release (&zswap_lock);
+	if (last)
+		free (e);
+	return slot;
+}
+
+/* Drops a reference to E, and frees E and whatever it holds if it
+ * was the last. */
+void
+zswap_invalidate (struct zswap_entry *e) {
+	bool last;
+
+	lock_acquire (&zswap_lock);
+	last = --e->ref_cnt == 0;
+	if (last && e->zpage != NULL) {
+		list_remove (&e->lru);
+		zbud_free (e);
+		entry_cnt--;
+	}
+	lock_release (&zswap_lock);
+	if (!last)
+		return;
+	if (e->slot != SWAP_SLOT_NONE)
+		swap_free (e->slot);
+	free (e);
+}
+
+/* Prints compressed swap statistics. */
+void
+zswap_print_stats (void) {
+	if (zswap_pct == 0)
+		return;
+	printf ("Zswap: %lld pages stored, %lld%% of their size on average, "
+			"%lld rejected, %lld written back\n",
+			stored_cnt, stored_cnt ? stored_bytes * 100 / (stored_cnt * PGSIZE) : 0,
+			reject_cnt, writeback_cnt);
+	printf ("Zswap: %lld loads, %lld%% from the pool, %llu cycles each; "
+			"pool of %zu pages for %zu entries, at most %zu of %zu\n",
+			hit_cnt + miss_cnt,
+			hit_cnt + miss_cnt ? hit_cnt * 100 / (hit_cnt + miss_cnt) : 0,
+			hit_cnt ? load_cycles / hit_cnt : 0,
+			pool_cnt, entry_cnt, pool_peak, pool_max);
+}